@@ -55,12 +55,8 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 	volatile VALUE	rstr = rb_str_new(str, len);
 
 	if (Qundef == rkey) {
-	    rkey = rb_str_new(key, klen);
 	    rstr = oj_encode(rstr);
-	    rkey = oj_encode(rkey);
-	    if (Yes == pi->options.sym_key) {
-		rkey = rb_str_intern(rkey);
-	    }
+	    rkey = oj_calc_hash_key(pi, key, klen);
 	}
 	rb_hash_aset(parent->val, rkey, rstr);
     }
@@ -89,7 +85,7 @@ calc_hash_key(ParseInfo pi, Val parent) {
     volatile VALUE	rkey = parent->key_val;
 
     if (Qundef == rkey) {
-	rkey = rb_str_new(parent->key, parent->klen);
+	return oj_calc_hash_key(pi, parent->key, parent->klen);
     }
     rkey = oj_encode(rkey);
     if (Yes == pi->options.sym_key) {
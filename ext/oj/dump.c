@@ -42,7 +42,10 @@
 
 #include "oj.h"
 #include "cache8.h"
+#include "dtoa.h"
+#include "nogvl.h"
 #include "odd.h"
+#include "scan.h"
 
 #if !HAS_ENCODING_SUPPORT || defined(RUBINIUS_RUBY)
 #define rb_eEncodingError	rb_eException
@@ -98,16 +101,13 @@ static void	dump_obj_attrs(VALUE obj, VALUE clas, slot_t id, int depth, Out out)
 static void	dump_odd(VALUE obj, Odd odd, VALUE clas, int depth, Out out);
 
 static void	grow(Out out, size_t len);
-static size_t	hibit_friendly_size(const uint8_t *str, size_t len);
-static size_t	xss_friendly_size(const uint8_t *str, size_t len);
-static size_t	ascii_friendly_size(const uint8_t *str, size_t len);
 
-static void	dump_leaf(Leaf leaf, int depth, Out out);
+static void	dump_leaf(Leaf leaf, LeafArena arena, int depth, Out out);
 static void	dump_leaf_str(Leaf leaf, Out out);
 static void	dump_leaf_fixnum(Leaf leaf, Out out);
 static void	dump_leaf_float(Leaf leaf, Out out);
-static void	dump_leaf_array(Leaf leaf, int depth, Out out);
-static void	dump_leaf_hash(Leaf leaf, int depth, Out out);
+static void	dump_leaf_array(Leaf leaf, LeafArena arena, int depth, Out out);
+static void	dump_leaf_hash(Leaf leaf, LeafArena arena, int depth, Out out);
 
 static const char	hex_chars[17] = "0123456789abcdef";
 
@@ -156,46 +156,6 @@ static char	xss_friendly_chars[256] = "\
 33333333333333333333333333333333\
 33333333333333333333333333333333";
 
-inline static size_t
-newline_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-
-    for (; 0 < len; str++, len--) {
-	size += newline_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-hibit_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-
-    for (; 0 < len; str++, len--) {
-	size += hibit_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-ascii_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-
-    for (; 0 < len; str++, len--) {
-	size += ascii_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-xss_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-
-    for (; 0 < len; str++, len--) {
-	size += xss_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
 inline static void
 fill_indent(Out out, int cnt) {
     if (0 < out->indent) {
@@ -229,10 +189,22 @@ dump_ulong(unsigned long num, Out out) {
 
 static void
 grow(Out out, size_t len) {
-    size_t  size = out->end - out->buf;
-    long    pos = out->cur - out->buf;
+    size_t  size;
+    long    pos;
     char    *buf;
-	
+
+    if (0 != out->flush && out->buf + 1 < out->cur) {
+	// All but the last character is written out since the dump functions
+	// may still back up over a trailing comma.
+	out->flush(out, out->buf, out->cur - out->buf - 1);
+	*out->buf = *(out->cur - 1);
+	out->cur = out->buf + 1;
+	if ((long)len < out->end - out->cur) {
+	    return;
+	}
+    }
+    size = out->end - out->buf;
+    pos = out->cur - out->buf;
     size *= 2;
     if (size <= len * 2 + pos) {
 	size += len;
@@ -445,6 +417,30 @@ static const char	inf_val[] = INF_VAL;
 static const char	ninf_val[] = NINF_VAL;
 static const char	nan_val[] = NAN_VAL;
 
+// Same as snprintf(buf, size, "%.1f", (double)num) for whole numbers.
+inline static int
+whole_float_fill(char *buf, long long int num) {
+    char		tmp[32];
+    char		*t = tmp + sizeof(tmp);
+    char		*b = buf;
+    unsigned long long	n = (0 > num) ? -(unsigned long long)num : (unsigned long long)num;
+
+    if (0 > num) {
+	*b++ = '-';
+    }
+    do {
+	*--t = '0' + (char)(n % 10);
+	n /= 10;
+    } while (0 < n);
+    memcpy(b, t, tmp + sizeof(tmp) - t);
+    b += tmp + sizeof(tmp) - t;
+    *b++ = '.';
+    *b++ = '0';
+    *b = '\0';
+
+    return (int)(b - buf);
+}
+
 // Removed dependencies on math due to problems with CentOS 5.4.
 static void
 dump_float(VALUE obj, Out out) {
@@ -563,7 +559,13 @@ dump_float(VALUE obj, Out out) {
 	    }
 	}
     } else if (d == (double)(long long int)d) {
-	cnt = snprintf(buf, sizeof(buf), "%.1f", d);
+	if (FastFloat == out->opts->float_format) {
+	    cnt = whole_float_fill(buf, (long long int)d);
+	} else {
+	    cnt = snprintf(buf, sizeof(buf), "%.1f", d);
+	}
+    } else if (FastFloat == out->opts->float_format) {
+	cnt = oj_dtoa(d, buf);
     } else if (0 == out->opts->float_prec) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
@@ -587,29 +589,21 @@ dump_float(VALUE obj, Out out) {
 
 static void
 dump_cstr(const char *str, size_t cnt, int is_sym, int escape1, Out out) {
-    size_t	size;
+    const char	*end = str + cnt;
+    const char	*clean;
     char	*cmap;
 
     switch (out->opts->escape_mode) {
-    case NLEsc:
-	cmap = newline_friendly_chars;
-	size = newline_friendly_size((uint8_t*)str, cnt);
-	break;
-    case ASCIIEsc:
-	cmap = ascii_friendly_chars;
-	size = ascii_friendly_size((uint8_t*)str, cnt);
-	break;
-    case XSSEsc:
-	cmap = xss_friendly_chars;
-	size = xss_friendly_size((uint8_t*)str, cnt);
-	break;
+    case NLEsc:		cmap = newline_friendly_chars;	break;
+    case ASCIIEsc:	cmap = ascii_friendly_chars;	break;
+    case XSSEsc:	cmap = xss_friendly_chars;	break;
     case JSONEsc:
-    default:
-	cmap = hibit_friendly_chars;
-	size = hibit_friendly_size((uint8_t*)str, cnt);
+    default:		cmap = hibit_friendly_chars;	break;
     }
-    if (out->end - out->cur <= (long)size + BUFFER_EXTRA) { // extra 10 for escaped first char, quotes, and sym
-	grow(out, size + BUFFER_EXTRA);
+    // There is always room for the rest of the string, the quotes, a
+    // symbol colon, and an escaped first character. Escapes grow as needed.
+    if (out->end - out->cur <= (long)cnt + BUFFER_EXTRA) {
+	grow(out, cnt + BUFFER_EXTRA);
     }
     *out->cur++ = '"';
     if (escape1) {
@@ -618,58 +612,60 @@ dump_cstr(const char *str, size_t cnt, int is_sym, int escape1, Out out) {
 	*out->cur++ = '0';
 	*out->cur++ = '0';
 	dump_hex((uint8_t)*str, out);
-	cnt--;
-	size--;
 	str++;
 	is_sym = 0; // just to make sure
     }
-    if (cnt == size) {
-	if (is_sym) {
-	    *out->cur++ = ':';
-	}
-	for (; '\0' != *str; str++) {
-	    *out->cur++ = *str;
+    if (is_sym) {
+	*out->cur++ = ':';
+    }
+    while (str < end) {
+	// Runs of characters that need no escaping are copied as a block and
+	// only the characters that do are looked up in the table.
+	clean = oj_scan_clean(str, end, out->opts->escape_mode, cmap);
+	if (str < clean) {
+	    memcpy(out->cur, str, clean - str);
+	    out->cur += clean - str;
+	    str = clean;
+	    if (end <= str) {
+		break;
+	    }
 	}
-	*out->cur++ = '"';
-    } else {
-	const char	*end = str + cnt;
-
-	if (is_sym) {
-	    *out->cur++ = ':';
+	// The longest escape is a 12 character surrogate pair.
+	if (out->end - out->cur <= (long)(end - str) + 12 + BUFFER_EXTRA) {
+	    grow(out, (end - str) + 12 + BUFFER_EXTRA);
 	}
-	for (; str < end; str++) {
-	    switch (cmap[(uint8_t)*str]) {
-	    case '1':
-		*out->cur++ = *str;
-		break;
-	    case '2':
-		*out->cur++ = '\\';
-		switch (*str) {
-		case '\\':	*out->cur++ = '\\';	break;
-		case '\b':	*out->cur++ = 'b';	break;
-		case '\t':	*out->cur++ = 't';	break;
-		case '\n':	*out->cur++ = 'n';	break;
-		case '\f':	*out->cur++ = 'f';	break;
-		case '\r':	*out->cur++ = 'r';	break;
-		default:	*out->cur++ = *str;	break;
-		}
-		break;
-	    case '3': // Unicode
-		str = dump_unicode(str, end, out);
-		break;
-	    case '6': // control characters
-		*out->cur++ = '\\';
-		*out->cur++ = 'u';
-		*out->cur++ = '0';
-		*out->cur++ = '0';
-		dump_hex((uint8_t)*str, out);
-		break;
-	    default:
-		break; // ignore, should never happen if the table is correct
+	switch (cmap[(uint8_t)*str]) {
+	case '1':
+	    *out->cur++ = *str;
+	    break;
+	case '2':
+	    *out->cur++ = '\\';
+	    switch (*str) {
+	    case '\\':	*out->cur++ = '\\';	break;
+	    case '\b':	*out->cur++ = 'b';	break;
+	    case '\t':	*out->cur++ = 't';	break;
+	    case '\n':	*out->cur++ = 'n';	break;
+	    case '\f':	*out->cur++ = 'f';	break;
+	    case '\r':	*out->cur++ = 'r';	break;
+	    default:	*out->cur++ = *str;	break;
 	    }
+	    break;
+	case '3': // Unicode
+	    str = dump_unicode(str, end, out);
+	    break;
+	case '6': // control characters
+	    *out->cur++ = '\\';
+	    *out->cur++ = 'u';
+	    *out->cur++ = '0';
+	    *out->cur++ = '0';
+	    dump_hex((uint8_t)*str, out);
+	    break;
+	default:
+	    break; // ignore, should never happen if the table is correct
 	}
-	*out->cur++ = '"';
+	str++;
     }
+    *out->cur++ = '"';
     *out->cur = '\0';
 }
 
@@ -2270,79 +2266,126 @@ oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VA
     }
 }
 
-void
-oj_write_obj_to_file(VALUE obj, const char *path, Options copts) {
-    char	buf[4096];
-    struct _Out out;
-    size_t	size;
+// Dumps to files and streams are written out in pieces of about this size
+// so memory use does not grow with the size of the JSON.
+#define FLUSH_SIZE	0x00010000
+
+typedef struct _WriteArgs {
+    VALUE	obj;
+    Leaf	leaf;	// dumped in place of obj if not 0
+    LeafArena	arena;
+    Options	copts;
+    struct _Out	out;
     FILE	*f;
-    int		ok;
-
-    out.buf = buf;
-    out.end = buf + sizeof(buf) - BUFFER_EXTRA;
-    out.allocated = 0;
-    out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_obj_to_json(obj, copts, &out);
-    size = out.cur - out.buf;
-    if (0 == (f = fopen(path, "w"))) {
-	if (out.allocated) {
-	    xfree(out.buf);
-	}
-	rb_raise(rb_eIOError, "%s\n", strerror(errno));
-    }
-    ok = (size == fwrite(out.buf, 1, size, f));
-    if (out.allocated) {
-	xfree(out.buf);
+} *WriteArgs;
+
+static void
+flush_file(Out out, const char *buf, size_t len) {
+    int	err = oj_fwrite(buf, len, (FILE*)out->flush_arg);
+
+    if (0 != err) {
+	rb_raise(rb_eIOError, "Write failed. [%d:%s]\n", err, strerror(err));
     }
-    fclose(f);
-    if (!ok) {
-	int	err = ferror(f);
+}
+
+#if !IS_WINDOWS
+static void
+flush_fd(Out out, const char *buf, size_t len) {
+    int	err = oj_write_fd(*(int*)out->flush_arg, buf, len);
 
+    if (0 != err) {
 	rb_raise(rb_eIOError, "Write failed. [%d:%s]\n", err, strerror(err));
     }
 }
+#endif
+
+static void
+flush_stream(Out out, const char *buf, size_t len) {
+    rb_funcall(*(VALUE*)out->flush_arg, oj_write_id, 1, rb_str_new(buf, len));
+}
+
+static VALUE
+write_obj(VALUE x) {
+    WriteArgs	wa = (WriteArgs)x;
+    Out		out = &wa->out;
+
+    out->buf = ALLOC_N(char, FLUSH_SIZE);
+    out->end = out->buf + FLUSH_SIZE - BUFFER_EXTRA;
+    out->allocated = 1;
+    if (0 != wa->leaf) {
+	oj_dump_leaf_to_json(wa->leaf, wa->arena, wa->copts, out);
+    } else {
+	oj_dump_obj_to_json(wa->obj, wa->copts, out);
+    }
+    if (out->buf < out->cur) {
+	out->flush(out, out->buf, out->cur - out->buf);
+    }
+    return Qnil;
+}
+
+static VALUE
+write_cleanup(VALUE x) {
+    WriteArgs	wa = (WriteArgs)x;
+
+    xfree(wa->out.buf);
+    if (0 != wa->f) {
+	fclose(wa->f);
+    }
+    return Qnil;
+}
+
+// Dumps obj, or the leaf if set, with the buffer written out by flush each
+// time it fills instead of growing. The buffer is freed and the file, if any, closed even if the
+// dump or a write raises.
+static void
+write_flushed(WriteArgs wa, void (*flush)(Out out, const char *buf, size_t len), void *arg) {
+    wa->out.buf = 0;
+    wa->out.flush = flush;
+    wa->out.flush_arg = arg;
+    wa->out.omit_nil = wa->copts->dump_opts.omit_nil;
+    rb_ensure(write_obj, (VALUE)wa, write_cleanup, (VALUE)wa);
+}
+
+void
+oj_write_obj_to_file(VALUE obj, const char *path, Options copts) {
+    struct _WriteArgs	wa;
+
+    if (0 == (wa.f = fopen(path, "w"))) {
+	rb_raise(rb_eIOError, "%s\n", strerror(errno));
+    }
+    wa.obj = obj;
+    wa.leaf = 0;
+    wa.copts = copts;
+    write_flushed(&wa, flush_file, wa.f);
+}
 
 void
 oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts) {
-    char	buf[4096];
-    struct _Out out;
-    ssize_t	size;
-    VALUE	clas = rb_obj_class(stream);
+    struct _WriteArgs	wa;
+    volatile VALUE	io = stream;
+    VALUE		clas = rb_obj_class(stream);
 #if !IS_WINDOWS
-    int		fd;
-    VALUE	s;
+    int			fd;
+    VALUE		s;
 #endif
 
-    out.buf = buf;
-    out.end = buf + sizeof(buf) - BUFFER_EXTRA;
-    out.allocated = 0;
-    out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_obj_to_json(obj, copts, &out);
-    size = out.cur - out.buf;
+    wa.obj = obj;
+    wa.leaf = 0;
+    wa.copts = copts;
+    wa.f = 0;
     if (oj_stringio_class == clas) {
-	rb_funcall(stream, oj_write_id, 1, rb_str_new(out.buf, size));
+	write_flushed(&wa, flush_stream, (void*)&io);
 #if !IS_WINDOWS
     } else if (rb_respond_to(stream, oj_fileno_id) &&
 	       Qnil != (s = rb_funcall(stream, oj_fileno_id, 0)) &&
 	       0 != (fd = FIX2INT(s))) {
-	if (size != write(fd, out.buf, size)) {
-	    if (out.allocated) {
-		xfree(out.buf);
-	    }
-	    rb_raise(rb_eIOError, "Write failed. [%d:%s]\n", errno, strerror(errno));
-	}
+	write_flushed(&wa, flush_fd, &fd);
 #endif
     } else if (rb_respond_to(stream, oj_write_id)) {
-	rb_funcall(stream, oj_write_id, 1, rb_str_new(out.buf, size));
+	write_flushed(&wa, flush_stream, (void*)&io);
     } else {
-	if (out.allocated) {
-	    xfree(out.buf);
-	}
 	rb_raise(rb_eArgError, "to_stream() expected an IO Object.");
     }
-    if (out.allocated) {
-	xfree(out.buf);
-    }
 }
 
 // dump leaf functions
@@ -2410,7 +2453,7 @@ dump_leaf_float(Leaf leaf, Out out) {
 }
 
 static void
-dump_leaf_array(Leaf leaf, int depth, Out out) {
+dump_leaf_array(Leaf leaf, LeafArena arena, int depth, Out out) {
     size_t	size;
     int		d2 = depth + 1;
 
@@ -2419,24 +2462,23 @@ dump_leaf_array(Leaf leaf, int depth, Out out) {
 	grow(out, size);
     }
     *out->cur++ = '[';
-    if (0 == leaf->elements) {
+    if (0 == leaf->cnt) {
 	*out->cur++ = ']';
     } else {
-	Leaf	first = leaf->elements->next;
-	Leaf	e = first;
+	Leaf	e = oj_leaf_at(arena, leaf->elements);
+	Leaf	last = e + leaf->cnt - 1;
 
 	size = d2 * out->indent + 2;
-	do {
+	for (; e <= last; e++) {
 	    if (out->end - out->cur <= (long)size) {
 		grow(out, size);
 	    }
 	    fill_indent(out, d2);
-	    dump_leaf(e, d2, out);
-	    if (e->next != first) {
+	    dump_leaf(e, arena, d2, out);
+	    if (e != last) {
 		*out->cur++ = ',';
 	    }
-	    e = e->next;
-	} while (e != first);
+	}
 	size = depth * out->indent + 1;
 	if (out->end - out->cur <= (long)size) {
 	    grow(out, size);
@@ -2448,7 +2490,7 @@ dump_leaf_array(Leaf leaf, int depth, Out out) {
 }
 
 static void
-dump_leaf_hash(Leaf leaf, int depth, Out out) {
+dump_leaf_hash(Leaf leaf, LeafArena arena, int depth, Out out) {
     size_t	size;
     int		d2 = depth + 1;
 
@@ -2457,26 +2499,25 @@ dump_leaf_hash(Leaf leaf, int depth, Out out) {
 	grow(out, size);
     }
     *out->cur++ = '{';
-    if (0 == leaf->elements) {
+    if (0 == leaf->cnt) {
 	*out->cur++ = '}';
     } else {
-	Leaf	first = leaf->elements->next;
-	Leaf	e = first;
+	Leaf	e = oj_leaf_at(arena, leaf->elements);
+	Leaf	last = e + leaf->cnt - 1;
 
 	size = d2 * out->indent + 2;
-	do {
+	for (; e <= last; e++) {
 	    if (out->end - out->cur <= (long)size) {
 		grow(out, size);
 	    }
 	    fill_indent(out, d2);
 	    dump_cstr(e->key, strlen(e->key), 0, 0, out);
 	    *out->cur++ = ':';
-	    dump_leaf(e, d2, out);
-	    if (e->next != first) {
+	    dump_leaf(e, arena, d2, out);
+	    if (e != last) {
 		*out->cur++ = ',';
 	    }
-	    e = e->next;
-	} while (e != first);
+	}
 	size = depth * out->indent + 1;
 	if (out->end - out->cur <= (long)size) {
 	    grow(out, size);
@@ -2488,7 +2529,7 @@ dump_leaf_hash(Leaf leaf, int depth, Out out) {
 }
 
 static void
-dump_leaf(Leaf leaf, int depth, Out out) {
+dump_leaf(Leaf leaf, LeafArena arena, int depth, Out out) {
     switch (leaf->rtype) {
     case T_NIL:
 	dump_nil(out);
@@ -2509,10 +2550,10 @@ dump_leaf(Leaf leaf, int depth, Out out) {
 	dump_leaf_float(leaf, out);
 	break;
     case T_ARRAY:
-	dump_leaf_array(leaf, depth, out);
+	dump_leaf_array(leaf, arena, depth, out);
 	break;
     case T_HASH:
-	dump_leaf_hash(leaf, depth, out);
+	dump_leaf_hash(leaf, arena, depth, out);
 	break;
     default:
 	rb_raise(rb_eTypeError, "Unexpected type %02x.\n", leaf->rtype);
@@ -2521,7 +2562,7 @@ dump_leaf(Leaf leaf, int depth, Out out) {
 }
 
 void
-oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out) {
+oj_dump_leaf_to_json(Leaf leaf, LeafArena arena, Options copts, Out out) {
     if (0 == out->buf) {
 	out->buf = ALLOC_N(char, 4096);
 	out->end = out->buf + 4095 - BUFFER_EXTRA; // 1 less than end plus extra for possible errors
@@ -2532,34 +2573,21 @@ oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out) {
     out->opts = copts;
     out->hash_cnt = 0;
     out->indent = copts->indent;
-    dump_leaf(leaf, 0, out);
+    dump_leaf(leaf, arena, 0, out);
 }
 
 void
-oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts) {
-    char	buf[4096];
-    struct _Out out;
-    size_t	size;
-    FILE	*f;
+oj_write_leaf_to_file(Leaf leaf, LeafArena arena, const char *path, Options copts) {
+    struct _WriteArgs	wa;
 
-    out.buf = buf;
-    out.end = buf + sizeof(buf) - BUFFER_EXTRA;
-    out.allocated = 0;
-    out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_leaf_to_json(leaf, copts, &out);
-    size = out.cur - out.buf;
-    if (0 == (f = fopen(path, "w"))) {
+    if (0 == (wa.f = fopen(path, "w"))) {
 	rb_raise(rb_eIOError, "%s\n", strerror(errno));
     }
-    if (size != fwrite(out.buf, 1, size, f)) {
-	int	err = ferror(f);
-
-	rb_raise(rb_eIOError, "Write failed. [%d:%s]\n", err, strerror(err));
-    }
-    if (out.allocated) {
-	xfree(out.buf);
-    }
-    fclose(f);
+    wa.obj = Qnil;
+    wa.leaf = leaf;
+    wa.arena = arena;
+    wa.copts = copts;
+    write_flushed(&wa, flush_file, wa.f);
 }
 
 // string writer functions
@@ -48,19 +48,22 @@ oj_err_raise(Err e) {
 }
 
 void
-_oj_err_set_with_location(Err err, VALUE eclas, const char *msg, const char *json, const char *current, const char* file, int line) {
-    int	n = 1;
+_oj_err_set_with_location(Err err, VALUE eclas, const char *msg, const char *json, const char *current, long first_line, const char* file, int line) {
+    long	n = first_line;
     int	col = 1;
 
     for (; json < current && '\n' != *current; current--) {
 	col++;
     }
+    if ('\n' == *current) {
+	col--;
+    }
     for (; json < current; current--) {
 	if ('\n' == *current) {
 	    n++;
 	}
     }
-    oj_err_set(err, eclas, "%s at line %d, column %d [%s:%d]", msg, n, col, file, line);
+    oj_err_set(err, eclas, "%s at line %ld, column %d [%s:%d]", msg, n, col, file, line);
 }
 
 void
@@ -72,6 +75,9 @@ _oj_raise_error(const char *msg, const char *json, const char *current, const ch
     for (; json < current && '\n' != *current; current--) {
 	col++;
     }
+    if ('\n' == *current) {
+	col--;
+    }
     for (; json < current; current--) {
 	if ('\n' == *current) {
 	    n++;
@@ -33,7 +33,7 @@
 
 #include "ruby.h"
 
-#define set_error(err, eclas, msg, json, current) _oj_err_set_with_location(err, eclas, msg, json, current, __FILE__, __LINE__)
+#define set_error(err, eclas, msg, json, current) _oj_err_set_with_location(err, eclas, msg, json, current, 1, __FILE__, __LINE__)
 
 typedef struct _Err {
     VALUE	clas;
@@ -43,7 +43,7 @@ typedef struct _Err {
 extern VALUE	oj_parse_error_class;
 
 extern void	oj_err_set(Err e, VALUE clas, const char *format, ...);
-extern void	_oj_err_set_with_location(Err err, VALUE eclas, const char *msg, const char *json, const char *current, const char* file, int line);
+extern void	_oj_err_set_with_location(Err err, VALUE eclas, const char *msg, const char *json, const char *current, long first_line, const char* file, int line);
 extern void	oj_err_raise(Err e);
 
 #define raise_error(msg, json, current) _oj_raise_error(msg, json, current, __FILE__, __LINE__)
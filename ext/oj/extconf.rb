@@ -53,6 +53,24 @@ end
 
 dflags['OJ_DEBUG'] = true unless ENV['OJ_DEBUG'].nil?
 
+# String scanning uses the widest vector instructions the compiler already
+# targets. Set OJ_SIMD to avx2, sse2, or none to override the choice.
+simd = ENV['OJ_SIMD']
+if simd.nil?
+  if try_compile("#include <immintrin.h>\n#ifndef __AVX2__\n#error no AVX2\n#endif\nint main() { return 0; }\n")
+    simd = 'avx2'
+  elsif try_compile("#include <emmintrin.h>\n#ifndef __SSE2__\n#error no SSE2\n#endif\nint main() { return 0; }\n")
+    simd = 'sse2'
+  end
+end
+case simd
+when 'avx2'
+  dflags['OJ_USE_AVX2'] = 1
+  $CFLAGS += ' -mavx2'
+when 'sse2'
+  dflags['OJ_USE_SSE2'] = 1
+end
+
 dflags.each do |k,v|
   if v.nil?
     $CPPFLAGS += " -D#{k}"
@@ -61,6 +79,11 @@ dflags.each do |k,v|
   end
 end
 
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_ext_ractor_safe', 'ruby.h')
+have_func('rb_ractor_local_storage_ptr_newkey', 'ruby/ractor.h')
+have_func('rb_hash_new_capa', 'ruby.h')
+
 $CPPFLAGS += ' -Wall'
 #puts "*** $CPPFLAGS: #{$CPPFLAGS}"
 create_makefile("#{extension_name}/#{extension_name}")
@@ -28,9 +28,6 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#if !IS_WINDOWS
-#include <sys/resource.h>  // for getrlimit() on linux
-#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -39,70 +36,90 @@
 
 #include "oj.h"
 #include "encode.h"
+#include "mapped.h"
+#include "nogvl.h"
+#include "scan.h"
 
 // maximum to allocate on the stack, arbitrary limit
 #define SMALL_XML	65536
 #define MAX_STACK	100
-//#define BATCH_SIZE	(4096 / sizeof(struct _Leaf) - 1)
-#define BATCH_SIZE	100
-
-typedef struct _Batch {
-    struct _Batch	*next;
-    int			next_avail;
-    struct _Leaf	leaves[BATCH_SIZE];
-} *Batch;
+// A hash is indexed after INDEX_HITS key lookups if it has at least
+// INDEX_MIN elements.
+#define INDEX_HITS	4
+#define INDEX_MIN	16
+#define NO_INDEX	0xFF
+#define MAX_INDEX_KEY	256
+
+// Open addressing table of the elements of a hash by key.
+typedef struct _Index {
+    Leaf		*slots;
+    uint32_t		mask;	     // slot count - 1
+} *Index;
 
 typedef struct _Doc {
     Leaf		data;
     Leaf		*where;	     // points to current location
     Leaf		where_path[MAX_STACK]; // points to head of path
     char		*json;
+    char		*end;	     // end of json, always a '\0'
+    size_t		map_len;     // length of the file if json is mapped
+    int			lazy;	     // arrays and hashes are parsed when first used
     unsigned long	size;	     // number of leaves/branches in the doc
     VALUE		self;
-    Batch		batches;
-    struct _Batch	batch0;
+    struct _LeafArena	arena;
+    Leaf		stack;	     // open arrays and hashes and their elements while reading
+    size_t		stack_len;
+    size_t		stack_size;
+    Index		indexes;
+    uint32_t		index_cnt;
+    uint32_t		index_size;
 } *Doc;
 
 typedef struct _ParseInfo {
     char	*str;		/* buffer being read from */
     char	*s;		/* current position in buffer */
+    char	*end;		/* end of buffer, always a '\0' */
     Doc		doc;
-    void	*stack_min;
 } *ParseInfo;
 
 static void	leaf_init(Leaf leaf, int type);
-static Leaf	leaf_new(Doc doc, int type);
-static void	leaf_append_element(Leaf parent, Leaf element);
+static long	leaf_push(Doc doc, int type);
+static void	col_close(Doc doc, long cp);
 static VALUE	leaf_value(Doc doc, Leaf leaf);
 static void	leaf_fixnum_value(Leaf leaf);
 static void	leaf_float_value(Leaf leaf);
 static VALUE	leaf_array_value(Doc doc, Leaf leaf);
 static VALUE	leaf_hash_value(Doc doc, Leaf leaf);
 
-static Leaf	read_next(ParseInfo pi);
-static Leaf	read_obj(ParseInfo pi);
-static Leaf	read_array(ParseInfo pi);
-static Leaf	read_str(ParseInfo pi);
-static Leaf	read_num(ParseInfo pi);
-static Leaf	read_true(ParseInfo pi);
-static Leaf	read_false(ParseInfo pi);
-static Leaf	read_nil(ParseInfo pi);
+static long	read_next(ParseInfo pi);
+static void	read_members(ParseInfo pi, long cp);
+static void	skip_col(ParseInfo pi, Leaf leaf);
+static void	leaf_expand(Doc doc, Leaf leaf);
+static void	leaf_expand_all(Doc doc, Leaf leaf);
+static long	read_str(ParseInfo pi);
+static long	read_num(ParseInfo pi);
+static long	read_true(ParseInfo pi);
+static long	read_false(ParseInfo pi);
+static long	read_nil(ParseInfo pi);
 static void	next_non_white(ParseInfo pi);
 static char*	read_quoted_value(ParseInfo pi);
 static void	skip_comment(ParseInfo pi);
 
 static VALUE	protect_open_proc(VALUE x);
-static VALUE	parse_json(VALUE clas, char *json, int given, int allocated);
+static VALUE	parse_json(VALUE clas, char *json, size_t len, int given, int allocated, size_t map_len, int lazy);
 static void	each_leaf(Doc doc, VALUE self);
 static int	move_step(Doc doc, const char *path, int loc);
 static Leaf	get_doc_leaf(Doc doc, const char *path);
-static Leaf	get_leaf(Leaf *stack, Leaf *lp, const char *path);
+static Leaf	get_leaf(Doc doc, Leaf *stack, Leaf *lp, const char *path);
+static Leaf	child_at(Doc doc, Leaf col, int cnt);
+static uint32_t	arena_alloc(Doc doc, uint32_t cnt);
+static Leaf	child_by_key(Doc doc, Leaf col, const char *key, int klen);
 static void	each_value(Doc doc, Leaf leaf);
 
 static void	doc_init(Doc doc);
 static void	doc_free(Doc doc);
-static VALUE	doc_open(VALUE clas, VALUE str);
-static VALUE	doc_open_file(VALUE clas, VALUE filename);
+static VALUE	doc_open(int argc, VALUE *argv, VALUE clas);
+static VALUE	doc_open_file(int argc, VALUE *argv, VALUE clas);
 static VALUE	doc_where(VALUE self);
 static VALUE	doc_local_key(VALUE self);
 static VALUE	doc_home(VALUE self);
@@ -117,6 +134,8 @@ static VALUE	doc_size(VALUE self);
 
 VALUE	oj_doc_class = 0;
 
+static VALUE	lazy_sym;
+
 // This is only for CentOS 5.4 with Ruby 1.9.3-p0.
 #ifdef NEEDS_STPCPY
 char *stpcpy(char *dest, const char *src) {
@@ -169,13 +188,15 @@ ulong_fill(char *s, size_t num) {
 
 inline static void
 leaf_init(Leaf leaf, int type) {
-    leaf->next = 0;
     leaf->rtype = type;
     leaf->parent_type = T_NONE;
+    leaf->hits = 0;
+    leaf->index_id = 0;
     switch (type) {
     case T_ARRAY:
     case T_HASH:
 	leaf->elements = 0;
+	leaf->cnt = 0;
 	leaf->value_type = COL_VAL;
 	break;
     case T_NIL:
@@ -199,36 +220,74 @@ leaf_init(Leaf leaf, int type) {
     }
 }
 
-inline static Leaf
-leaf_new(Doc doc, int type) {
-    Leaf	leaf;
+/* Leaves are read onto a stack. When an array or hash is closed its elements
+ * are on the top of the stack and are moved together into the arena. Returns
+ * the stack position of the new leaf which stays valid while the stack grows
+ * unlike a pointer.
+ */
+inline static long
+leaf_push(Doc doc, int type) {
+    if (doc->stack_len == doc->stack_size) {
+	doc->stack_size = (0 == doc->stack_size) ? 256 : doc->stack_size * 2;
+	REALLOC_N(doc->stack, struct _Leaf, doc->stack_size);
+    }
+    leaf_init(doc->stack + doc->stack_len, type);
 
-    if (0 == doc->batches || BATCH_SIZE == doc->batches->next_avail) {
-	Batch	b = ALLOC(struct _Batch);
+    return (long)doc->stack_len++;
+}
 
-	// Initializes all leaves with a NO_VAL value_type
-	memset(b, 0, sizeof(struct _Batch));
-	b->next = doc->batches;
-	doc->batches = b;
-	b->next_avail = 0;
+// Returns the arena position of cnt contiguous leaves.
+static uint32_t
+arena_alloc(Doc doc, uint32_t cnt) {
+    LeafArena	arena = &doc->arena;
+    int		k = arena->cur;
+    uint32_t	pos = arena->next;
+
+    while (oj_leaf_chunk_start(k + 1) - pos < cnt) {
+	k++;
+	if (LEAF_CHUNK_MAX <= k) {
+	    rb_raise(rb_eNoMemError, "JSON document has too many elements.");
+	}
+	pos = oj_leaf_chunk_start(k);
+    }
+    if (0 == arena->chunks[k]) {
+	arena->chunks[k] = ALLOC_N(struct _Leaf, (size_t)1 << (k + LEAF_CHUNK_SHIFT));
     }
-    leaf = &doc->batches->leaves[doc->batches->next_avail];
-    doc->batches->next_avail++;
-    leaf_init(leaf, type);
+    arena->cur = k;
+    arena->next = pos + cnt;
 
-    return leaf;
+    return pos;
 }
 
-inline static void
-leaf_append_element(Leaf parent, Leaf element) {
-    if (0 == parent->elements) {
-	parent->elements = element;
-	element->next = element;
-    } else {
-	element->next = parent->elements->next;
-	parent->elements->next = element;
-	parent->elements = element;
+// Moves the elements above the array or hash at stack position cp into the
+// arena.
+static void
+col_close(Doc doc, long cp) {
+    Leaf	col = doc->stack + cp;
+    uint32_t	cnt = (uint32_t)(doc->stack_len - cp - 1);
+
+    col->elements = 0;
+    col->cnt = cnt;
+    if (0 < cnt) {
+	col->elements = arena_alloc(doc, cnt);
+	memcpy(oj_leaf_at(&doc->arena, col->elements), col + 1, sizeof(struct _Leaf) * cnt);
+    }
+    doc->stack_len = cp + 1;
+}
+
+inline static Leaf
+leaf_elements(Doc doc, Leaf col) {
+    return oj_leaf_at(&doc->arena, col->elements);
+}
+
+// Returns the value_type of the leaf after parsing the members of a lazy array
+// or hash.
+inline static int
+ready_type(Doc doc, Leaf leaf) {
+    if (LAZY_VAL == leaf->value_type) {
+	leaf_expand(doc, leaf);
     }
+    return leaf->value_type;
 }
 
 static VALUE
@@ -360,14 +419,14 @@ static VALUE
 leaf_array_value(Doc doc, Leaf leaf) {
     VALUE	a = rb_ary_new();
 
-    if (0 != leaf->elements) {
-	Leaf	first = leaf->elements->next;
-	Leaf	e = first;
+    ready_type(doc, leaf);
+    if (0 != leaf->cnt) {
+	Leaf	e = leaf_elements(doc, leaf);
+	Leaf	end = e + leaf->cnt;
 
-	do {
+	for (; e < end; e++) {
 	    rb_ary_push(a, leaf_value(doc, e));
-	    e = e->next;
-	} while (e != first);
+	}
     }
     return a;
 }
@@ -376,35 +435,42 @@ static VALUE
 leaf_hash_value(Doc doc, Leaf leaf) {
     VALUE	h = rb_hash_new();
 
-    if (0 != leaf->elements) {
-	Leaf	first = leaf->elements->next;
-	Leaf	e = first;
+    ready_type(doc, leaf);
+    if (0 != leaf->cnt) {
+	Leaf	e = leaf_elements(doc, leaf);
+	Leaf	end = e + leaf->cnt;
 	VALUE	key;
 
-	do {
+	for (; e < end; e++) {
 	    key = rb_str_new2(e->key);
 	    key = oj_encode(key);
 	    rb_hash_aset(h, key, leaf_value(doc, e));
-	    e = e->next;
-	} while (e != first);
+	}
     }
     return h;
 }
 
-static Leaf
-read_next(ParseInfo pi) {
-    Leaf	leaf = 0;
+// Reads a value. An array or hash is only pushed and, unless the doc is
+// lazy, its members are left for read_members(). Returns -1 if there is no
+// value.
+static long
+read_value(ParseInfo pi) {
+    Doc		doc = pi->doc;
+    long	leaf = -1;
 
-    if ((void*)&leaf < pi->stack_min) {
-	rb_raise(rb_eSysStackError, "JSON is too deeply nested");
-    }
     next_non_white(pi);	// skip white space
     switch (*pi->s) {
     case '{':
-	leaf = read_obj(pi);
+	leaf = leaf_push(doc, T_HASH);
+	if (doc->lazy) {
+	    skip_col(pi, doc->stack + leaf);
+	}
 	break;
     case '[':
-	leaf = read_array(pi);
+	leaf = leaf_push(doc, T_ARRAY);
+	if (doc->lazy) {
+	    skip_col(pi, doc->stack + leaf);
+	}
 	break;
     case '"':
 	leaf = read_str(pi);
@@ -434,115 +500,260 @@ read_next(ParseInfo pi) {
 	break;
     case '\0':
     default:
-	break; // returns 0
+	break; // returns -1
     }
-    pi->doc->size++;
+    doc->size++;
 
     return leaf;
 }
 
-static Leaf
-read_obj(ParseInfo pi) {
-    Leaf	h = leaf_new(pi->doc, T_HASH);
-    char	*end;
+inline static int
+col_unread(Leaf leaf) {
+    return (T_HASH == leaf->rtype || T_ARRAY == leaf->rtype) && COL_VAL == leaf->value_type;
+}
+
+static const char*
+read_key(ParseInfo pi) {
     const char	*key = 0;
-    Leaf	val = 0;
+
+    next_non_white(pi);
+    if ('"' != *pi->s || 0 == (key = read_quoted_value(pi))) {
+	raise_error("unexpected character", pi->str, pi->s);
+    }
+    next_non_white(pi);
+    if (':' == *pi->s) {
+	pi->s++;
+    } else {
+	raise_error("invalid format, expected :", pi->str, pi->s);
+    }
+    return key;
+}
+
+// Moves past the opening character of the array or hash at stack position
+// cp. Returns 0 if it was empty and has been closed. Otherwise the key of
+// the first member of a hash is read.
+static int
+col_open(ParseInfo pi, long cp, const char **keyp) {
+    Doc		doc = pi->doc;
+    int		hash = (T_HASH == doc->stack[cp].rtype);
 
     pi->s++;
     next_non_white(pi);
-    if ('}' == *pi->s) {
+    if ((hash ? '}' : ']') == *pi->s) {
 	pi->s++;
-	return h;
+	col_close(doc, cp);
+	return 0;
+    }
+    if (hash) {
+	*keyp = read_key(pi);
+    }
+    return 1;
+}
+
+/* Reads the members of the array or hash at stack position cp starting at
+ * its opening character. Nested arrays and hashes are read in the same loop
+ * instead of by recursion so there is no depth limit. While one is open its
+ * elements field holds the stack position of the enclosing open array or
+ * hash plus one since it is not set until the array or hash is closed.
+ */
+static void
+read_members(ParseInfo pi, long cp) {
+    Doc		doc = pi->doc;
+    long	col = cp; // innermost open array or hash
+    long	leaf;
+    Leaf	lp;
+    const char	*key = 0;
+    char	*end;
+
+    if (!col_open(pi, cp, &key)) {
+	return;
     }
     while (1) {
-	next_non_white(pi);
-	key = 0;
-	val = 0;
-	if ('"' != *pi->s || 0 == (key = read_quoted_value(pi))) {
+	if (0 > (leaf = read_value(pi))) {
 	    raise_error("unexpected character", pi->str, pi->s);
 	}
-	next_non_white(pi);
-	if (':' == *pi->s) {
-	    pi->s++;
+	lp = doc->stack + leaf;
+	if (T_HASH == doc->stack[col].rtype) {
+	    lp->key = key;
+	    lp->parent_type = T_HASH;
 	} else {
-	    raise_error("invalid format, expected :", pi->str, pi->s);
+	    lp->index = leaf - col;
+	    lp->parent_type = T_ARRAY;
 	}
-	if (0 == (val = read_next(pi))) {
-	    //printf("*** '%s'\n", pi->s);
-	    raise_error("unexpected character", pi->str, pi->s);
+	if (col_unread(lp)) {
+	    lp->elements = (uint32_t)(col + 1);
+	    if (col_open(pi, leaf, &key)) {
+		col = leaf;
+		continue;
+	    }
 	}
-	end = pi->s;
-	val->key = key;
-	val->parent_type = T_HASH;
-	leaf_append_element(h, val);
-	next_non_white(pi);
-	if ('}' == *pi->s) {
-	    pi->s++;
-	    *end = '\0';
-	    break;
-	} else if (',' == *pi->s) {
-	    pi->s++;
-	} else {
-	    //printf("*** '%s'\n", pi->s);
-	    raise_error("invalid format, expected , or } while in an object", pi->str, pi->s);
+	// The value is complete so either another member follows or the
+	// innermost open array or hash, now a complete value itself, ends.
+	while (1) {
+	    lp = doc->stack + col;
+	    end = pi->s;
+	    next_non_white(pi);
+	    if (',' == *pi->s) {
+		pi->s++;
+		*end = '\0';
+		if (T_HASH == lp->rtype) {
+		    key = read_key(pi);
+		}
+		break;
+	    }
+	    if (((T_HASH == lp->rtype) ? '}' : ']') == *pi->s) {
+		long	parent = (long)lp->elements - 1;
+
+		pi->s++;
+		*end = '\0';
+		col_close(doc, col);
+		if (cp == col) {
+		    return;
+		}
+		col = parent;
+		continue;
+	    }
+	    if (T_HASH == lp->rtype) {
+		raise_error("invalid format, expected , or } while in an object", pi->str, pi->s);
+	    } else {
+		raise_error("invalid format, expected , or ] while in an array", pi->str, pi->s);
+	    }
 	}
-	*end = '\0';
     }
-    return h;
 }
 
-static Leaf
-read_array(ParseInfo pi) {
-    Leaf	a = leaf_new(pi->doc, T_ARRAY);
-    Leaf	e;
-    char	*end;
-    int		cnt = 0;
+static long
+read_next(ParseInfo pi) {
+    long	leaf = read_value(pi);
 
-    pi->s++;
-    next_non_white(pi);
-    if (']' == *pi->s) {
-	pi->s++;
-	return a;
+    if (0 <= leaf && col_unread(pi->doc->stack + leaf)) {
+	read_members(pi, leaf);
     }
-    while (1) {
-	next_non_white(pi);
-	if (0 == (e = read_next(pi))) {
-	    raise_error("unexpected character", pi->str, pi->s);
-	}
-	cnt++;
-	e->index = cnt;
-	e->parent_type = T_ARRAY;
-	leaf_append_element(a, e);
-	end = pi->s;
-	next_non_white(pi);
-	if (',' == *pi->s) {
-	    pi->s++;
-	} else if (']' == *pi->s) {
-	    pi->s++;
-	    *end = '\0';
+    return leaf;
+}
+
+/* Skips over an array or hash without creating leaves for the members. Only
+ * the nesting and strings are followed so errors inside are not reported
+ * until the leaf is expanded. Members are still counted for Doc#size.
+ */
+static void
+skip_col(ParseInfo pi, Leaf leaf) {
+    Doc		doc = pi->doc;
+    int		depth = 0;
+    int		empty = 0;
+
+    leaf->str = pi->s;
+    leaf->value_type = LAZY_VAL;
+    for (; 1; pi->s++) {
+	switch (*pi->s) {
+	case ' ':
+	case '\t':
+	case '\f':
+	case '\n':
+	case '\r':
+	    break;
+	case '/':
+	    skip_comment(pi);
+	    if ('\0' == *pi->s) {
+		raise_error("comment not terminated", pi->str, pi->s);
+	    }
+	    break;
+	case '{':
+	case '[':
+	    if (empty) {
+		doc->size++;
+	    }
+	    depth++;
+	    empty = 1;
+	    break;
+	case '}':
+	case ']':
+	    empty = 0;
+	    if (0 == --depth) {
+		pi->s++;
+		return;
+	    }
+	    break;
+	case ',':
+	    doc->size++;
+	    break;
+	case '"':
+	    if (empty) {
+		doc->size++;
+		empty = 0;
+	    }
+	    for (pi->s++; 1; pi->s += 2) {
+		pi->s = (char*)oj_scan_str(pi->s, pi->end);
+		if ('"' == *pi->s) {
+		    break;
+		}
+		if ('\0' == *pi->s || '\0' == pi->s[1]) {
+		    raise_error("quoted string not terminated", pi->str, pi->s);
+		}
+	    }
+	    break;
+	case '\0':
+	    raise_error("invalid format, array or object not terminated", pi->str, pi->s);
+	    break;
+	default:
+	    if (empty) {
+		doc->size++;
+		empty = 0;
+	    }
 	    break;
-	} else {
-	    raise_error("invalid format, expected , or ] while in an array", pi->str, pi->s);
 	}
-	*end = '\0';
     }
-    return a;
 }
 
-static Leaf
+/* Parses the direct members of a lazy leaf. Member arrays and hashes are left
+ * lazy. The members were already counted when the leaf was skipped.
+ */
+static void
+leaf_expand(Doc doc, Leaf leaf) {
+    struct _ParseInfo	pi;
+    unsigned long	size = doc->size;
+    long		cp;
+
+    pi.str = doc->json;
+    pi.s = leaf->str;
+    pi.end = doc->end;
+    pi.doc = doc;
+    doc->stack_len = 0; // left over if an earlier read raised
+    cp = leaf_push(doc, leaf->rtype);
+    read_members(&pi, cp);
+    leaf->elements = doc->stack[cp].elements;
+    leaf->cnt = doc->stack[cp].cnt;
+    leaf->value_type = COL_VAL;
+    doc->stack_len = 0;
+    doc->size = size;
+}
+
+static void
+leaf_expand_all(Doc doc, Leaf leaf) {
+    if (COL_VAL == ready_type(doc, leaf) && 0 != leaf->cnt) {
+	Leaf	e = leaf_elements(doc, leaf);
+	Leaf	end = e + leaf->cnt;
+
+	for (; e < end; e++) {
+	    leaf_expand_all(doc, e);
+	}
+    }
+}
+
+static long
 read_str(ParseInfo pi) {
-    Leaf	leaf = leaf_new(pi->doc, T_STRING);
+    long	leaf = leaf_push(pi->doc, T_STRING);
 
-    leaf->str = read_quoted_value(pi);
+    pi->doc->stack[leaf].str = read_quoted_value(pi);
 
     return leaf;
 }
 
-static Leaf
+static long
 read_num(ParseInfo pi) {
     char	*start = pi->s;
     int		type = T_FIXNUM;
-    Leaf	leaf;
+    long	leaf;
 
     if ('-' == *pi->s) {
 	pi->s++;
@@ -564,15 +775,15 @@ read_num(ParseInfo pi) {
 	for (; '0' <= *pi->s && *pi->s <= '9'; pi->s++) {
 	}
     }
-    leaf = leaf_new(pi->doc, type);
-    leaf->str = start;
+    leaf = leaf_push(pi->doc, type);
+    pi->doc->stack[leaf].str = start;
 
     return leaf;
 }
 
-static Leaf
+static long
 read_true(ParseInfo pi) {
-    Leaf	leaf = leaf_new(pi->doc, T_TRUE);
+    long	leaf = leaf_push(pi->doc, T_TRUE);
 
     pi->s++;
     if ('r' != *pi->s || 'u' != *(pi->s + 1) || 'e' != *(pi->s + 2)) {
@@ -583,9 +794,9 @@ read_true(ParseInfo pi) {
     return leaf;
 }
 
-static Leaf
+static long
 read_false(ParseInfo pi) {
-    Leaf	leaf = leaf_new(pi->doc, T_FALSE);
+    long	leaf = leaf_push(pi->doc, T_FALSE);
 
     pi->s++;
     if ('a' != *pi->s || 'l' != *(pi->s + 1) || 's' != *(pi->s + 2) || 'e' != *(pi->s + 3)) {
@@ -596,9 +807,9 @@ read_false(ParseInfo pi) {
     return leaf;
 }
 
-static Leaf
+static long
 read_nil(ParseInfo pi) {
-    Leaf	leaf = leaf_new(pi->doc, T_NIL);
+    long	leaf = leaf_push(pi->doc, T_NIL);
 
     pi->s++;
     if ('u' != *pi->s || 'l' != *(pi->s + 1) || 'l' != *(pi->s + 2)) {
@@ -676,7 +887,19 @@ read_quoted_value(ParseInfo pi) {
     h++;	// skip quote character
     t++;
     value = h;
-    for (; '"' != *h; h++, t++) {
+    while (1) {
+	char	*s = (char*)oj_scan_str(h, pi->end);
+
+	// Plain characters only need to be moved down once an escape has
+	// shortened the value.
+	if (t != h) {
+	    memmove(t, h, s - h);
+	}
+	t += s - h;
+	h = s;
+	if ('"' == *h) {
+	    break;
+	}
 	if ('\0' == *h) {
 	    pi->s = h;
 	    raise_error("quoted string not terminated", pi->str, pi->s);
@@ -721,9 +944,9 @@ read_quoted_value(ParseInfo pi) {
 		raise_error("invalid escaped character", pi->str, pi->s);
 		break;
 	    }
-	} else if (t != h) {
-	    *t = *h;
 	}
+	h++;
+	t++;
     }
     *t = '\0'; // terminate value
     pi->s = h + 1;
@@ -737,19 +960,31 @@ doc_init(Doc doc) {
     memset(doc, 0, sizeof(struct _Doc));
     doc->where = doc->where_path;
     doc->self = Qundef;
-    doc->batches = &doc->batch0;
 }
 
 static void
 doc_free(Doc doc) {
     if (0 != doc) {
-	Batch	b;
+	int	k;
+
+	for (k = 0; k < LEAF_CHUNK_MAX; k++) {
+	    if (0 != doc->arena.chunks[k]) {
+		xfree(doc->arena.chunks[k]);
+		doc->arena.chunks[k] = 0;
+	    }
+	}
+	if (0 != doc->stack) {
+	    xfree(doc->stack);
+	    doc->stack = 0;
+	}
+	if (0 != doc->indexes) {
+	    uint32_t	i;
 
-	while (0 != (b = doc->batches)) {
-	    doc->batches = doc->batches->next;
-	    if (&doc->batch0 != b) {
-		xfree(b);
+	    for (i = 0; i < doc->index_cnt; i++) {
+		xfree(doc->indexes[i].slots);
 	    }
+	    xfree(doc->indexes);
+	    doc->indexes = 0;
 	}
 	//xfree(f);
     }
@@ -759,7 +994,19 @@ static VALUE
 protect_open_proc(VALUE x) {
     ParseInfo	pi = (ParseInfo)x;
 
-    pi->doc->data = read_next(pi); // parse
+    Doc		doc = pi->doc;
+    long	root = read_next(pi); // parse
+
+    if (0 <= root) {
+	doc->data = oj_leaf_at(&doc->arena, arena_alloc(doc, 1));
+	*doc->data = doc->stack[root];
+    }
+    doc->stack_len = 0;
+    if (!doc->lazy) { // only needed again to expand lazy leaves
+	xfree(doc->stack);
+	doc->stack = 0;
+	doc->stack_size = 0;
+    }
     *pi->doc->where = pi->doc->data;
     pi->doc->where = pi->doc->where_path;
     if (rb_block_given_p()) {
@@ -768,18 +1015,27 @@ protect_open_proc(VALUE x) {
     return Qnil;
 }
 
+static void
+free_json(char *json, size_t map_len) {
+    if (0 != map_len) {
+	oj_unmap_file(json, map_len);
+    } else {
+	xfree(json);
+    }
+}
+
 static void
 free_doc_cb(void *x) {
     Doc	doc = (Doc)x;
 
     if (0 != doc) {
-	xfree(doc->json);
+	free_json(doc->json, doc->map_len);
 	doc_free(doc);
     }
 }
 
 static VALUE
-parse_json(VALUE clas, char *json, int given, int allocated) {
+parse_json(VALUE clas, char *json, size_t len, int given, int allocated, size_t map_len, int lazy) {
     struct _ParseInfo	pi;
     VALUE		result = Qnil;
     Doc			doc;
@@ -797,21 +1053,11 @@ parse_json(VALUE clas, char *json, int given, int allocated) {
 	pi.str = json;
     }
     pi.s = pi.str;
+    pi.end = json + len;
     doc_init(doc);
+    doc->end = pi.end;
+    doc->lazy = lazy;
     pi.doc = doc;
-#if IS_WINDOWS
-    pi.stack_min = (void*)((char*)&pi - (512 * 1024)); // assume a 1M stack and give half to ruby
-#else
-    {
-	struct rlimit	lim;
-
-	if (0 == getrlimit(RLIMIT_STACK, &lim)) {
-	    pi.stack_min = (void*)((char*)&lim - (lim.rlim_cur / 4 * 3)); // let 3/4ths of the stack be used only
-	} else {
-	    pi.stack_min = 0; // indicates not to check stack limit
-	}
-    }
-#endif
     // last arg is free func void* func(void*)
 #if HAS_DATA_OBJECT_WRAP
     doc->self = rb_data_object_wrap(clas, doc, 0, free_doc_cb);
@@ -820,6 +1066,7 @@ parse_json(VALUE clas, char *json, int given, int allocated) {
 #endif
     rb_gc_register_address(&doc->self);
     doc->json = json;
+    doc->map_len = map_len;
     DATA_PTR(doc->self) = doc;
     result = rb_protect(protect_open_proc, (VALUE)&pi, &ex);
     if (given || 0 != ex) {
@@ -827,7 +1074,7 @@ parse_json(VALUE clas, char *json, int given, int allocated) {
 	DATA_PTR(doc->self) = 0;
 	doc_free(pi.doc);
 	if (allocated && 0 != ex) { // will jump so caller will not free
-	    xfree(json);
+	    free_json(json, map_len);
 	}
     } else {
 	result = doc->self;
@@ -862,7 +1109,7 @@ get_doc_leaf(Doc doc, const char *path) {
 	    memcpy(stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
 	    lp = stack + cnt;
 	}
-	return get_leaf(stack, lp, path);
+	return get_leaf(doc, stack, lp, path);
     }
     return leaf;
 }
@@ -896,8 +1143,121 @@ key_match(const char *pat, const char *key, int plen) {
     return '\0' == *key;
 }
 
+inline static uint32_t
+key_hash(const char *key, size_t len) {
+    uint32_t	h = 2166136261u;
+
+    for (; 0 < len; len--, key++) {
+	h = (h ^ (uint8_t)*key) * 16777619u;
+    }
+    return h;
+}
+
+/* Returns the index of a hash once it has been looked into often enough,
+ * building it on the first call after that. Returns 0 if the elements should
+ * be walked instead.
+ */
+static Index
+col_index(Doc doc, Leaf col) {
+    Leaf	e = leaf_elements(doc, col);
+    Leaf	end = e + col->cnt;
+    Index	index;
+    uint32_t	size = 4;
+
+    if (0 != col->index_id) {
+	return doc->indexes + col->index_id - 1;
+    }
+    if (INDEX_HITS > col->hits) {
+	col->hits++;
+	return 0;
+    }
+    if (NO_INDEX == col->hits) {
+	return 0;
+    }
+    if (INDEX_MIN > col->cnt) {
+	col->hits = NO_INDEX;
+	return 0;
+    }
+    if (doc->index_cnt == doc->index_size) {
+	doc->index_size = (0 == doc->index_size) ? 16 : doc->index_size * 2;
+	REALLOC_N(doc->indexes, struct _Index, doc->index_size);
+    }
+    index = doc->indexes + doc->index_cnt;
+    while (size < col->cnt * 2) {
+	size *= 2;
+    }
+    index->mask = size - 1;
+    index->slots = ALLOC_N(Leaf, size);
+    memset(index->slots, 0, sizeof(Leaf) * size);
+    for (; e < end; e++) {
+	uint32_t	i = key_hash(e->key, strlen(e->key)) & index->mask;
+
+	// The first of any duplicate keys wins as it does when walking.
+	for (; 0 != index->slots[i]; i = (i + 1) & index->mask) {
+	    if (0 == strcmp(e->key, index->slots[i]->key)) {
+		break;
+	    }
+	}
+	if (0 == index->slots[i]) {
+	    index->slots[i] = e;
+	}
+    }
+    doc->index_cnt++;
+    col->index_id = doc->index_cnt;
+
+    return index;
+}
+
+// Returns the element at the 1 based position cnt, 0 and 1 are both the first.
+static Leaf
+child_at(Doc doc, Leaf col, int cnt) {
+    if (1 >= cnt) {
+	cnt = 1;
+    } else if (col->cnt < (uint32_t)cnt) {
+	return 0;
+    }
+    return leaf_elements(doc, col) + cnt - 1;
+}
+
+// Returns the element with a key matching the possibly escaped path key.
+static Leaf
+child_by_key(Doc doc, Leaf col, const char *key, int klen) {
+    Leaf	e;
+    Leaf	end;
+    Index	index;
+
+    if (MAX_INDEX_KEY > klen && 0 != (index = col_index(doc, col))) {
+	char		buf[MAX_INDEX_KEY];
+	char		*b = buf;
+	const char	*kend = key + klen;
+	uint32_t	i;
+
+	for (; key < kend; key++) {
+	    if ('\\' == *key && key + 1 < kend) {
+		key++;
+	    }
+	    *b++ = *key;
+	}
+	*b = '\0';
+	i = key_hash(buf, b - buf) & index->mask;
+	for (; 0 != (e = index->slots[i]); i = (i + 1) & index->mask) {
+	    if (0 == strcmp(buf, e->key)) {
+		return e;
+	    }
+	}
+	return 0;
+    }
+    e = leaf_elements(doc, col);
+    for (end = e + col->cnt; e < end; e++) {
+	if (key_match(key, e->key, klen)) {
+	    return e;
+	}
+    }
+    return 0;
+}
+
 static Leaf
-get_leaf(Leaf *stack, Leaf *lp, const char *path) {
+get_leaf(Doc doc, Leaf *stack, Leaf *lp, const char *path) {
     Leaf	leaf = *lp;
 
     if (MAX_STACK <= lp - stack) {
@@ -910,17 +1270,16 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		path++;
 	    }
 	    if (stack < lp) {
-		leaf = get_leaf(stack, lp - 1, path);
+		leaf = get_leaf(doc, stack, lp - 1, path);
 	    } else {
 		return 0;
 	    }
-	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
-	    int		type = leaf->rtype;
+	} else if (COL_VAL == ready_type(doc, leaf) && 0 != leaf->cnt) {
+	    Leaf	col = leaf;
+	    Leaf	e = 0;
 
 	    leaf = 0;
-	    if (T_ARRAY == type) {
+	    if (T_ARRAY == col->rtype) {
 		int	cnt = 0;
 
 		for (; '0' <= *path && *path <= '9'; path++) {
@@ -929,17 +1288,8 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		if ('/' == *path) {
 		    path++;
 		}
-		do {
-		    if (1 >= cnt) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
-	    } else if (T_HASH == type) {
+		e = child_at(doc, col, cnt);
+	    } else if (T_HASH == col->rtype) {
 		const char	*key = path;
 		const char	*slash = next_slash(path);
 		int		klen;
@@ -951,15 +1301,12 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		    klen = (int)(slash - key);
 		    path += klen + 1;
 		}
-		do {
-		    if (key_match(key, e->key, klen)) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		e = child_by_key(doc, col, key, klen);
+	    }
+	    if (0 != e) {
+		lp++;
+		*lp = e;
+		leaf = get_leaf(doc, stack, lp, path);
 	    }
 	}
     }
@@ -968,20 +1315,19 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 
 static void
 each_leaf(Doc doc, VALUE self) {
-    if (COL_VAL == (*doc->where)->value_type) {
-	if (0 != (*doc->where)->elements) {
-	    Leaf	first = (*doc->where)->elements->next;
-	    Leaf	e = first;
+    if (COL_VAL == ready_type(doc, *doc->where)) {
+	if (0 != (*doc->where)->cnt) {
+	    Leaf	e = leaf_elements(doc, *doc->where);
+	    Leaf	end = e + (*doc->where)->cnt;
 
 	    doc->where++;
 	    if (MAX_STACK <= doc->where - doc->where_path) {
 		rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
 	    }
-	    do {
+	    for (; e < end; e++) {
 		*doc->where = e;
 		each_leaf(doc, self);
-		e = e->next;
-	    } while (e != first);
+	    }
 	    doc->where--;
 	}
     } else {
@@ -1020,9 +1366,8 @@ move_step(Doc doc, const char *path, int loc) {
 		*doc->where = init;
 		doc->where++;
 	    }
-	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
+	} else if (COL_VAL == ready_type(doc, leaf) && 0 != leaf->cnt) {
+	    Leaf	e = 0;
 
 	    if (T_ARRAY == leaf->rtype) {
 		int	cnt = 0;
@@ -1035,20 +1380,7 @@ move_step(Doc doc, const char *path, int loc) {
 		} else if ('\0' != *path) {
 		    return loc;
 		}
-		do {
-		    if (1 >= cnt) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
+		e = child_at(doc, leaf, cnt);
 	    } else if (T_HASH == leaf->rtype) {
 		const char	*key = path;
 		const char	*slash = next_slash(path);
@@ -1061,19 +1393,16 @@ move_step(Doc doc, const char *path, int loc) {
 		    klen = (int)(slash - key);
 		    path += klen + 1;
 		}
-		do {
-		    if (key_match(key, e->key, klen)) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		e = child_by_key(doc, leaf, key, klen);
+	    }
+	    if (0 != e) {
+		doc->where++;
+		*doc->where = e;
+		loc = move_step(doc, path, loc + 1);
+		if (0 != loc) {
+		    *doc->where = 0;
+		    doc->where--;
+		}
 	    }
 	}
     }
@@ -1082,15 +1411,14 @@ move_step(Doc doc, const char *path, int loc) {
 
 static void
 each_value(Doc doc, Leaf leaf) {
-    if (COL_VAL == leaf->value_type) {
-	if (0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
+    if (COL_VAL == ready_type(doc, leaf)) {
+	if (0 != leaf->cnt) {
+	    Leaf	e = leaf_elements(doc, leaf);
+	    Leaf	end = e + leaf->cnt;
 
-	    do {
+	    for (; e < end; e++) {
 		each_value(doc, e);
-		e = e->next;
-	    } while (e != first);
+	    }
 	}
     } else {
 	rb_yield(leaf_value(doc, leaf));
@@ -1099,14 +1427,28 @@ each_value(Doc doc, Leaf leaf) {
 
 // doc functions
 
-/* call-seq: open(json) { |doc| ... } => Object
+static int
+lazy_option(VALUE ropts) {
+    if (rb_cHash != rb_obj_class(ropts)) {
+	rb_raise(rb_eArgError, "options must be a hash.");
+    }
+    return Qtrue == rb_hash_lookup(ropts, lazy_sym);
+}
+
+/* call-seq: open(json, options) { |doc| ... } => Object
  *
  * Parses a JSON document String and then yields to the provided block if one
  * is given with an instance of the Oj::Doc as the single yield parameter. If
  * a block is not given then an Oj::Doc instance is returned and must be
  * closed with a call to the #close() method when no longer needed.
  *
+ * If the :lazy option is true arrays and hashes are only scanned for their
+ * extent when the document is opened. The members of each are parsed the
+ * first time the array or hash is navigated into or fetched. Syntax errors
+ * inside an array or hash are not raised until then.
+ *
  * @param [String] json JSON document string
+ * @param [Hash] options only the :lazy option is used
  * @yieldparam [Oj::Doc] doc parsed JSON document
  * @yieldreturn [Object] returns the result of the yield as the result of the method call
  * @example
@@ -1117,14 +1459,23 @@ each_value(Doc doc, Leaf leaf) {
  *   doc.close()
  */
 static VALUE
-doc_open(VALUE clas, VALUE str) {
+doc_open(int argc, VALUE *argv, VALUE clas) {
     char	*json;
     size_t	len;
     VALUE	obj;
+    VALUE	str;
     int		given = rb_block_given_p();
     int		allocate;
+    int		lazy = 0;
 
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to open.");
+    }
+    str = *argv;
     Check_Type(str, T_STRING);
+    if (2 == argc) {
+	lazy = lazy_option(argv[1]);
+    }
     len = RSTRING_LEN(str) + 1;
     allocate = (SMALL_XML < len || !given);
     if (allocate) {
@@ -1133,21 +1484,26 @@ doc_open(VALUE clas, VALUE str) {
 	json = ALLOCA_N(char, len);
     }
     memcpy(json, StringValuePtr(str), len);
-    obj = parse_json(clas, json, given, allocate);
+    obj = parse_json(clas, json, len - 1, given, allocate, 0, lazy);
     if (given && allocate) {
 	xfree(json);
     }
     return obj;
 }
 
-/* call-seq: open_file(filename) { |doc| ... } => Object
+/* call-seq: open_file(filename, options) { |doc| ... } => Object
  *
  * Parses a JSON document from a file and then yields to the provided block if
  * one is given with an instance of the Oj::Doc as the single yield
  * parameter. If a block is not given then an Oj::Doc instance is returned and
  * must be closed with a call to the #close() method when no longer needed.
  *
+ * Large files are memory mapped and parsed in place. The :mmap option or the
+ * default :mmap option controls when mapping is used. The :lazy option is the
+ * same as for #open().
+ *
  * @param [String] filename name of file that contains a JSON document
+ * @param [Hash] options only the :mmap and :lazy options are used
  * @yieldparam [Oj::Doc] doc parsed JSON document
  * @yieldreturn [Object] returns the result of the yield as the result of the method call
  * @example
@@ -1159,20 +1515,37 @@ doc_open(VALUE clas, VALUE str) {
  *   doc.close()
  */
 static VALUE
-doc_open_file(VALUE clas, VALUE filename) {
-    char	*path;
-    char	*json;
-    FILE	*f;
-    size_t	len;
-    VALUE	obj;
-    int		given = rb_block_given_p();
-    int		allocate;
-
-    Check_Type(filename, T_STRING);
-    path = StringValuePtr(filename);
+doc_open_file(int argc, VALUE *argv, VALUE clas) {
+    struct _Options	opts = oj_default_options;
+    char		*path;
+    char		*json;
+    FILE		*f;
+    size_t		len;
+    VALUE		obj;
+    int			given = rb_block_given_p();
+    int			allocate;
+    int			lazy = 0;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to open_file.");
+    }
+    Check_Type(*argv, T_STRING);
+    if (2 == argc) {
+	oj_parse_options(argv[1], &opts);
+	lazy = lazy_option(argv[1]);
+    }
+    path = StringValuePtr(*argv);
     if (0 == (f = fopen(path, "r"))) {
 	rb_raise(rb_eIOError, "%s", strerror(errno));
     }
+    if (0 != (json = oj_map_file(fileno(f), &len, opts.mem_map))) {
+	fclose(f);
+	obj = parse_json(clas, json, len, given, 1, len, lazy);
+	if (given) {
+	    oj_unmap_file(json, len);
+	}
+	return obj;
+    }
     fseek(f, 0, SEEK_END);
     len = ftell(f);
     allocate = (SMALL_XML < len || !given);
@@ -1182,14 +1555,14 @@ doc_open_file(VALUE clas, VALUE filename) {
 	json = ALLOCA_N(char, len + 1);
     }
     fseek(f, 0, SEEK_SET);
-    if (len != fread(json, 1, len, f)) {
+    if (len != oj_fread(json, len, f)) {
 	fclose(f);
 	rb_raise(rb_const_get_at(Oj, rb_intern("LoadError")), 
 		 "Failed to read %lu bytes from %s.", (unsigned long)len, path);
     }
     fclose(f);
     json[len] = '\0';
-    obj = parse_json(clas, json, given, allocate);
+    obj = parse_json(clas, json, len, given, allocate, 0, lazy);
     if (given && allocate) {
 	xfree(json);
     }
@@ -1497,16 +1870,15 @@ doc_each_child(int argc, VALUE *argv, VALUE self) {
 		return Qnil;
 	    }
 	}
-	if (COL_VAL == (*doc->where)->value_type && 0 != (*doc->where)->elements) {
-	    Leaf	first = (*doc->where)->elements->next;
-	    Leaf	e = first;
+	if (COL_VAL == ready_type(doc, *doc->where) && 0 != (*doc->where)->cnt) {
+	    Leaf	e = leaf_elements(doc, *doc->where);
+	    Leaf	end = e + (*doc->where)->cnt;
 
 	    doc->where++;
-	    do {
+	    for (; e < end; e++) {
 		*doc->where = e;
 		rb_yield(self);
-		e = e->next;
-	    } while (e != first);
+	    }
 	}
 	if (0 < wlen) {
 	    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
@@ -1588,6 +1960,8 @@ doc_dump(int argc, VALUE *argv, VALUE self) {
     if (0 != (leaf = get_doc_leaf(doc, path))) {
 	VALUE	rjson;
 
+	leaf_expand_all(doc, leaf);
+
 	if (0 == filename) {
 	    char	buf[4096];
 	    struct _Out out;
@@ -1595,14 +1969,15 @@ doc_dump(int argc, VALUE *argv, VALUE self) {
 	    out.buf = buf;
 	    out.end = buf + sizeof(buf) - 10;
 	    out.allocated = 0;
+	    out.flush = 0;
 	    out.omit_nil = oj_default_options.dump_opts.omit_nil;
-	    oj_dump_leaf_to_json(leaf, &oj_default_options, &out);
+	    oj_dump_leaf_to_json(leaf, &doc->arena, &oj_default_options, &out);
 	    rjson = rb_str_new2(out.buf);
 	    if (out.allocated) {
 		xfree(out.buf);
 	    }
 	} else {
-	    oj_write_leaf_to_file(leaf, filename, &oj_default_options);
+	    oj_write_leaf_to_file(leaf, &doc->arena, filename, &oj_default_options);
 	    rjson = Qnil;
 	}
 	return rjson;
@@ -1639,7 +2014,7 @@ doc_close(VALUE self) {
     rb_gc_unregister_address(&doc->self);
     DATA_PTR(doc->self) = 0;
     if (0 != doc) {
-	xfree(doc->json);
+	free_json(doc->json, doc->map_len);
 	doc_free(doc);
 	xfree(doc);
     }
@@ -1705,9 +2080,10 @@ doc_not_implemented(VALUE self) {
 void
 oj_init_doc() {
     oj_doc_class = rb_define_class_under(Oj, "Doc", rb_cObject);
-    rb_define_singleton_method(oj_doc_class, "open", doc_open, 1);
-    rb_define_singleton_method(oj_doc_class, "open_file", doc_open_file, 1);
-    rb_define_singleton_method(oj_doc_class, "parse", doc_open, 1);
+    lazy_sym = ID2SYM(rb_intern("lazy"));	rb_gc_register_address(&lazy_sym);
+    rb_define_singleton_method(oj_doc_class, "open", doc_open, -1);
+    rb_define_singleton_method(oj_doc_class, "open_file", doc_open_file, -1);
+    rb_define_singleton_method(oj_doc_class, "parse", doc_open, -1);
     rb_define_method(oj_doc_class, "where?", doc_where, 0);
     rb_define_method(oj_doc_class, "local_key", doc_local_key, 0);
     rb_define_method(oj_doc_class, "home", doc_home, 0);
@@ -31,22 +31,44 @@
 #include "hash.h"
 #include <stdint.h>
 
-#define HASH_MASK	0x000003FF
-#define  HASH_SLOT_CNT	1024
+// Slot counts are always a power of 2 and the table grows when more than
+// 3/4 of the slots are used.
+#define HASH_INIT_SIZE	64
+#define KEY_INIT_SIZE	16
+
+// The class and attribute hashes are read without a lock. Slots are filled
+// in before the key is published and a grown slot array is published only
+// after it is complete. Replaced slot arrays are retained since a reader may
+// still be using one.
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+#define LOAD_ACQUIRE(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQUIRE(p)		(p)
+#define STORE_RELEASE(p, v)	((p) = (v))
+#endif
 
 typedef struct _KeyVal {
-    struct _KeyVal	*next;
-    const char		*key;
+    const char		*key;	// 0 if the slot is empty
     size_t		len;
+    uint32_t		hash;
     VALUE		val;
 } *KeyVal;
 
+typedef struct _Slots {
+    struct _Slots	*prev;	// retained replaced slots
+    size_t		mask;	// slot count - 1
+    struct _KeyVal	kv[1];
+} *Slots;
+
 struct _Hash {
-    struct _KeyVal	slots[HASH_SLOT_CNT];
+    Slots		slots;
+    size_t		cnt;
+    int			retain;	// keep replaced slots for lock free readers
 };
 
-struct _Hash	class_hash;
-struct _Hash	intern_hash;
+struct _Hash	class_hash = { 0, 0, 1 };
+struct _Hash	intern_hash = { 0, 0, 1 };
 
 // almost the Murmur hash algorithm
 #define M 0x5bd1e995
@@ -89,56 +111,141 @@ hash_calc(const uint8_t *key, size_t len) {
     return h;
 }
 
+static Slots
+slots_create(size_t size) {
+    size_t	bytes = sizeof(struct _Slots) + sizeof(struct _KeyVal) * (size - 1);
+    Slots	slots = (Slots)ALLOC_N(char, bytes);
+
+    memset(slots, 0, bytes);
+    slots->mask = size - 1;
+
+    return slots;
+}
+
+static void
+hash_setup(Hash hash, size_t size) {
+    hash->slots = slots_create(size);
+    hash->cnt = 0;
+}
+
+static void
+hash_cleanup(Hash hash) {
+    Slots	slots = hash->slots;
+    Slots	prev;
+    KeyVal	b;
+    KeyVal	end = slots->kv + slots->mask + 1;
+
+    // Retained slots share keys with the current slots.
+    for (b = slots->kv; b < end; b++) {
+	if (0 != b->key) {
+	    xfree((char*)b->key);
+	}
+    }
+    for (; 0 != slots; slots = prev) {
+	prev = slots->prev;
+	xfree(slots);
+    }
+    hash->slots = 0;
+}
+
+static void
+hash_grow(Hash hash) {
+    Slots	old = hash->slots;
+    Slots	slots = slots_create((old->mask + 1) * 2);
+    KeyVal	end = old->kv + old->mask + 1;
+    KeyVal	b;
+    size_t	i;
+
+    for (b = old->kv; b < end; b++) {
+	if (0 != b->key) {
+	    for (i = b->hash & slots->mask; 0 != slots->kv[i].key; i = (i + 1) & slots->mask) {
+	    }
+	    slots->kv[i] = *b;
+	}
+    }
+    if (hash->retain) {
+	slots->prev = old;
+	STORE_RELEASE(hash->slots, slots);
+    } else {
+	hash->slots = slots;
+	xfree(old);
+    }
+}
+
 void
 oj_hash_init() {
-    memset(class_hash.slots, 0, sizeof(class_hash.slots));
-    memset(intern_hash.slots, 0, sizeof(intern_hash.slots));
+    if (0 != class_hash.slots) {
+	hash_cleanup(&class_hash);
+    }
+    if (0 != intern_hash.slots) {
+	hash_cleanup(&intern_hash);
+    }
+    hash_setup(&class_hash, HASH_INIT_SIZE);
+    hash_setup(&intern_hash, HASH_INIT_SIZE);
 }
 
-// if slotp is 0 then just lookup
+// If slotp is 0 then just lookup. A slot returned is only valid until the
+// next key is added to the hash since adding can move all the slots. Callers
+// of a hash that is read without a lock must hold a lock while adding.
 static VALUE
 hash_get(Hash hash, const char *key, size_t len, VALUE **slotp, VALUE def_value) {
-    uint32_t	h = hash_calc((const uint8_t*)key, len) & HASH_MASK;
-    KeyVal	bucket = hash->slots + h;
-
-    if (0 != bucket->key) {
-	KeyVal	b;
+    uint32_t	h = hash_calc((const uint8_t*)key, len);
+    Slots	slots = hash->slots;
+    size_t	i;
+    KeyVal	b;
 
-	for (b = bucket; 0 != b; b = b->next) {
-	    if (len == b->len && 0 == strncmp(b->key, key, len)) {
+    for (i = h & slots->mask; 0 != (b = slots->kv + i)->key; i = (i + 1) & slots->mask) {
+	if (h == b->hash && len == b->len && 0 == memcmp(b->key, key, len)) {
+	    if (0 != slotp) {
 		*slotp = &b->val;
-		return b->val;
 	    }
-	    bucket = b;
+	    return b->val;
 	}
     }
     if (0 != slotp) {
-	if (0 != bucket->key) {
-	    KeyVal	b = ALLOC(struct _KeyVal);
-	
-	    b->next = 0;
-	    bucket->next = b;
-	    bucket = b;
+	if ((slots->mask + 1) * 3 < (hash->cnt + 1) * 4) {
+	    hash_grow(hash);
+	    slots = hash->slots;
+	    for (i = h & slots->mask; 0 != (b = slots->kv + i)->key; i = (i + 1) & slots->mask) {
+	    }
 	}
-	bucket->key = oj_strndup(key, len);
-	bucket->len = len;
-	bucket->val = def_value;
-	*slotp = &bucket->val;
+	b->len = len;
+	b->hash = h;
+	b->val = def_value;
+	STORE_RELEASE(b->key, (const char*)oj_strndup(key, len));
+	hash->cnt++;
+	*slotp = &b->val;
     }
     return def_value;
 }
 
+// Lookup without a lock. Returns missing if the key has not been added or
+// if it was added by a writer that has not finished.
+static VALUE
+hash_peek(Hash hash, const char *key, size_t len, VALUE missing) {
+    uint32_t	h = hash_calc((const uint8_t*)key, len);
+    Slots	slots = LOAD_ACQUIRE(hash->slots);
+    const char	*k;
+    size_t	i;
+    KeyVal	b;
+
+    for (i = h & slots->mask; 0 != (k = LOAD_ACQUIRE((b = slots->kv + i)->key)); i = (i + 1) & slots->mask) {
+	if (h == b->hash && len == b->len && 0 == memcmp(k, key, len)) {
+	    return LOAD_ACQUIRE(b->val);
+	}
+    }
+    return missing;
+}
+
 void
 oj_hash_print() {
-    int		i;
-    KeyVal	b;
+    Slots	slots = class_hash.slots;
+    size_t	i;
 
-    for (i = 0; i < HASH_SLOT_CNT; i++) {
-	printf("%4d:", i);
-	for (b = class_hash.slots + i; 0 != b && 0 != b->key; b = b->next) {
-	    printf(" %s", b->key);
+    for (i = 0; i <= slots->mask; i++) {
+	if (0 != slots->kv[i].key) {
+	    printf("%4lu: %s\n", (unsigned long)i, slots->kv[i].key);
 	}
-	printf("\n");
     }
 }
 
@@ -147,11 +254,74 @@ oj_class_hash_get(const char *key, size_t len, VALUE **slotp) {
     return hash_get(&class_hash, key, len, slotp, Qnil);
 }
 
+VALUE
+oj_class_hash_peek(const char *key, size_t len) {
+    return hash_peek(&class_hash, key, len, Qnil);
+}
+
 ID
 oj_attr_hash_get(const char *key, size_t len, ID **slotp) {
     return (ID)hash_get(&intern_hash, key, len, (VALUE**)slotp, 0);
 }
 
+ID
+oj_attr_hash_peek(const char *key, size_t len) {
+    return (ID)hash_peek(&intern_hash, key, len, 0);
+}
+
+void
+oj_hash_set_slot(VALUE *slot, VALUE val) {
+    STORE_RELEASE(*slot, val);
+}
+
+Hash
+oj_hash_create() {
+    Hash	hash = ALLOC(struct _Hash);
+
+    hash_setup(hash, KEY_INIT_SIZE);
+    hash->retain = 0;
+
+    return hash;
+}
+
+void
+oj_hash_destroy(Hash hash) {
+    hash_cleanup(hash);
+    xfree(hash);
+}
+
+// Empties the hash in place so a parse that still holds it keeps working.
+void
+oj_hash_clear(Hash hash) {
+    Slots	slots = slots_create(KEY_INIT_SIZE);
+
+    hash_cleanup(hash);
+    hash->slots = slots;
+    hash->cnt = 0;
+}
+
+size_t
+oj_hash_size(Hash hash) {
+    return hash->cnt;
+}
+
+void
+oj_hash_mark(Hash hash) {
+    KeyVal	b;
+    KeyVal	end = hash->slots->kv + hash->slots->mask + 1;
+
+    for (b = hash->slots->kv; b < end; b++) {
+	if (0 != b->key) {
+	    rb_gc_mark(b->val);
+	}
+    }
+}
+
+VALUE
+oj_key_hash_get(Hash hash, const char *key, size_t len, VALUE **slotp) {
+    return hash_get(hash, key, len, slotp, Qundef);
+}
+
 char*
 oj_strndup(const char *s, size_t len) {
     char	*d = ALLOC_N(char, len + 1);
@@ -38,7 +38,17 @@ typedef struct _Hash	*Hash;
 extern void	oj_hash_init();
 
 extern VALUE	oj_class_hash_get(const char *key, size_t len, VALUE **slotp);
+extern VALUE	oj_class_hash_peek(const char *key, size_t len);
 extern ID	oj_attr_hash_get(const char *key, size_t len, ID **slotp);
+extern ID	oj_attr_hash_peek(const char *key, size_t len);
+extern void	oj_hash_set_slot(VALUE *slot, VALUE val);
+
+extern Hash	oj_hash_create();
+extern void	oj_hash_destroy(Hash hash);
+extern void	oj_hash_clear(Hash hash);
+extern void	oj_hash_mark(Hash hash);
+extern size_t	oj_hash_size(Hash hash);
+extern VALUE	oj_key_hash_get(Hash hash, const char *key, size_t len, VALUE **slotp);
 
 extern void	oj_hash_print();
 extern char*	oj_strndup(const char *s, size_t len);
@@ -30,6 +30,8 @@
 
 // if windows, comment out the whole file. It's only a performance test.
 #ifndef _WIN32
+#include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include "hash.h"
@@ -442,6 +444,110 @@ static struct _StrLen data[] = {
     { 0, 0 }
 };
 
+// The original fixed size chained hash is kept here so the open addressing
+// hash in hash.c can be compared with it.
+#define CHAIN_MASK	0x000003FF
+#define CHAIN_SLOT_CNT	1024
+
+typedef struct _ChainKeyVal {
+    struct _ChainKeyVal	*next;
+    const char		*key;
+    size_t		len;
+    VALUE		val;
+} *ChainKeyVal;
+
+typedef struct _ChainHash {
+    struct _ChainKeyVal	slots[CHAIN_SLOT_CNT];
+} *ChainHash;
+
+static struct _ChainHash	chain_hash;
+
+#define M 0x5bd1e995
+
+static uint32_t
+chain_hash_calc(const uint8_t *key, size_t len) {
+    const uint8_t	*end = key + len;
+    const uint8_t	*endless = key + (len / 4 * 4);
+    uint32_t		h = (uint32_t)len;
+    uint32_t		k;
+
+    while (key < endless) {
+	k = (uint32_t)*key++;
+	k |= (uint32_t)*key++ << 8;
+	k |= (uint32_t)*key++ << 16;
+	k |= (uint32_t)*key++ << 24;
+
+        k *= M;
+        k ^= k >> 24;
+        h *= M;
+        h ^= k * M;
+    }
+    if (1 < end - key) {
+	uint16_t	k16 = (uint16_t)*key++;
+
+	k16 |= (uint16_t)*key++ << 8;
+	h ^= k16 << 8;
+    }
+    if (key < end) {
+	h ^= *key;
+    }
+    h *= M;
+    h ^= h >> 13;
+    h *= M;
+    h ^= h >> 15;
+    
+    return h;
+}
+
+static void
+chain_clear() {
+    ChainKeyVal	b;
+    int		i;
+
+    for (i = 0; i < CHAIN_SLOT_CNT; i++) {
+	while (0 != (b = chain_hash.slots[i].next)) {
+	    chain_hash.slots[i].next = b->next;
+	    xfree((char*)b->key);
+	    xfree(b);
+	}
+	if (0 != chain_hash.slots[i].key) {
+	    xfree((char*)chain_hash.slots[i].key);
+	}
+    }
+    memset(chain_hash.slots, 0, sizeof(chain_hash.slots));
+}
+
+static VALUE
+chain_get(const char *key, size_t len, VALUE **slotp) {
+    uint32_t	h = chain_hash_calc((const uint8_t*)key, len) & CHAIN_MASK;
+    ChainKeyVal	bucket = chain_hash.slots + h;
+
+    if (0 != bucket->key) {
+	ChainKeyVal	b;
+
+	for (b = bucket; 0 != b; b = b->next) {
+	    if (len == b->len && 0 == strncmp(b->key, key, len)) {
+		*slotp = &b->val;
+		return b->val;
+	    }
+	    bucket = b;
+	}
+    }
+    if (0 != bucket->key) {
+	ChainKeyVal	b = ALLOC(struct _ChainKeyVal);
+	
+	b->next = 0;
+	bucket->next = b;
+	bucket = b;
+    }
+    bucket->key = oj_strndup(key, len);
+    bucket->len = len;
+    bucket->val = Qnil;
+    *slotp = &bucket->val;
+
+    return Qnil;
+}
+
 static uint64_t
 micro_time() {
     struct timeval	tv;
@@ -452,33 +558,80 @@ micro_time() {
 }
 
 static void
-perf() {
+report(const char *label, int iter, int cnt, uint64_t dt) {
+    if (0 == dt) {
+	dt = 1;
+    }
+#if IS_WINDOWS
+    printf("  %-8s %d iterations took %ld msecs, %ld gets/msec\n", label, iter, (long)(dt / 1000), (long)((double)iter * cnt * 1000.0 / dt));
+#else
+    printf("  %-8s %d iterations took %"PRIu64" msecs, %ld gets/msec\n", label, iter, dt / 1000, (long)((double)iter * cnt * 1000.0 / dt));
+#endif
+}
+
+// Looks up every key iter times in both the chained and the open addressing
+// hash after adding them all once.
+static void
+compare(const char *title, StrLen keys, int cnt, int iter) {
     StrLen	d;
+    StrLen	end = keys + cnt;
     VALUE	v;
     VALUE	*slot = 0;
-    uint64_t	dt, start;
-    int		i, iter = 1000000;
-    int		dataCnt = sizeof(data) / sizeof(*data);
+    uint64_t	start;
+    int		i;
 
+    printf("%s (%d keys)\n", title, cnt);
+    chain_clear();
     oj_hash_init();
+    for (d = keys; d < end; d++) {
+	if (Qnil == chain_get(d->str, d->len, &slot)) {
+	    *slot = Qtrue;
+	}
+	if (Qnil == oj_class_hash_get(d->str, d->len, &slot)) {
+	    *slot = Qtrue;
+	}
+    }
+    start = micro_time();
+    for (i = iter; 0 < i; i--) {
+	for (d = keys; d < end; d++) {
+	    v = chain_get(d->str, d->len, &slot);
+	}
+    }
+    report("chained", iter, cnt, micro_time() - start);
     start = micro_time();
     for (i = iter; 0 < i; i--) {
-	for (d = data; 0 != d->str; d++) {
+	for (d = keys; d < end; d++) {
 	    v = oj_class_hash_get(d->str, d->len, &slot);
-	    if (Qundef == v) {
-		if (0 != slot) {
-		    v = ID2SYM(rb_intern(d->str));
-		    *slot = v;
-		}
-	    }
 	}
     }
-    dt = micro_time() - start;
-#if IS_WINDOWS
-    printf("%d iterations took %ld msecs, %ld gets/msec\n", iter, (long)(dt / 1000), (long)(iter * dataCnt / (dt / 1000)));
-#else
-    printf("%d iterations took %"PRIu64" msecs, %ld gets/msec\n", iter, dt / 1000, (long)(iter * dataCnt / (dt / 1000)));
-#endif
+    report("open", iter, cnt, micro_time() - start);
+    (void)v;
+}
+
+static void
+perf() {
+    int		dataCnt = sizeof(data) / sizeof(*data) - 1;
+    int		cnt = 20000;
+    StrLen	keys = ALLOC_N(struct _StrLen, cnt);
+    char	name[64];
+    int		i;
+
+    compare("Ruby core classes", data, dataCnt, 1000000 / 10);
+
+    // A large application has thousands of classes, many in the same
+    // namespaces.
+    for (i = 0; i < cnt; i++) {
+	keys[i].len = sprintf(name, "App::Models::Module%d::Record%d", i / 50, i);
+	keys[i].str = oj_strndup(name, keys[i].len);
+    }
+    compare("Application classes", keys, 1000, 2000);
+    compare("Application classes", keys, cnt, 100);
+    for (i = 0; i < cnt; i++) {
+	xfree((char*)keys[i].str);
+    }
+    xfree(keys);
+    chain_clear();
+    oj_hash_init();
 }
 
 void
@@ -0,0 +1,102 @@
+/* mapped.c
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !IS_WINDOWS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "oj.h"
+#include "mapped.h"
+
+#if !IS_WINDOWS
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+static size_t
+map_size(size_t len) {
+    size_t	page = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Always leave room for at least one '\0' after the content.
+    return (len + page) & ~(page - 1);
+}
+#endif
+
+/* Maps a regular file for parsing in place and returns the start of the
+ * mapping or NULL if the file should be read instead. The mapping is private
+ * and writable so the parsers can modify it without changing the file. The
+ * content is always followed by a '\0' even when the file is an exact
+ * multiple of the page size.
+ */
+char*
+oj_map_file(int fd, size_t *lenp, char mode) {
+#if IS_WINDOWS
+    return 0;
+#else
+    struct stat	st;
+    size_t	len;
+    size_t	size;
+    char	*base;
+
+    if (MapOff == mode || 0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 == st.st_size) {
+	return 0;
+    }
+    len = (size_t)st.st_size;
+    if (MapOn != mode && MAP_AUTO_MIN > len) {
+	return 0;
+    }
+    size = map_size(len);
+    // Reserve zero filled pages for the whole size and then map the file
+    // over the front of them.
+    if (MAP_FAILED == (base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))) {
+	return 0;
+    }
+    if (MAP_FAILED == mmap(base, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0)) {
+	munmap(base, size);
+	return 0;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(base, len, MADV_SEQUENTIAL);
+#endif
+    *lenp = len;
+
+    return base;
+#endif
+}
+
+void
+oj_unmap_file(char *json, size_t len) {
+#if !IS_WINDOWS
+    munmap(json, map_size(len));
+#endif
+}
@@ -0,0 +1,201 @@
+/* nogvl.c
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "oj.h"
+#include "nogvl.h"
+#if HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#include "ruby/thread.h"
+#endif
+
+typedef struct _IOArgs {
+    int		fd;
+    FILE	*f;
+    char	*buf;
+    size_t	len;
+    ssize_t	cnt;
+    int		err;
+} *IOArgs;
+
+void
+oj_without_gvl(void* (*func)(void*), void *arg) {
+#if HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    rb_thread_call_without_gvl(func, arg, RUBY_UBF_IO, 0);
+#else
+    func(arg);
+#endif
+}
+
+static void*
+read_fd(void *x) {
+    IOArgs	a = (IOArgs)x;
+
+    a->cnt = read(a->fd, a->buf, a->len);
+    a->err = errno;
+
+    return 0;
+}
+
+static void*
+write_fd(void *x) {
+    IOArgs	a = (IOArgs)x;
+
+    a->cnt = write(a->fd, a->buf, a->len);
+    a->err = errno;
+
+    return 0;
+}
+
+static void*
+read_file(void *x) {
+    IOArgs	a = (IOArgs)x;
+
+    a->cnt = (ssize_t)fread(a->buf, 1, a->len, a->f);
+    a->err = ferror(a->f) ? errno : 0;
+
+    return 0;
+}
+
+static void*
+write_file(void *x) {
+    IOArgs	a = (IOArgs)x;
+
+    a->cnt = (ssize_t)fwrite(a->buf, 1, a->len, a->f);
+    a->err = ferror(a->f) ? errno : 0;
+
+    return 0;
+}
+
+// Returns what read() returns. Only one successful read is made, as with
+// read(), but a non-blocking fd is waited on until there is data.
+ssize_t
+oj_read_fd(int fd, void *buf, size_t len) {
+    struct _IOArgs	a;
+
+    a.fd = fd;
+    a.buf = (char*)buf;
+    a.len = len;
+    do {
+	oj_without_gvl(read_fd, &a);
+	if (0 > a.cnt) {
+	    if (EAGAIN == a.err || EWOULDBLOCK == a.err) {
+		rb_thread_wait_fd(fd);
+	    } else if (EINTR == a.err) {
+		rb_thread_check_ints();
+	    } else {
+		break;
+	    }
+	}
+    } while (0 > a.cnt);
+    errno = a.err;
+
+    return a.cnt;
+}
+
+// Writes all of buf. Returns 0 on success or the errno of the failure.
+int
+oj_write_fd(int fd, const void *buf, size_t len) {
+    struct _IOArgs	a;
+
+    a.fd = fd;
+    a.buf = (char*)buf;
+    a.len = len;
+    while (0 < a.len) {
+	oj_without_gvl(write_fd, &a);
+	if (0 > a.cnt) {
+	    // Ruby opens pipes and sockets non-blocking so wait until the
+	    // other end has read some.
+	    if (EAGAIN == a.err || EWOULDBLOCK == a.err) {
+		rb_thread_fd_writable(fd);
+	    } else if (EINTR == a.err) {
+		rb_thread_check_ints();
+	    } else {
+		return a.err;
+	    }
+	} else {
+	    a.buf += a.cnt;
+	    a.len -= a.cnt;
+	}
+    }
+    return 0;
+}
+
+// Returns the number of bytes read which is less than len only at the end
+// of the file or on an error, as with fread().
+size_t
+oj_fread(void *buf, size_t len, FILE *f) {
+    struct _IOArgs	a;
+    size_t		total = 0;
+
+    a.f = f;
+    a.buf = (char*)buf;
+    a.len = len;
+    while (0 < a.len) {
+	oj_without_gvl(read_file, &a);
+	total += a.cnt;
+	a.buf += a.cnt;
+	a.len -= a.cnt;
+	if (0 < a.len) {
+	    if (EINTR != a.err) {
+		break;
+	    }
+	    clearerr(f);
+	    rb_thread_check_ints();
+	}
+    }
+    return total;
+}
+
+// Writes all of buf. Returns 0 on success or the errno of the failure, which
+// is saved before any Ruby call that could change errno.
+int
+oj_fwrite(const void *buf, size_t len, FILE *f) {
+    struct _IOArgs	a;
+
+    a.f = f;
+    a.buf = (char*)buf;
+    a.len = len;
+    while (0 < a.len) {
+	oj_without_gvl(write_file, &a);
+	a.buf += a.cnt;
+	a.len -= a.cnt;
+	if (0 < a.len) {
+	    if (EINTR != a.err) {
+		return (0 == a.err) ? EIO : a.err;
+	    }
+	    clearerr(f);
+	    rb_thread_check_ints();
+	}
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/* nogvl.h
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __OJ_NOGVL_H__
+#define __OJ_NOGVL_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+
+// Calls func with arg without holding the GVL when Ruby supports it. The
+// func must not call Ruby or allocate with xmalloc.
+extern void	oj_without_gvl(void* (*func)(void*), void *arg);
+
+// Blocking I/O with the GVL released so other Ruby threads keep running.
+// The calls are retried if interrupted after checking for a pending
+// Thread#raise or kill.
+extern ssize_t	oj_read_fd(int fd, void *buf, size_t len);
+extern int	oj_write_fd(int fd, const void *buf, size_t len);
+extern size_t	oj_fread(void *buf, size_t len, FILE *f);
+extern int	oj_fwrite(const void *buf, size_t len, FILE *f);
+
+#endif /* __OJ_NOGVL_H__ */
@@ -62,11 +62,7 @@ calc_hash_key(ParseInfo pi, Val kval, char k1) {
 	rkey = oj_encode(rkey);
 	rkey = rb_funcall(rkey, oj_to_sym_id, 0);
     } else {
-	rkey = rb_str_new(kval->key, kval->klen);
-	rkey = oj_encode(rkey);
-	if (Yes == pi->options.sym_key) {
-	    rkey = rb_str_intern(rkey);
-	}
+	rkey = oj_calc_hash_key(pi, kval->key, kval->klen);
     }
     return rkey;
 }
@@ -488,6 +484,10 @@ set_obj_ivar(Val parent, Val kval, VALUE value) {
 	    rb_funcall(parent->val, rb_intern("set_backtrace"), 1, value);
 	}
     }
+    if (0 != (var_id = oj_attr_hash_peek(key, klen))) {
+	rb_ivar_set(parent->val, var_id, value);
+	return;
+    }
 #if USE_PTHREAD_MUTEX
     pthread_mutex_lock(&oj_cache_mutex);
 #elif USE_RB_MUTEX
@@ -520,7 +520,7 @@ set_obj_ivar(Val parent, Val kval, VALUE value) {
 	    }
 	    var_id = rb_intern(attr);
 	}
-	*slot = var_id;
+	oj_hash_set_slot((VALUE*)slot, (VALUE)var_id);
     }
 #if USE_PTHREAD_MUTEX
     pthread_mutex_unlock(&oj_cache_mutex);
@@ -32,6 +32,17 @@
 
 #include "odd.h"
 
+// Lookups do not lock so they can run in any Ractor. A registration builds
+// a new array and publishes it before the count. Replaced arrays are never
+// freed since a lookup may still be using one.
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+#define LOAD_ACQUIRE(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQUIRE(p)		(p)
+#define STORE_RELEASE(p, v)	((p) = (v))
+#endif
+
 static struct _Odd	_odds[4]; // bump up if new initial Odd classes are added
 static struct _Odd	*odds = _odds;
 static long		odd_cnt = 0;
@@ -141,10 +152,12 @@ oj_odd_init() {
 
 Odd
 oj_get_odd(VALUE clas) {
+    long	cnt = LOAD_ACQUIRE(odd_cnt);
+    Odd		first = LOAD_ACQUIRE(odds);
     Odd		odd;
     const char	*classname = NULL;
 
-    for (odd = odds + odd_cnt - 1; odds <= odd; odd--) {
+    for (odd = first + cnt - 1; first <= odd; odd--) {
 	if (clas == odd->clas) {
 	    return odd;
 	}
@@ -163,9 +176,11 @@ oj_get_odd(VALUE clas) {
 
 Odd
 oj_get_oddc(const char *classname, size_t len) {
-    Odd	odd;
+    long	cnt = LOAD_ACQUIRE(odd_cnt);
+    Odd		first = LOAD_ACQUIRE(odds);
+    Odd		odd;
 
-    for (odd = odds + odd_cnt - 1; odds <= odd; odd--) {
+    for (odd = first + cnt - 1; first <= odd; odd--) {
 	if (len == odd->clen && 0 == strncmp(classname, odd->classname, len)) {
 	    return odd;
 	}
@@ -213,19 +228,14 @@ oj_odd_set_arg(OddArgs args, const char *key, size_t klen, VALUE value) {
 
 void
 oj_reg_odd(VALUE clas, VALUE create_object, VALUE create_method, int mcnt, VALUE *members, bool raw) {
+    Odd		grown = ALLOC_N(struct _Odd, odd_cnt + 1);
     Odd		odd;
     const char	**np;
     ID		*ap;
     AttrGetFunc	*fp;
 
-    if (_odds == odds) {
-	odds = ALLOC_N(struct _Odd, odd_cnt + 1);
-
-	memcpy(odds, _odds, sizeof(struct _Odd) * odd_cnt);
-    } else {
-	REALLOC_N(odds, struct _Odd, odd_cnt + 1);
-    }
-    odd = odds + odd_cnt;
+    memcpy(grown, odds, sizeof(struct _Odd) * odd_cnt);
+    odd = grown + odd_cnt;
     odd->clas = clas;
     odd->classname = strdup(rb_class2name(clas));
     odd->clen = strlen(odd->classname);
@@ -251,5 +261,6 @@ oj_reg_odd(VALUE clas, VALUE create_object, VALUE create_method, int mcnt, VALUE
     }
     *np = 0;
     *ap = 0;
-    odd_cnt++;
+    STORE_RELEASE(odds, grown);
+    STORE_RELEASE(odd_cnt, odd_cnt + 1);
 }
@@ -41,7 +41,11 @@
 #include "parse.h"
 #include "hash.h"
 #include "odd.h"
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+#include "ruby/ractor.h"
+#endif
 #include "encode.h"
+#include "nogvl.h"
 
 typedef struct _YesNoOpt {
     VALUE	sym;
@@ -103,6 +107,7 @@ VALUE	oj_string_writer_class;
 VALUE	oj_stringio_class;
 VALUE	oj_struct_class;
 
+VALUE	oj_skip_key;
 VALUE	oj_slash_string;
 
 static VALUE	allow_gc_sym;
@@ -111,21 +116,30 @@ static VALUE	ascii_only_sym;
 static VALUE	ascii_sym;
 static VALUE	auto_define_sym;
 static VALUE	auto_sym;
+static VALUE	batch_sym;
 static VALUE	bigdecimal_as_decimal_sym;
 static VALUE	bigdecimal_load_sym;
 static VALUE	bigdecimal_sym;
+static VALUE	cache_keys_sym;
 static VALUE	circular_sym;
 static VALUE	class_cache_sym;
 static VALUE	compat_sym;
 static VALUE	create_id_sym;
 static VALUE	escape_mode_sym;
+static VALUE	fast_sym;
+static VALUE	first_line_sym;
+static VALUE	float_format_sym;
 static VALUE	float_prec_sym;
 static VALUE	float_sym;
+static VALUE	global_sym;
 static VALUE	hash_class_sym;
+static VALUE	hits_sym;
 static VALUE	huge_sym;
 static VALUE	indent_sym;
 static VALUE	json_parser_error_class;
 static VALUE	json_sym;
+static VALUE	misses_sym;
+static VALUE	mmap_sym;
 static VALUE	mode_sym;
 static VALUE	nan_sym;
 static VALUE	newline_sym;
@@ -134,10 +148,14 @@ static VALUE	empty_string_sym;
 static VALUE	null_sym;
 static VALUE	object_sym;
 static VALUE	omit_nil_sym;
+static VALUE	only_sym;
+static VALUE	packed_sym;
 static VALUE	quirks_mode_sym;
 static VALUE	raise_sym;
 static VALUE	ruby_sym;
 static VALUE	sec_prec_sym;
+static VALUE	size_sym;
+static VALUE	skip_errors_sym;
 static VALUE	strict_sym;
 static VALUE	symbol_keys_sym;
 static VALUE	time_format_sym;
@@ -194,7 +212,12 @@ struct _Options	oj_default_options = {
     9,		// sec_prec
     15,		// float_prec
     "%0.15g",	// float_fmt
+    RubyFloat,	// float_format
+    MapAuto,	// mem_map
+    KeyCacheOff,// cache_keys
     Qnil,	// hash_class
+    Qnil,	// only
+    Qnil,	// packed
     {		// dump_opts
 	false,	//use
 	"",	// indent
@@ -230,6 +253,9 @@ static VALUE	define_mimic_json(int argc, VALUE *argv, VALUE self);
  * - create_id: [String|nil] create id for json compatible object encoding, default is 'json_create'
  * - second_precision: [Fixnum|nil] number of digits after the decimal when dumping the seconds portion of time
  * - float_precision: [Fixnum|nil] number of digits of precision when dumping floats, 0 indicates use Ruby
+ * - float_format: [:ruby|:fast] :fast dumps floats with a built in shortest round trip formatter that matches Float#to_s and ignores float_precision, :ruby uses float_precision
+ * - mmap: [true|false|:auto] memory map files for load_file and Oj::Doc.open_file instead of reading them, :auto maps files of 64K or more
+ * - cache_keys: [true|false|:global] reuse frozen hash key Strings or Symbols for repeated keys, true caches for a single load and :global caches across loads
  * - use_to_json: [true|false|nil] call to_json() methods on dump, default is false
  * - use_as_json: [true|false|nil] call as_json() methods on dump, default is false
  * - nilnil: [true|false|nil] if true a nil input to load will return nil and not raise an Exception
@@ -244,6 +270,8 @@ static VALUE	define_mimic_json(int argc, VALUE *argv, VALUE self);
  * - array_nl: [String|nil] String to use after a JSON array value
  * - nan: [:null|:huge|:word|:raise|:auto] how to dump Infinity and NaN in null, strict, and compat mode. :null places a null, :huge places a huge number, :word places Infinity or NaN, :raise raises and exception, :auto uses default for each mode.
  * - hash_class: [Class|nil] Class to use instead of Hash on load
+ * - only: [Array|nil] JSON Pointer style paths, such as "/user/id", of the values to load with * matching any key or element, other values are skipped
+ * - packed: [Array|nil] JSON Pointer style paths of arrays of numbers to load as a binary String of native doubles, as from Array#pack('d*'), in place of an Array
  * - omit_nil: [true|false] if true Hash and Object attributes with nil values are omitted
  * @return [Hash] all current option settings.
  */
@@ -270,6 +298,19 @@ get_def_opts(VALUE self) {
     rb_hash_aset(opts, quirks_mode_sym, (Yes == oj_default_options.quirks_mode) ? Qtrue : ((No == oj_default_options.quirks_mode) ? Qfalse : Qnil));
     rb_hash_aset(opts, allow_invalid_unicode_sym, (Yes == oj_default_options.allow_invalid) ? Qtrue : ((No == oj_default_options.allow_invalid) ? Qfalse : Qnil));
     rb_hash_aset(opts, float_prec_sym, INT2FIX(oj_default_options.float_prec));
+    rb_hash_aset(opts, float_format_sym, (FastFloat == oj_default_options.float_format) ? fast_sym : ruby_sym);
+    switch (oj_default_options.mem_map) {
+    case MapOn:		rb_hash_aset(opts, mmap_sym, Qtrue);	break;
+    case MapOff:	rb_hash_aset(opts, mmap_sym, Qfalse);	break;
+    case MapAuto:
+    default:		rb_hash_aset(opts, mmap_sym, auto_sym);	break;
+    }
+    switch (oj_default_options.cache_keys) {
+    case KeyCacheParse:	rb_hash_aset(opts, cache_keys_sym, Qtrue);	break;
+    case KeyCacheGlobal:rb_hash_aset(opts, cache_keys_sym, global_sym);	break;
+    case KeyCacheOff:
+    default:		rb_hash_aset(opts, cache_keys_sym, Qfalse);	break;
+    }
     switch (oj_default_options.mode) {
     case StrictMode:	rb_hash_aset(opts, mode_sym, strict_sym);	break;
     case CompatMode:	rb_hash_aset(opts, mode_sym, compat_sym);	break;
@@ -313,6 +354,8 @@ get_def_opts(VALUE self) {
     }
     rb_hash_aset(opts, omit_nil_sym, oj_default_options.dump_opts.omit_nil ? Qtrue : Qfalse);
     rb_hash_aset(opts, hash_class_sym, oj_default_options.hash_class);
+    rb_hash_aset(opts, only_sym, oj_default_options.only);
+    rb_hash_aset(opts, packed_sym, oj_default_options.packed);
     
     return opts;
 }
@@ -348,6 +391,9 @@ get_def_opts(VALUE self) {
  * @param [String|nil] :create_id create id for json compatible object encoding
  * @param [Fixnum|nil] :second_precision number of digits after the decimal when dumping the seconds portion of time
  * @param [Fixnum|nil] :float_precision number of digits of precision when dumping floats, 0 indicates use Ruby
+ * @param [:ruby|:fast] :float_format :fast dumps floats with a built in shortest round trip formatter that matches Float#to_s and ignores :float_precision, :ruby uses :float_precision
+ * @param [true|false|:auto] :mmap memory map files for load_file and Oj::Doc.open_file instead of reading them, :auto maps files of 64K or more
+ * @param [true|false|:global] :cache_keys reuse frozen hash key Strings or Symbols for repeated keys, true caches for a single load and :global caches across loads
  * @param [true|false|nil] :use_to_json call to_json() methods on dump, default is false
  * @param [true|false|nil] :use_as_json call as_json() methods on dump, default is false
  * @param [true|false|nil] :nilnil if true a nil input to load will return nil and not raise an Exception
@@ -360,17 +406,121 @@ get_def_opts(VALUE self) {
  * @param [String|nil] :array_nl String to use after a JSON array value
  * @param [:null|:huge|:word|:raise] :nan how to dump Infinity and NaN in null, strict, and compat mode. :null places a null, :huge places a huge number, :word places Infinity or NaN, :raise raises and exception, :auto uses default for each mode.
  * @param [Class|nil] :hash_class Class to use instead of Hash on load
+ * @param [Array|nil] :only JSON Pointer style paths, such as "/user/id", of the values to load with * matching any key or element, other values are skipped
+ * @param [Array|nil] :packed JSON Pointer style paths of arrays of numbers to load as a binary String of native doubles, as from Array#pack('d*'), in place of an Array
  * @param [true|false] :omit_nil if true Hash and Object attributes with nil values are omitted
  * @return [nil]
  */
 static VALUE
 set_def_opts(VALUE self, VALUE opts) {
+    oj_check_main_ractor("default_options=");
     Check_Type(opts, T_HASH);
     oj_parse_options(opts, &oj_default_options);
 
     return Qnil;
 }
 
+/* call-seq: key_cache_stats() => Hash
+ *
+ * Returns the number of hash key lookups that were found in the key cache
+ * (:hits), the number that were not (:misses), and the number of keys in the
+ * process wide :global caches (:size). The counts include both single load
+ * and :global caches and are kept atomically when loads run in several
+ * Ractors at once.
+ * @return [Hash] key cache statistics
+ */
+static VALUE
+key_cache_stats(VALUE self) {
+    VALUE	stats = rb_hash_new();
+
+    rb_hash_aset(stats, hits_sym, ULONG2NUM(KEY_COUNT_GET(oj_key_cache_hits)));
+    rb_hash_aset(stats, misses_sym, ULONG2NUM(KEY_COUNT_GET(oj_key_cache_misses)));
+    rb_hash_aset(stats, size_sym, ULONG2NUM(KEY_COUNT_GET(oj_key_cache_size)));
+
+    return stats;
+}
+
+/* call-seq: key_cache_clear() => nil
+ *
+ * Empties the :global key caches and resets the key cache statistics. Loads
+ * in progress keep working and start filling the emptied caches again.
+ * @return [nil]
+ */
+static VALUE
+key_cache_clear(VALUE self) {
+    oj_check_main_ractor("key_cache_clear");
+    oj_key_cache_clear();
+
+    return Qnil;
+}
+
+// Returns a frozen copy of an Array of paths for the :only or :packed option
+// after checking each one.
+static VALUE
+path_list(VALUE v, const char *name) {
+    volatile VALUE	paths;
+    VALUE		path;
+    long		i;
+
+    if (Qnil == v) {
+	return Qnil;
+    }
+    rb_check_type(v, T_ARRAY);
+    paths = rb_ary_new2(RARRAY_LEN(v));
+    for (i = 0; i < RARRAY_LEN(v); i++) {
+	path = rb_ary_entry(v, i);
+	rb_check_type(path, T_STRING);
+	if (0 < RSTRING_LEN(path) && '/' != *RSTRING_PTR(path)) {
+	    rb_raise(rb_eArgError, ":%s paths must start with a '/'.", name);
+	}
+	rb_ary_push(paths, rb_str_new_frozen(path));
+    }
+    return rb_obj_freeze(paths);
+}
+
+typedef struct _CreateId {
+    struct _CreateId	*next;
+    size_t		len;
+    char		str[1];
+} *CreateId;
+
+static CreateId	create_ids = 0;
+
+// Returns a copy of a create_id that is never freed. Options are copied by
+// value into each parse and shared with other Ractors so a create_id that
+// has been handed out may still be in use after it is replaced.
+static const char*
+intern_create_id(const char *str, size_t len) {
+    CreateId	ci;
+
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_lock(&oj_cache_mutex);
+#elif USE_RB_MUTEX
+    rb_mutex_lock(oj_cache_mutex);
+#endif
+    for (ci = create_ids; 0 != ci; ci = ci->next) {
+	if (len == ci->len && 0 == memcmp(str, ci->str, len)) {
+	    break;
+	}
+    }
+    if (0 == ci && 0 != (ci = (CreateId)malloc(sizeof(struct _CreateId) + len))) {
+	memcpy(ci->str, str, len);
+	ci->str[len] = '\0';
+	ci->len = len;
+	ci->next = create_ids;
+	create_ids = ci;
+    }
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_unlock(&oj_cache_mutex);
+#elif USE_RB_MUTEX
+    rb_mutex_unlock(oj_cache_mutex);
+#endif
+    if (0 == ci) {
+	rb_raise(rb_eNoMemError, "not enough memory for the create_id");
+    }
+    return ci->str;
+}
+
 void
 oj_parse_options(VALUE ropts, Options copts) {
     struct _YesNoOpt	ynos[] = {
@@ -446,6 +596,15 @@ oj_parse_options(VALUE ropts, Options copts) {
 	    copts->float_prec = n;
 	}
     }
+    if (Qnil != (v = rb_hash_lookup(ropts, float_format_sym))) {
+	if (fast_sym == v) {
+	    copts->float_format = FastFloat;
+	} else if (ruby_sym == v) {
+	    copts->float_format = RubyFloat;
+	} else {
+	    rb_raise(rb_eArgError, ":float_format must be :ruby or :fast.");
+	}
+    }
     if (Qnil != (v = rb_hash_lookup(ropts, sec_prec_sym))) {
 	int	n;
 
@@ -516,22 +675,40 @@ oj_parse_options(VALUE ropts, Options copts) {
 	    rb_raise(rb_eArgError, ":bigdecimal_load must be :bigdecimal, :float, or :auto.");
 	}
     }
+    if (Qnil != (v = rb_hash_lookup(ropts, mmap_sym))) {
+	if (Qtrue == v) {
+	    copts->mem_map = MapOn;
+	} else if (Qfalse == v) {
+	    copts->mem_map = MapOff;
+	} else if (auto_sym == v) {
+	    copts->mem_map = MapAuto;
+	} else {
+	    rb_raise(rb_eArgError, ":mmap must be true, false, or :auto.");
+	}
+    }
+    if (Qnil != (v = rb_hash_lookup(ropts, cache_keys_sym))) {
+	if (Qtrue == v) {
+	    copts->cache_keys = KeyCacheParse;
+	} else if (Qfalse == v) {
+	    copts->cache_keys = KeyCacheOff;
+	} else if (global_sym == v) {
+	    copts->cache_keys = KeyCacheGlobal;
+	} else {
+	    rb_raise(rb_eArgError, ":cache_keys must be true, false, or :global.");
+	}
+    }
     if (Qtrue == rb_funcall(ropts, has_key_id, 1, create_id_sym)) {
 	v = rb_hash_lookup(ropts, create_id_sym);
 	if (Qnil == v) {
-	    if (json_class != oj_default_options.create_id) {
-		xfree((char*)oj_default_options.create_id);
-	    }
 	    copts->create_id = NULL;
 	    copts->create_id_len = 0;
 	} else if (T_STRING == rb_type(v)) {
 	    const char	*str = StringValuePtr(v);
 
 	    len = RSTRING_LEN(v);
-	    if (len != copts->create_id_len ||
-		0 != strcmp(copts->create_id, str)) {
-		copts->create_id = ALLOC_N(char, len + 1);
-		strcpy((char*)copts->create_id, str);
+	    if (0 == copts->create_id || len != copts->create_id_len ||
+		0 != memcmp(copts->create_id, str, len)) {
+		copts->create_id = intern_create_id(str, len);
 		copts->create_id_len = len;
 	    }
 	} else {
@@ -645,6 +822,12 @@ oj_parse_options(VALUE ropts, Options copts) {
 	    copts->hash_class = v;
 	}
     }
+    if (Qtrue == rb_funcall(ropts, has_key_id, 1, only_sym)) {
+	copts->only = path_list(rb_hash_lookup(ropts, only_sym), "only");
+    }
+    if (Qtrue == rb_funcall(ropts, has_key_id, 1, packed_sym)) {
+	copts->packed = path_list(rb_hash_lookup(ropts, packed_sym), "packed");
+    }
 }
 
 /* Document-method: strict_load
@@ -881,6 +1064,102 @@ load_file(int argc, VALUE *argv, VALUE self) {
     return oj_pi_sparse(argc, argv, &pi, fd);
 }
 
+/* Document-method: load_ndjson
+ *   call-seq: load_ndjson(io, options) { |docs, errors| ... } => Array or nil
+ *
+ * Parses newline delimited JSON, one document per line, from a String, File,
+ * or IO according to the default mode or the mode specified. Lines are found
+ * and parsed in C and the documents are yielded in Arrays of up to :batch
+ * documents so the block is called once per batch instead of once per
+ * line. Blank lines are ignored.
+ *
+ * If :skip_errors is true a line that fails to parse is skipped instead of
+ * raising an exception and the second block argument, an Array of [line,
+ * message] pairs, reports the lines skipped since the last yield.
+ *
+ * Without a block all the documents are returned in a single Array.
+ *
+ * @param [String|IO] io newline delimited JSON String or IO to read from
+ * @param [Hash] options load options (same as default_options) and
+ *   - :batch [Fixnum] number of documents to yield at a time, default 1000
+ *   - :skip_errors [true|false] skip bad lines instead of raising, default false
+ *   - :first_line [Fixnum] line number of the first line, default 1
+ */
+static VALUE
+load_ndjson(int argc, VALUE *argv, VALUE self) {
+    Mode		mode = oj_default_options.mode;
+    long		batch = 1000;
+    long		first_line = 1;
+    int			skip = 0;
+    struct _ParseInfo	pi;
+
+    if (1 > argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to load_ndjson().");
+    }
+    pi.options = oj_default_options;
+    pi.handler = Qnil;
+    pi.err_class = Qnil;
+    if (2 <= argc) {
+	VALUE	ropts = argv[1];
+	VALUE	v;
+
+	Check_Type(ropts, T_HASH);
+	oj_parse_options(ropts, &pi.options);
+	if (Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
+	    if (object_sym == v) {
+		mode = ObjectMode;
+	    } else if (strict_sym == v) {
+		mode = StrictMode;
+	    } else if (compat_sym == v) {
+		mode = CompatMode;
+	    } else if (null_sym == v) {
+		mode = NullMode;
+	    } else {
+		rb_raise(rb_eArgError, ":mode must be :object, :strict, :compat, or :null.");
+	    }
+	}
+	if (Qnil != (v = rb_hash_lookup(ropts, batch_sym))) {
+	    batch = NUM2LONG(v);
+	    if (1 > batch) {
+		rb_raise(rb_eArgError, ":batch must be 1 or more.");
+	    }
+	}
+	if (Qnil != (v = rb_hash_lookup(ropts, first_line_sym))) {
+	    first_line = NUM2LONG(v);
+	}
+	skip = (Qtrue == rb_hash_lookup(ropts, skip_errors_sym));
+    }
+    switch (mode) {
+    case StrictMode:
+	oj_set_strict_callbacks(&pi);
+	break;
+    case NullMode:
+    case CompatMode:
+	oj_set_compat_callbacks(&pi);
+	break;
+    case ObjectMode:
+    default:
+	oj_set_object_callbacks(&pi);
+	break;
+    }
+    return oj_pi_parse_ndjson(*argv, &pi, batch, skip, first_line);
+}
+
+/* call-seq: ndjson_parts(input, part_size) => Array
+ *
+ * Splits newline delimited JSON in a String or File into parts of about
+ * part_size bytes that end at the end of a line. Files are memory mapped
+ * for the scan. Used by Oj.load_ndjson_parallel() to divide the work.
+ *
+ * @param [String|File] input newline delimited JSON
+ * @param [Fixnum] part_size approximate size of each part in bytes
+ * @return [Array] [offset, length, first_line] for each part
+ */
+static VALUE
+ndjson_parts(VALUE self, VALUE input, VALUE part_size) {
+    return oj_ndjson_parts(input, NUM2ULONG(part_size));
+}
+
 /* call-seq: safe_load(doc)
  *
  * Loads a JSON document in strict mode with :auto_define and :symbol_keys
@@ -952,6 +1231,7 @@ dump(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = 0;
+    out.flush = 0;
     out.omit_nil = copts.dump_opts.omit_nil;
     oj_dump_obj_to_json(*argv, &copts, &out);
     if (0 == out.buf) {
@@ -1027,6 +1307,7 @@ to_stream(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 register_odd(int argc, VALUE *argv, VALUE self) {
+    oj_check_main_ractor("register_odd");
     if (3 > argc) {
 	rb_raise(rb_eArgError, "incorrect number of arguments.");
     }
@@ -1067,6 +1348,7 @@ register_odd(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 register_odd_raw(int argc, VALUE *argv, VALUE self) {
+    oj_check_main_ractor("register_odd_raw");
     if (3 > argc) {
 	rb_raise(rb_eArgError, "incorrect number of arguments.");
     }
@@ -1122,6 +1404,7 @@ str_writer_init(StrWriter sw) {
     sw->out.buf = ALLOC_N(char, 4096);
     sw->out.end = sw->out.buf + 4086;
     sw->out.allocated = 1;
+    sw->out.flush = 0;
     sw->out.cur = sw->out.buf;
     *sw->out.cur = '\0';
     sw->out.circ_cnt = 0;
@@ -1367,6 +1650,7 @@ stream_writer_free(void *ptr) {
 static void
 stream_writer_write(StreamWriter sw) {
     ssize_t	size = sw->sw.out.cur - sw->sw.out.buf;
+    int		err;
 
     switch (sw->type) {
     case STRING_IO:
@@ -1376,8 +1660,8 @@ stream_writer_write(StreamWriter sw) {
 	rb_funcall(sw->stream, oj_write_id, 1, rb_str_new(sw->sw.out.buf, size));
 	break;
     case FILE_IO:
-	if (size != write(sw->fd, sw->sw.out.buf, size)) {
-	    rb_raise(rb_eIOError, "Write failed. [%d:%s]\n", errno, strerror(errno));
+	if (0 != (err = oj_write_fd(sw->fd, sw->sw.out.buf, size))) {
+	    rb_raise(rb_eIOError, "Write failed. [%d:%s]\n", err, strerror(err));
 	}
 	break;
     default:
@@ -1622,6 +1906,7 @@ mimic_dump(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = 0;
+    out.flush = 0;
     out.omit_nil = copts.dump_opts.omit_nil;
     oj_dump_obj_to_json(*argv, &copts, &out);
     if (0 == out.buf) {
@@ -1720,6 +2005,7 @@ mimic_generate_core(int argc, VALUE *argv, Options copts) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = 0;
+    out.flush = 0;
     out.omit_nil = copts->dump_opts.omit_nil;
     if (2 == argc && Qnil != argv[1]) {
 	VALUE	ropts = argv[1];
@@ -1885,21 +2171,11 @@ no_op1(VALUE self, VALUE obj) {
 static VALUE
 mimic_set_create_id(VALUE self, VALUE id) {
     Check_Type(id, T_STRING);
+    oj_check_main_ractor("create_id=");
 
-    if (0 != oj_default_options.create_id) {
-	if (json_class != oj_default_options.create_id) {
-	    xfree((char*)oj_default_options.create_id);
-	}
-	oj_default_options.create_id = 0;
-	oj_default_options.create_id_len = 0;
-    }
-    if (Qnil != id) {
-	size_t	len = RSTRING_LEN(id) + 1;
+    oj_default_options.create_id = intern_create_id(StringValuePtr(id), RSTRING_LEN(id));
+    oj_default_options.create_id_len = RSTRING_LEN(id);
 
-	oj_default_options.create_id = ALLOC_N(char, len);
-	strcpy((char*)oj_default_options.create_id, StringValuePtr(id));
-	oj_default_options.create_id_len = len - 1;
-    }
     return id;
 }
 
@@ -1934,7 +2210,12 @@ static struct _Options	mimic_object_to_json_options = {
     9,		// sec_prec
     15,		// float_prec
     "%0.15g",	// float_fmt
+    RubyFloat,	// float_format
+    MapAuto,	// mem_map
+    KeyCacheOff,// cache_keys
     Qnil,	// hash_class
+    Qnil,	// only
+    Qnil,	// packed
     {		// dump_opts
 	false,	//use
 	"",	// indent
@@ -1962,6 +2243,7 @@ mimic_object_to_json(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = 0;
+    out.flush = 0;
     out.omit_nil = copts.dump_opts.omit_nil;
     // Have to turn off to_json to avoid the Active Support recursion problem.
     copts.to_json = No;
@@ -2001,7 +2283,8 @@ define_mimic_json(int argc, VALUE *argv, VALUE self) {
     VALUE	dummy;
     VALUE	verbose;
     VALUE	json_error;
-    
+
+    oj_check_main_ractor("mimic_JSON");
     // Either set the paths to indicate JSON has been loaded or replaces the
     // methods if it has been loaded.
     if (rb_const_defined_at(rb_cObject, rb_intern("JSON"))) {
@@ -2120,9 +2403,46 @@ protect_require(VALUE x) {
     return Qnil;
 }
 
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+// Only the main Ractor has a value for this key.
+static const struct rb_ractor_local_storage_type	main_ractor_type = { 0, 0 };
+static rb_ractor_local_key_t				main_ractor_key;
+#endif
+
+// Returns true if called from the main Ractor or if there are no Ractors.
+int
+oj_main_ractor(void) {
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+    return (0 != rb_ractor_local_storage_ptr(main_ractor_key));
+#else
+    return 1;
+#endif
+}
+
+// Settings shared by all Ractors can only be changed from the main Ractor.
+void
+oj_check_main_ractor(const char *method) {
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+    if (!oj_main_ractor()) {
+	rb_raise(rb_path2class("Ractor::UnsafeError"), "Oj.%s can only be called from the main Ractor.", method);
+    }
+#endif
+}
+
 void Init_oj() {
     int	err = 0;
 
+#if HAVE_RB_EXT_RACTOR_SAFE && !USE_RB_MUTEX
+    // Parsing and dumping only share state that is read only, locked, or
+    // published safely. Calls that change shared settings check that they
+    // are made from the main Ractor. A Ruby Mutex used for the cache lock
+    // can not be shared by Ractors so that build is not marked safe.
+    rb_ext_ractor_safe(true);
+#endif
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+    main_ractor_key = rb_ractor_local_storage_ptr_newkey(&main_ractor_type);
+    rb_ractor_local_storage_ptr_set(main_ractor_key, (void*)&main_ractor_type);
+#endif
     Oj = rb_define_module("Oj");
 
     oj_cstack_class = rb_define_class_under(Oj, "CStack", rb_cObject);
@@ -2169,10 +2489,14 @@ void Init_oj() {
 
     rb_define_module_function(Oj, "default_options", get_def_opts, 0);
     rb_define_module_function(Oj, "default_options=", set_def_opts, 1);
+    rb_define_module_function(Oj, "key_cache_stats", key_cache_stats, 0);
+    rb_define_module_function(Oj, "key_cache_clear", key_cache_clear, 0);
 
     rb_define_module_function(Oj, "mimic_JSON", define_mimic_json, -1);
     rb_define_module_function(Oj, "load", load, -1);
     rb_define_module_function(Oj, "load_file", load_file, -1);
+    rb_define_module_function(Oj, "load_ndjson", load_ndjson, -1);
+    rb_define_module_function(Oj, "ndjson_parts", ndjson_parts, 2);
     rb_define_module_function(Oj, "safe_load", safe_load, 1);
     rb_define_module_function(Oj, "strict_load", oj_strict_parse, -1);
     rb_define_module_function(Oj, "compat_load", oj_compat_parse, -1);
@@ -2247,20 +2571,29 @@ void Init_oj() {
     ascii_sym = ID2SYM(rb_intern("ascii"));		rb_gc_register_address(&ascii_sym);
     auto_define_sym = ID2SYM(rb_intern("auto_define"));	rb_gc_register_address(&auto_define_sym);
     auto_sym = ID2SYM(rb_intern("auto"));		rb_gc_register_address(&auto_sym);
+    batch_sym = ID2SYM(rb_intern("batch"));		rb_gc_register_address(&batch_sym);
     bigdecimal_as_decimal_sym = ID2SYM(rb_intern("bigdecimal_as_decimal"));rb_gc_register_address(&bigdecimal_as_decimal_sym);
     bigdecimal_load_sym = ID2SYM(rb_intern("bigdecimal_load"));rb_gc_register_address(&bigdecimal_load_sym);
     bigdecimal_sym = ID2SYM(rb_intern("bigdecimal"));	rb_gc_register_address(&bigdecimal_sym);
+    cache_keys_sym = ID2SYM(rb_intern("cache_keys"));	rb_gc_register_address(&cache_keys_sym);
     circular_sym = ID2SYM(rb_intern("circular"));	rb_gc_register_address(&circular_sym);
     class_cache_sym = ID2SYM(rb_intern("class_cache"));	rb_gc_register_address(&class_cache_sym);
     compat_sym = ID2SYM(rb_intern("compat"));		rb_gc_register_address(&compat_sym);
     create_id_sym = ID2SYM(rb_intern("create_id"));	rb_gc_register_address(&create_id_sym);
     escape_mode_sym = ID2SYM(rb_intern("escape_mode"));	rb_gc_register_address(&escape_mode_sym);
     float_prec_sym = ID2SYM(rb_intern("float_precision"));rb_gc_register_address(&float_prec_sym);
+    fast_sym = ID2SYM(rb_intern("fast"));		rb_gc_register_address(&fast_sym);
+    first_line_sym = ID2SYM(rb_intern("first_line"));	rb_gc_register_address(&first_line_sym);
+    float_format_sym = ID2SYM(rb_intern("float_format"));rb_gc_register_address(&float_format_sym);
     float_sym = ID2SYM(rb_intern("float"));		rb_gc_register_address(&float_sym);
+    global_sym = ID2SYM(rb_intern("global"));		rb_gc_register_address(&global_sym);
     hash_class_sym = ID2SYM(rb_intern("hash_class"));	rb_gc_register_address(&hash_class_sym);
+    hits_sym = ID2SYM(rb_intern("hits"));		rb_gc_register_address(&hits_sym);
     huge_sym = ID2SYM(rb_intern("huge"));		rb_gc_register_address(&huge_sym);
     indent_sym = ID2SYM(rb_intern("indent"));		rb_gc_register_address(&indent_sym);
     json_sym = ID2SYM(rb_intern("json"));		rb_gc_register_address(&json_sym);
+    misses_sym = ID2SYM(rb_intern("misses"));		rb_gc_register_address(&misses_sym);
+    mmap_sym = ID2SYM(rb_intern("mmap"));		rb_gc_register_address(&mmap_sym);
     mode_sym = ID2SYM(rb_intern("mode"));		rb_gc_register_address(&mode_sym);
     nan_sym = ID2SYM(rb_intern("nan"));			rb_gc_register_address(&nan_sym);
     newline_sym = ID2SYM(rb_intern("newline"));		rb_gc_register_address(&newline_sym);
@@ -2270,11 +2603,15 @@ void Init_oj() {
     object_nl_sym = ID2SYM(rb_intern("object_nl"));	rb_gc_register_address(&object_nl_sym);
     object_sym = ID2SYM(rb_intern("object"));		rb_gc_register_address(&object_sym);
     omit_nil_sym = ID2SYM(rb_intern("omit_nil"));	rb_gc_register_address(&omit_nil_sym);
+    only_sym = ID2SYM(rb_intern("only"));		rb_gc_register_address(&only_sym);
+    packed_sym = ID2SYM(rb_intern("packed"));		rb_gc_register_address(&packed_sym);
     quirks_mode_sym = ID2SYM(rb_intern("quirks_mode"));	rb_gc_register_address(&quirks_mode_sym);
     allow_invalid_unicode_sym = ID2SYM(rb_intern("allow_invalid_unicode"));rb_gc_register_address(&allow_invalid_unicode_sym);
     raise_sym = ID2SYM(rb_intern("raise"));		rb_gc_register_address(&raise_sym);
     ruby_sym = ID2SYM(rb_intern("ruby"));		rb_gc_register_address(&ruby_sym);
     sec_prec_sym = ID2SYM(rb_intern("second_precision"));rb_gc_register_address(&sec_prec_sym);
+    size_sym = ID2SYM(rb_intern("size"));		rb_gc_register_address(&size_sym);
+    skip_errors_sym = ID2SYM(rb_intern("skip_errors"));rb_gc_register_address(&skip_errors_sym);
     space_before_sym = ID2SYM(rb_intern("space_before"));rb_gc_register_address(&space_before_sym);
     space_sym = ID2SYM(rb_intern("space"));		rb_gc_register_address(&space_sym);
     strict_sym = ID2SYM(rb_intern("strict"));		rb_gc_register_address(&strict_sym);
@@ -2288,9 +2625,15 @@ void Init_oj() {
     xmlschema_sym = ID2SYM(rb_intern("xmlschema"));	rb_gc_register_address(&xmlschema_sym);
     xss_safe_sym = ID2SYM(rb_intern("xss_safe"));	rb_gc_register_address(&xss_safe_sym);
 
-    oj_slash_string = rb_str_new2("/");			rb_gc_register_address(&oj_slash_string);
+    oj_slash_string = rb_obj_freeze(rb_str_new2("/"));			rb_gc_register_address(&oj_slash_string);
+
+    // Returned from Oj::ScHandler#hash_key to skip the value of that key.
+    oj_skip_key = rb_obj_freeze(rb_obj_alloc(rb_cObject));		rb_gc_register_address(&oj_skip_key);
+    rb_define_const(rb_define_class_under(Oj, "ScHandler", rb_cObject), "SKIP", oj_skip_key);
 
     oj_default_options.mode = ObjectMode;
+    rb_gc_register_address(&oj_default_options.only);
+    rb_gc_register_address(&oj_default_options.packed);
 
     oj_hash_init();
     oj_odd_init();
@@ -2302,6 +2645,7 @@ void Init_oj() {
     rb_gc_register_address(&oj_cache_mutex);
 #endif
     oj_init_doc();
+    oj_init_parser();
 }
 
 // mimic JSON documentation
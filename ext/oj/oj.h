@@ -105,6 +105,23 @@ typedef enum {
     AutoDec	= 'a'
 } BigLoad;
 
+typedef enum {
+    RubyFloat	= 'r',
+    FastFloat	= 'f'
+} FloatFormat;
+
+typedef enum {
+    MapOn	= 'y',
+    MapOff	= 'n',
+    MapAuto	= 'a'
+} MemMap;
+
+typedef enum {
+    KeyCacheOff		= 'n',
+    KeyCacheParse	= 'p',
+    KeyCacheGlobal	= 'g'
+} KeyCache;
+
 typedef enum {
     ArrayNew	= 'A',
     ArrayType	= 'a',
@@ -165,7 +182,12 @@ typedef struct _Options {
     int			sec_prec;	// second precision when dumping time
     char		float_prec;	// float precision, linked to float_fmt
     char		float_fmt[7];	// float format for dumping, if empty use Ruby
+    char		float_format;	// FloatFormat
+    char		mem_map;	// MemMap
+    char		cache_keys;	// KeyCache
     VALUE		hash_class;	// class to use in place of Hash on load
+    VALUE		only;		// frozen Array of paths to load or Qnil
+    VALUE		packed;		// frozen Array of paths to load as packed doubles or Qnil
     struct _DumpOpts	dump_opts;
 } *Options;
 
@@ -181,6 +203,10 @@ typedef struct _Out {
     uint32_t	hash_cnt;
     int		allocated;
     bool	omit_nil;
+    // If set the buffer is written out with flush instead of growing. The
+    // flush_arg is where it goes, such as an fd or IO.
+    void	(*flush)(struct _Out *out, const char *buf, size_t len);
+    void	*flush_arg;
 } *Out;
 
 typedef struct _StrWriter {
@@ -203,25 +229,55 @@ enum {
     NO_VAL   = 0x00,
     STR_VAL  = 0x01,
     COL_VAL  = 0x02,
-    RUBY_VAL = 0x03
+    RUBY_VAL = 0x03,
+    LAZY_VAL = 0x04  // array or hash not parsed yet, str is the opening bracket
 };
     
 typedef struct _Leaf {
-    struct _Leaf	*next;
     union {
 	const char	*key;	   // hash key
 	size_t		index;	   // array index, 0 is not set
     };
     union {
 	char		*str;	   // pointer to location in json string or allocated
-	struct _Leaf	*elements; // array and hash elements
+	struct {
+	    uint32_t	elements;  // arena position of the first array or hash element
+	    uint32_t	cnt;	   // number of elements
+	};
 	VALUE		value;
     };
+    uint32_t		index_id;  // 1 based Oj::Doc index of the elements, 0 if none
     uint8_t		rtype;
     uint8_t		parent_type;
     uint8_t		value_type;
+    uint8_t		hits;	   // child lookups before an Oj::Doc index is built
 } *Leaf;
 
+// Oj::Doc leaves are stored in chunks that double in size. Chunk k holds
+// 1 << (k + LEAF_CHUNK_SHIFT) leaves starting at arena position
+// ((1 << k) - 1) << LEAF_CHUNK_SHIFT. The elements of an array or hash are
+// contiguous within one chunk.
+#define LEAF_CHUNK_SHIFT	6
+#define LEAF_CHUNK_MAX		(32 - LEAF_CHUNK_SHIFT)
+
+typedef struct _LeafArena {
+    Leaf		chunks[LEAF_CHUNK_MAX];
+    int			cur;	   // chunk being filled
+    uint32_t		next;	   // next free position
+} *LeafArena;
+
+inline static uint32_t
+oj_leaf_chunk_start(int k) {
+    return (((uint32_t)1 << k) - 1) << LEAF_CHUNK_SHIFT;
+}
+
+inline static Leaf
+oj_leaf_at(LeafArena arena, uint32_t pos) {
+    int	k = 31 - __builtin_clz((pos >> LEAF_CHUNK_SHIFT) + 1);
+
+    return arena->chunks[k] + (pos - oj_leaf_chunk_start(k));
+}
+
 extern VALUE	oj_saj_parse(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_sc_parse(int argc, VALUE *argv, VALUE self);
 
@@ -240,8 +296,8 @@ extern void	oj_dump_obj_to_json(VALUE obj, Options copts, Out out);
 extern void	oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VALUE *argv);
 extern void	oj_write_obj_to_file(VALUE obj, const char *path, Options copts);
 extern void	oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts);
-extern void	oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out);
-extern void	oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts);
+extern void	oj_dump_leaf_to_json(Leaf leaf, LeafArena arena, Options copts, Out out);
+extern void	oj_write_leaf_to_file(Leaf leaf, LeafArena arena, const char *path, Options copts);
 
 extern void	oj_str_writer_push_key(StrWriter sw, const char *key);
 extern void	oj_str_writer_push_object(StrWriter sw, const char *key);
@@ -252,6 +308,9 @@ extern void	oj_str_writer_pop(StrWriter sw);
 extern void	oj_str_writer_pop_all(StrWriter sw);
 
 extern void	oj_init_doc(void);
+extern void	oj_init_parser(void);
+extern int	oj_main_ractor(void);
+extern void	oj_check_main_ractor(const char *method);
 
 extern VALUE	Oj;
 extern struct _Options	oj_default_options;
@@ -272,6 +331,7 @@ extern VALUE	oj_string_writer_class;
 extern VALUE	oj_stringio_class;
 extern VALUE	oj_struct_class;
 
+extern VALUE	oj_skip_key;
 extern VALUE	oj_slash_string;
 
 extern ID	oj_add_value_id;
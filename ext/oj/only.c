@@ -0,0 +1,169 @@
+/* only.c
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "only.h"
+
+static OnlyNode
+node_kid(OnlyNode node, const char *key, size_t klen, bool wild) {
+    OnlyNode	kid;
+
+    for (kid = node->kids; 0 != kid; kid = kid->next) {
+	if (wild == kid->wild && klen == kid->klen && 0 == memcmp(key, kid->key, klen)) {
+	    return kid;
+	}
+    }
+    kid = ALLOC(struct _OnlyNode);
+    kid->kids = 0;
+    kid->key = ALLOC_N(char, klen + 1);
+    memcpy(kid->key, key, klen);
+    kid->key[klen] = '\0';
+    kid->klen = klen;
+    kid->wild = wild;
+    kid->all = false;
+    kid->next = node->kids;
+    node->kids = kid;
+
+    return kid;
+}
+
+// Paths follow JSON Pointer so ~1 is a '/' and ~0 a '~' in a key.
+static void
+add_path(OnlyNode node, const char *path, const char *end) {
+    char	*key = ALLOC_N(char, end - path + 1);
+    const char	*start;
+    size_t	klen;
+
+    while (path < end) {
+	for (start = ++path, klen = 0; path < end && '/' != *path; path++) {
+	    if ('~' == *path && path + 1 < end && ('0' == path[1] || '1' == path[1])) {
+		path++;
+		key[klen++] = ('1' == *path) ? '/' : '~';
+	    } else {
+		key[klen++] = *path;
+	    }
+	}
+	node = node_kid(node, key, klen, (1 == path - start && '*' == *start));
+    }
+    node->all = true;
+    xfree(key);
+}
+
+static void
+merge(OnlyNode dst, OnlyNode src) {
+    OnlyNode	kid;
+
+    if (src->all) {
+	dst->all = true;
+    }
+    for (kid = src->kids; 0 != kid; kid = kid->next) {
+	merge(node_kid(dst, kid->key, kid->klen, kid->wild), kid);
+    }
+}
+
+// A key that matches a named segment also matches a '*' segment beside it so
+// the wildcard branch is copied into each named branch. Lookups then only
+// need the first match.
+static void
+spread_wild(OnlyNode node) {
+    OnlyNode	wild = oj_only_wild(node);
+    OnlyNode	kid;
+
+    for (kid = node->kids; 0 != kid; kid = kid->next) {
+	if (0 != wild && kid != wild) {
+	    merge(kid, wild);
+	}
+	spread_wild(kid);
+    }
+}
+
+// The paths are checked by oj_parse_options().
+OnlyNode
+oj_only_create(VALUE paths) {
+    OnlyNode	root;
+    VALUE	path;
+    long	i;
+
+    root = ALLOC(struct _OnlyNode);
+    memset(root, 0, sizeof(struct _OnlyNode));
+    for (i = 0; i < RARRAY_LEN(paths); i++) {
+	path = RARRAY_AREF(paths, i);
+	if (RSTRING_LEN(path) <= 1) {
+	    root->all = true;
+	} else {
+	    add_path(root, RSTRING_PTR(path), RSTRING_PTR(path) + RSTRING_LEN(path));
+	}
+    }
+    spread_wild(root);
+
+    return root;
+}
+
+void
+oj_only_destroy(OnlyNode node) {
+    OnlyNode	kid;
+
+    while (0 != (kid = node->kids)) {
+	node->kids = kid->next;
+	oj_only_destroy(kid);
+    }
+    xfree(node->key);
+    xfree(node);
+}
+
+OnlyNode
+oj_only_kid(OnlyNode node, const char *key, size_t klen) {
+    OnlyNode	kid;
+    OnlyNode	wild = 0;
+
+    for (kid = node->kids; 0 != kid; kid = kid->next) {
+	if (kid->wild) {
+	    wild = kid;
+	} else if (klen == kid->klen && 0 == memcmp(key, kid->key, klen)) {
+	    return kid;
+	}
+    }
+    return wild;
+}
+
+OnlyNode
+oj_only_wild(OnlyNode node) {
+    OnlyNode	kid;
+
+    for (kid = node->kids; 0 != kid; kid = kid->next) {
+	if (kid->wild) {
+	    return kid;
+	}
+    }
+    return 0;
+}
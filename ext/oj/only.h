@@ -0,0 +1,58 @@
+/* only.h
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __OJ_ONLY_H__
+#define __OJ_ONLY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ruby.h"
+
+/* A tree built from the :only load option paths. Each node matches one key
+ * of a hash or, for a '*' segment, any key or array element. Members of a
+ * node with all set are kept without further checks.
+ */
+typedef struct _OnlyNode {
+    struct _OnlyNode	*next;	// next sibling
+    struct _OnlyNode	*kids;
+    char		*key;
+    size_t		klen;
+    bool		wild;	// '*' segment
+    bool		all;
+} *OnlyNode;
+
+extern OnlyNode	oj_only_create(VALUE paths);
+extern void	oj_only_destroy(OnlyNode node);
+extern OnlyNode	oj_only_kid(OnlyNode node, const char *key, size_t klen);
+extern OnlyNode	oj_only_wild(OnlyNode node);
+
+#endif /* __OJ_ONLY_H__ */
@@ -31,12 +31,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#if !IS_WINDOWS
+#include <sys/stat.h>
+#endif
 #include <math.h>
 
 #include "oj.h"
 #include "parse.h"
 #include "buf.h"
+#include "dtoa.h"
+#include "encode.h"
+#include "mapped.h"
+#include "nogvl.h"
+#include "scan.h"
+#include "scan_index.h"
 #include "val_stack.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
@@ -282,7 +292,10 @@ read_escaped_str(ParseInfo pi, const char *start) {
 		return;
 	    }
 	} else {
-	    buf_append(&buf, *s);
+	    const char	*e = oj_scan_str(s + 1, pi->end);
+
+	    buf_append_string(&buf, s, e - s);
+	    s = e - 1;
 	}
     }
     if (0 == parent) {
@@ -303,6 +316,7 @@ read_escaped_str(ParseInfo pi, const char *start) {
 		parent->key = "";
 		parent->klen = 0;
 	    }
+	    only_key(parent, buf.head, buf_len(&buf));
 	    parent->k1 = *start;
 	    parent->next = NEXT_HASH_COLON;
 	    break;
@@ -332,17 +346,17 @@ read_str(ParseInfo pi) {
     const char	*str = pi->cur;
     Val		parent = stack_peek(&pi->stack);
 
-    for (; '"' != *pi->cur; pi->cur++) {
+    // Skip to the first quote, backslash, or NULL in one pass.
+    pi->cur = oj_scan_str(pi->cur, pi->end);
+    if ('"' != *pi->cur) {
 	if (pi->end <= pi->cur) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
-	    return;
 	} else if ('\0' == *pi->cur) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "NULL byte in string");
-	    return;
-	} else if ('\\' == *pi->cur) {
+	} else {
 	    read_escaped_str(pi, str);
-	    return;
 	}
+	return;
     }
     if (0 == parent) { // simple add
 	pi->add_cstr(pi, str, pi->cur - str, str);
@@ -362,6 +376,7 @@ read_str(ParseInfo pi) {
 		parent->key = "";
 		parent->klen = 0;
 	    }
+	    only_key(parent, str, pi->cur - str);
 	    parent->k1 = *str;
 	    parent->next = NEXT_HASH_COLON;
 	    break;
@@ -385,58 +400,57 @@ read_str(ParseInfo pi) {
     pi->cur++; // move past "
 }
 
-static void
-read_num(ParseInfo pi) {
-    struct _NumInfo	ni;
-    Val			parent = stack_peek(&pi->stack);
-
-    ni.str = pi->cur;
-    ni.i = 0;
-    ni.num = 0;
-    ni.div = 1;
-    ni.di = 0;
-    ni.len = 0;
-    ni.exp = 0;
-    ni.big = 0;
-    ni.infinity = 0;
-    ni.nan = 0;
-    ni.neg = 0;
-    ni.hasExp = 0;
-    ni.no_big = (FloatDec == pi->options.bigdec_load);
+// Reads a number into ni. Returns false, with the error set, if it is not a
+// number.
+static bool
+scan_num(ParseInfo pi, NumInfo ni) {
+    ni->str = pi->cur;
+    ni->i = 0;
+    ni->num = 0;
+    ni->div = 1;
+    ni->di = 0;
+    ni->len = 0;
+    ni->exp = 0;
+    ni->big = 0;
+    ni->infinity = 0;
+    ni->nan = 0;
+    ni->neg = 0;
+    ni->hasExp = 0;
+    ni->no_big = (FloatDec == pi->options.bigdec_load);
 
     if ('-' == *pi->cur) {
 	pi->cur++;
-	ni.neg = 1;
+	ni->neg = 1;
     } else if ('+' == *pi->cur) {
 	pi->cur++;
     }
     if ('I' == *pi->cur) {
 	if (0 != strncmp("Infinity", pi->cur, 8)) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
-	    return;
+	    return false;
 	}
 	pi->cur += 8;
-	ni.infinity = 1;
+	ni->infinity = 1;
     } else if ('N' == *pi->cur || 'n' == *pi->cur) {
 	if ('a' != pi->cur[1] || ('N' != pi->cur[2] && 'n' != pi->cur[2])) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
-	    return;
+	    return false;
 	}
 	pi->cur += 3;
-	ni.nan = 1;
+	ni->nan = 1;
     } else {
 	int	dec_cnt = 0;
 
 	for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
-	    if (0 < ni.i) {
+	    if (0 < ni->i) {
 		dec_cnt++;
 	    }
-	    if (!ni.big) {
+	    if (!ni->big) {
 		int	d = (*pi->cur - '0');
 
-		ni.i = ni.i * 10 + d;
-		if (INT64_MAX <= ni.i || DEC_MAX < dec_cnt) {
-		    ni.big = 1;
+		ni->i = ni->i * 10 + d;
+		if (INT64_MAX <= ni->i || DEC_MAX < dec_cnt) {
+		    ni->big = 1;
 		}
 	    }
 	}
@@ -445,21 +459,21 @@ read_num(ParseInfo pi) {
 	    for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
 		int	d = (*pi->cur - '0');
 
-		if (0 < ni.num || 0 < ni.i) {
+		if (0 < ni->num || 0 < ni->i) {
 		    dec_cnt++;
 		}
-		ni.num = ni.num * 10 + d;
-		ni.div *= 10;
-		ni.di++;
-		if (INT64_MAX <= ni.div || DEC_MAX < dec_cnt) {
-		    ni.big = 1;
+		ni->num = ni->num * 10 + d;
+		ni->div *= 10;
+		ni->di++;
+		if (INT64_MAX <= ni->div || DEC_MAX < dec_cnt) {
+		    ni->big = 1;
 		}
 	    }
 	}
 	if ('e' == *pi->cur || 'E' == *pi->cur) {
 	    int	eneg = 0;
 
-	    ni.hasExp = 1;
+	    ni->hasExp = 1;
 	    pi->cur++;
 	    if ('-' == *pi->cur) {
 		pi->cur++;
@@ -468,30 +482,41 @@ read_num(ParseInfo pi) {
 		pi->cur++;
 	    }
 	    for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
-		ni.exp = ni.exp * 10 + (*pi->cur - '0');
-		if (EXP_MAX <= ni.exp) {
-		    ni.big = 1;
+		ni->exp = ni->exp * 10 + (*pi->cur - '0');
+		if (EXP_MAX <= ni->exp) {
+		    ni->big = 1;
 		}
 	    }
 	    if (eneg) {
-		ni.exp = -ni.exp;
+		ni->exp = -ni->exp;
 	    }
 	}
-	ni.len = pi->cur - ni.str;
+	ni->len = pi->cur - ni->str;
     }
     // Check for special reserved values for Infinity and NaN.
-    if (ni.big) {
-	if (0 == strcasecmp(INF_VAL, ni.str)) {
-	    ni.infinity = 1;
-	} else if (0 == strcasecmp(NINF_VAL, ni.str)) {
-	    ni.infinity = 1;
-	    ni.neg = 1;
-	} else if (0 == strcasecmp(NAN_VAL, ni.str)) {
-	    ni.nan = 1;
+    if (ni->big) {
+	if (0 == strcasecmp(INF_VAL, ni->str)) {
+	    ni->infinity = 1;
+	} else if (0 == strcasecmp(NINF_VAL, ni->str)) {
+	    ni->infinity = 1;
+	    ni->neg = 1;
+	} else if (0 == strcasecmp(NAN_VAL, ni->str)) {
+	    ni->nan = 1;
 	}
     }
     if (BigDec == pi->options.bigdec_load) {
-	ni.big = 1;
+	ni->big = 1;
+    }
+    return true;
+}
+
+static void
+read_num(ParseInfo pi) {
+    struct _NumInfo	ni;
+    Val			parent = stack_peek(&pi->stack);
+
+    if (!scan_num(pi, &ni)) {
+	return;
     }
     if (0 == parent) {
 	pi->add_num(pi, &ni);
@@ -517,11 +542,248 @@ read_num(ParseInfo pi) {
     }
 }
 
+// Numbers converted before they are added to the array as a group. The
+// values are on the C stack so the GC finds them without marking.
+#define NUM_RUN_MAX	64
+
+// Reads the numbers at the start of the array just opened and adds them with
+// the array_append_values callback in groups instead of one callback each.
+// The run ends at anything other than a plain number, such as a string or
+// Infinity, which is then read as usual.
+static void
+read_num_run(ParseInfo pi, Val array) {
+    VALUE		vals[NUM_RUN_MAX];
+    struct _NumInfo	ni;
+    const char		*start;
+    long		cnt = 0;
+
+    while (1) {
+	next_non_white(pi);
+	start = pi->cur;
+	if (('0' > *start || '9' < *start) && '-' != *start) {
+	    break;
+	}
+	if (!scan_num(pi, &ni)) {
+	    break;
+	}
+	if (ni.infinity || ni.nan) {
+	    pi->cur = start;
+	    break;
+	}
+	vals[cnt++] = oj_num_as_value(&ni);
+	array->next = NEXT_ARRAY_COMMA;
+	if (NUM_RUN_MAX <= cnt) {
+	    pi->array_append_values(pi, vals, cnt);
+	    cnt = 0;
+	}
+	next_non_white(pi);
+	if (',' != *pi->cur) {
+	    break;
+	}
+	pi->cur++;
+	array->next = NEXT_ARRAY_ELEMENT;
+    }
+    if (0 < cnt) {
+	pi->array_append_values(pi, vals, cnt);
+    }
+}
+
+// Reads an array on a :packed path into a binary String of native doubles in
+// place of an Array. Only numbers are allowed in the array, including
+// Infinity and NaN if the mode allows them.
+static void
+read_packed(ParseInfo pi) {
+    struct _Buf		buf;
+    struct _NumInfo	ni;
+    double		d;
+    volatile VALUE	rstr;
+
+    buf_init(&buf);
+    next_non_white(pi);
+    if (']' == *pi->cur) {
+	pi->cur++;
+    } else {
+	while (1) {
+	    next_non_white(pi);
+	    if (0 == strchr("+-0123456789INn", *pi->cur) || '\0' == *pi->cur) {
+		pi->cur++;
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected a number in a packed array");
+		break;
+	    }
+	    if (!scan_num(pi, &ni)) {
+		break;
+	    }
+	    // Rejected where the strict array_append_num callback would.
+	    if ((ni.infinity || ni.nan) && oj_strict_array_nums(pi)) {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+		break;
+	    }
+	    d = oj_num_as_double(&ni);
+	    buf_append_string(&buf, (const char*)&d, sizeof(d));
+	    next_non_white(pi);
+	    if (',' == *pi->cur) {
+		pi->cur++;
+	    } else if (']' == *pi->cur) {
+		pi->cur++;
+		break;
+	    } else {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected a comma or array close");
+		break;
+	    }
+	}
+    }
+    if (err_has(&pi->err)) {
+	buf_cleanup(&buf);
+	return;
+    }
+    rstr = rb_str_new(buf.head, buf_len(&buf));
+    buf_cleanup(&buf);
+    add_value(pi, rstr);
+}
+
+// Moves past a value that is not wanted, either because the hash_key callback
+// asked to skip it or it is not on an :only path. Only string and container
+// boundaries are tracked so nothing is created for the value and it is not
+// otherwise checked.
+static void
+skip_value(ParseInfo pi) {
+    int	depth = 0;
+    int	empty = 1;
+
+    for (; 1; pi->cur++) {
+	switch (*pi->cur) {
+	case ' ':
+	case '\t':
+	case '\f':
+	case '\n':
+	case '\r':
+	    continue;
+	case '"':
+	    for (pi->cur++; '"' != *pi->cur; pi->cur++) {
+		if ('\\' == *pi->cur) {
+		    pi->cur++;
+		}
+		if ('\0' == *pi->cur) {
+		    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
+		    return;
+		}
+	    }
+	    break;
+	case '{':
+	case '[':
+	    depth++;
+	    break;
+	case '}':
+	case ']':
+	    if (0 == depth) {
+		goto DONE;
+	    }
+	    depth--;
+	    break;
+	case ',':
+	    if (0 == depth) {
+		goto DONE;
+	    }
+	    break;
+	case '/':
+	    pi->cur++;
+	    skip_comment(pi);
+	    if (err_has(&pi->err)) {
+		return;
+	    }
+	    pi->cur--;
+	    continue;
+	case '\0':
+	    if (0 == depth) {
+		goto DONE;
+	    }
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+	    return;
+	default:
+	    break;
+	}
+	empty = 0;
+    }
+ DONE:
+    if (empty) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected a value");
+    }
+}
+
+// Skips the next value if no :only path goes through it. Only hashes and
+// arrays are kept on the way to the end of a path.
+static int
+only_skip(ParseInfo pi, OnlyNode kid) {
+    if (0 != kid) {
+	if (kid->all) {
+	    return 0;
+	}
+	next_non_white(pi);
+	if ('{' == *pi->cur || '[' == *pi->cur) {
+	    return 0;
+	}
+    }
+    skip_value(pi);
+
+    return 1;
+}
+
+// Skips array elements not on an :only path up to the next one to keep or
+// the array close.
+static void
+only_elements(ParseInfo pi, Val array) {
+    while (1) {
+	next_non_white(pi);
+	if (']' == *pi->cur || !only_skip(pi, array->kid) || err_has(&pi->err)) {
+	    break;
+	}
+	if (',' != *pi->cur) {
+	    array->next = NEXT_ARRAY_COMMA;
+	    break;
+	}
+	pi->cur++;
+	array->next = NEXT_ARRAY_ELEMENT;
+    }
+}
+
+// Returns the member count the index found for the array or hash opened
+// just before pi->cur or 0 if not known.
+inline static size_t
+col_size(ParseInfo pi, const uint32_t *sp) {
+    if (0 != pi->ssizes && pi->json + *sp == pi->cur - 1) {
+	return pi->ssizes[sp - pi->sindex];
+    }
+    return 0;
+}
+
 static void
-array_start(ParseInfo pi) {
-    volatile VALUE	v = pi->start_array(pi);
+array_start(ParseInfo pi, size_t size) {
+    volatile VALUE	v;
+    Val			array;
+
+    pi->col_size = size;
+    v = pi->start_array(pi);
+    pi->col_size = 0;
 
     stack_push(&pi->stack, v, NEXT_ARRAY_NEW);
+    array = stack_peek(&pi->stack);
+    if (0 != pi->packed) {
+	packed_start(pi);
+	if (0 != array->pack) {
+	    array->pkid = oj_only_wild(array->pack);
+	}
+    }
+    if (0 != pi->only) {
+	only_start(pi);
+	if (0 != array->only) {
+	    array->kid = oj_only_wild(array->only);
+	    only_elements(pi, array);
+	    return;
+	}
+    }
+    if (0 != pi->array_append_values) {
+	read_num_run(pi, array);
+    }
 }
 
 static void
@@ -539,10 +801,20 @@ array_end(ParseInfo pi) {
 }
 
 static void
-hash_start(ParseInfo pi) {
-    volatile VALUE	v = pi->start_hash(pi);
+hash_start(ParseInfo pi, size_t size) {
+    volatile VALUE	v;
+
+    pi->col_size = size;
+    v = pi->start_hash(pi);
+    pi->col_size = 0;
 
     stack_push(&pi->stack, v, NEXT_HASH_NEW);
+    if (0 != pi->packed) {
+	packed_start(pi);
+    }
+    if (0 != pi->only) {
+	only_start(pi);
+    }
 }
 
 static void
@@ -569,6 +841,9 @@ comma(ParseInfo pi) {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected comma");
     } else if (NEXT_ARRAY_COMMA == parent->next) {
 	parent->next = NEXT_ARRAY_ELEMENT;
+	if (0 != parent->only) {
+	    only_elements(pi, parent);
+	}
     } else if (NEXT_HASH_COMMA == parent->next) {
 	parent->next = NEXT_HASH_KEY;
     } else {
@@ -581,7 +856,14 @@ colon(ParseInfo pi) {
     Val	parent = stack_peek(&pi->stack);
 
     if (0 != parent && NEXT_HASH_COLON == parent->next) {
-	parent->next = NEXT_HASH_VALUE;
+	if (oj_skip_key == parent->key_val) {
+	    skip_value(pi);
+	    parent->next = NEXT_HASH_COMMA;
+	} else if (0 != parent->only && only_skip(pi, parent->kid)) {
+	    parent->next = NEXT_HASH_COMMA;
+	} else {
+	    parent->next = NEXT_HASH_VALUE;
+	}
     } else {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected colon");
     }
@@ -589,25 +871,47 @@ colon(ParseInfo pi) {
 
 void
 oj_parse2(ParseInfo pi) {
-    int	first = 1;
+    const uint32_t	*sp = pi->sindex;
+    int			first = 1;
 
     pi->cur = pi->json;
     err_init(&pi->err);
     while (1) {
-	next_non_white(pi);
+	if (0 == sp) {
+	    next_non_white(pi);
+	} else {
+	    // The index holds the start of every token so white space is
+	    // skipped by jumping to the next entry. Anything else, such as a
+	    // value run into another, is left to the switch below.
+	    for (; pi->json + *sp < pi->cur; sp++) {
+	    }
+	    switch (*pi->cur) {
+	    case ' ':
+	    case '\t':
+	    case '\f':
+	    case '\n':
+	    case '\r':
+		pi->cur = pi->json + *sp;
+		break;
+	    default:
+		break;
+	    }
+	}
 	if (!first && '\0' != *pi->cur) {
+	    pi->cur++;
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected characters after the JSON document");
+	    return;
 	}
 
 	// if no tokens are consumed (i.e. empty string), throw a parse error
 	// this is the behavior of JSON.parse in both Ruby and JS
-	if (No == pi->options.empty_string && 1 == first && '\0' == *pi->cur) {
+	if (No == pi->options.empty_string && 1 == first && '\0' == *pi->cur && stack_empty(&pi->stack)) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected character");
 	}
 
 	switch (*pi->cur++) {
 	case '{':
-	    hash_start(pi);
+	    hash_start(pi, col_size(pi, sp));
 	    break;
 	case '}':
 	    hash_end(pi);
@@ -616,7 +920,11 @@ oj_parse2(ParseInfo pi) {
 	    colon(pi);
 	    break;
 	case '[':
-	    array_start(pi);
+	    if (0 != pi->packed && packed_next(pi)) {
+		read_packed(pi);
+	    } else {
+		array_start(pi, col_size(pi, sp));
+	    }
 	    break;
 	case ']':
 	    array_end(pi);
@@ -696,6 +1004,25 @@ oj_parse2(ParseInfo pi) {
     }
 }
 
+// Converts a number to the nearest double for a :packed array whatever its
+// size or the :bigdecimal_load option.
+double
+oj_num_as_double(NumInfo ni) {
+    if (ni->infinity) {
+	return ni->neg ? -OJ_INFINITY : OJ_INFINITY;
+    }
+    if (ni->nan) {
+	return 0.0/0.0;
+    }
+    if (!ni->big) {
+	if (1 == ni->div && 0 == ni->exp) {
+	    return ni->neg ? -(double)ni->i : (double)ni->i;
+	}
+	return oj_dec2dbl((uint64_t)(ni->i * ni->div + ni->num), (int64_t)ni->exp - ni->di, ni->neg, ni->str, ni->len);
+    }
+    return oj_strtod(ni->str, ni->len);
+}
+
 VALUE
 oj_num_as_value(NumInfo ni) {
     volatile VALUE	rnum = Qnil;
@@ -732,39 +1059,238 @@ oj_num_as_value(NumInfo ni) {
 	    }
 	}
     } else { // decimal
-	if (ni->big) {
+	if (ni->big && !ni->no_big) {
 	    rnum = rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new(ni->str, ni->len));
-	    if (ni->no_big) {
-		rnum = rb_funcall(rnum, rb_intern("to_f"), 0);
+	} else if (ni->big) {
+	    rnum = rb_float_new(oj_strtod(ni->str, ni->len));
+	} else {
+	    // The mantissa has at most DEC_MAX digits so it fits in 64 bits
+	    // and the conversion is correctly rounded.
+	    uint64_t	mant = (uint64_t)(ni->i * ni->div + ni->num);
+
+	    rnum = rb_float_new(oj_dec2dbl(mant, (int64_t)ni->exp - ni->di, ni->neg, ni->str, ni->len));
+	}
+    }
+    return rnum;
+}
+
+// Only this many keys are kept in the process wide caches so documents with
+// many unique keys do not grow them without limit.
+#define KEY_CACHE_MAX	0x00004000
+
+size_t	oj_key_cache_hits = 0;
+size_t	oj_key_cache_misses = 0;
+size_t	oj_key_cache_size = 0;
+
+static Hash	str_key_cache = 0;
+static Hash	sym_key_cache = 0;
+static VALUE	wrapped_global_keys = Qnil;
+
+static void
+mark_key_cache(void *ptr) {
+    if (0 != ptr) {
+	oj_hash_mark((Hash)ptr);
+    }
+}
+
+static void
+free_key_cache(void *ptr) {
+    if (0 != ptr) {
+	oj_hash_destroy((Hash)ptr);
+    }
+}
+
+static void
+mark_global_keys(void *ptr) {
+    if (0 != str_key_cache) {
+	oj_hash_mark(str_key_cache);
+    }
+    if (0 != sym_key_cache) {
+	oj_hash_mark(sym_key_cache);
+    }
+}
+
+// Sets up the key cache for a parse according to the :cache_keys option. A
+// per parse cache is wrapped in a data object so the cached keys are marked
+// while the parse is in progress. The wrapper must be kept on the stack and
+// passed to oj_key_cache_stop() when done.
+VALUE
+oj_key_cache_start(ParseInfo pi) {
+    switch (pi->options.cache_keys) {
+    case KeyCacheParse:
+	pi->key_cache = oj_hash_create();
+	return Data_Wrap_Struct(rb_cObject, mark_key_cache, free_key_cache, pi->key_cache);
+    case KeyCacheGlobal:
+	// The process wide caches are not locked so other Ractors use a per
+	// parse cache instead.
+	if (!oj_main_ractor()) {
+	    pi->key_cache = oj_hash_create();
+	    return Data_Wrap_Struct(rb_cObject, mark_key_cache, free_key_cache, pi->key_cache);
+	}
+	if (Qnil == wrapped_global_keys) {
+	    wrapped_global_keys = Data_Wrap_Struct(rb_cObject, mark_global_keys, 0, 0);
+	    rb_gc_register_address(&wrapped_global_keys);
+	}
+	if (Yes == pi->options.sym_key) {
+	    if (0 == sym_key_cache) {
+		sym_key_cache = oj_hash_create();
 	    }
+	    pi->key_cache = sym_key_cache;
 	} else {
-	    // All these machinations are to get rounding to work better.
-	    long double	d = (long double)ni->i * (long double)ni->div + (long double)ni->num;
-	    int		x = ni->exp - ni->di;
-
-	    // Rounding sometimes cuts off the last digit even if there are only
-	    // 15 digits. This attempts to fix those few cases where this
-	    // occurs.
-	    if ((long double)INT64_MAX > d && (int64_t)d != (ni->i * ni->div + ni->num)) {
-		rnum = rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new(ni->str, ni->len));
-		if (ni->no_big) {
-		    rnum = rb_funcall(rnum, rb_intern("to_f"), 0);
-		}
-	    } else {
-		d = roundl(d);
-		if (0 < x) {
-		    d *= powl(10.0L, x);
-		} else if (0 > x) {
-		    d /= powl(10.0L, -x);
-		}
-		if (ni->neg) {
-		    d = -d;
-		}
-		rnum = rb_float_new((double)d);
+	    if (0 == str_key_cache) {
+		str_key_cache = oj_hash_create();
 	    }
+	    pi->key_cache = str_key_cache;
 	}
+	break;
+    default:
+	pi->key_cache = 0;
+	break;
     }
-    return rnum;
+    return Qnil;
+}
+
+void
+oj_key_cache_stop(ParseInfo pi, VALUE wrapped_cache) {
+    if (Qnil != wrapped_cache) {
+	DATA_PTR(wrapped_cache) = 0;
+	oj_hash_destroy(pi->key_cache);
+    }
+    pi->key_cache = 0;
+}
+
+// Sets the key cache for a parse by an Oj::Parser. A per parse cache is
+// kept by the parser in *ownp for the next parse and is started over once
+// it holds more than KEY_CACHE_MAX keys.
+void
+oj_key_cache_reuse(ParseInfo pi, Hash *ownp) {
+    if (KeyCacheOff == pi->options.cache_keys ||
+	(KeyCacheGlobal == pi->options.cache_keys && oj_main_ractor())) {
+	oj_key_cache_start(pi);
+	return;
+    }
+    if (0 != *ownp && KEY_CACHE_MAX < oj_hash_size(*ownp)) {
+	oj_hash_destroy(*ownp);
+	*ownp = 0;
+    }
+    if (0 == *ownp) {
+	*ownp = oj_hash_create();
+    }
+    pi->key_cache = *ownp;
+}
+
+typedef struct _Paths {
+    OnlyNode	only;
+    OnlyNode	packed;
+} *Paths;
+
+static void
+free_paths(void *ptr) {
+    Paths	paths = (Paths)ptr;
+
+    if (0 != paths->only) {
+	oj_only_destroy(paths->only);
+    }
+    if (0 != paths->packed) {
+	oj_only_destroy(paths->packed);
+    }
+    xfree(paths);
+}
+
+// Builds the path trees for the :only and :packed options. Like the key
+// cache the trees are wrapped so they are freed if the parse raises. The
+// wrapper must be passed to oj_only_stop() when done.
+VALUE
+oj_only_start(ParseInfo pi) {
+    volatile VALUE	wrapped;
+    Paths		paths;
+
+    pi->only = 0;
+    pi->packed = 0;
+    if (Qnil == pi->options.only && Qnil == pi->options.packed) {
+	return Qnil;
+    }
+    wrapped = Data_Make_Struct(rb_cObject, struct _Paths, 0, free_paths, paths);
+    if (Qnil != pi->options.only) {
+	paths->only = oj_only_create(pi->options.only);
+    }
+    if (Qnil != pi->options.packed) {
+	paths->packed = oj_only_create(pi->options.packed);
+    }
+    pi->only = paths->only;
+    pi->packed = paths->packed;
+
+    return wrapped;
+}
+
+void
+oj_only_stop(ParseInfo pi, VALUE wrapped_only) {
+    if (Qnil != wrapped_only) {
+	free_paths(DATA_PTR(wrapped_only));
+	DATA_PTR(wrapped_only) = 0;
+    }
+    pi->only = 0;
+    pi->packed = 0;
+}
+
+void
+oj_key_cache_clear() {
+    // A load in progress, such as one yielding to the block that called
+    // this, may hold either cache so they are emptied and never freed.
+    if (0 != str_key_cache) {
+	oj_hash_clear(str_key_cache);
+    }
+    if (0 != sym_key_cache) {
+	oj_hash_clear(sym_key_cache);
+    }
+    KEY_COUNT_SET(oj_key_cache_hits, 0);
+    KEY_COUNT_SET(oj_key_cache_misses, 0);
+    KEY_COUNT_SET(oj_key_cache_size, 0);
+}
+
+static VALUE
+new_hash_key(ParseInfo pi, const char *key, size_t klen) {
+    volatile VALUE	rkey = rb_str_new(key, klen);
+
+    rkey = oj_encode(rkey);
+    if (Yes == pi->options.sym_key) {
+	rkey = rb_str_intern(rkey);
+    }
+    return rkey;
+}
+
+// Returns the String or Symbol for a hash key. With a key cache the same
+// frozen String or Symbol is returned for each occurrence of a key.
+VALUE
+oj_calc_hash_key(ParseInfo pi, const char *key, size_t klen) {
+    volatile VALUE	rkey;
+    VALUE		*slot = 0;
+    VALUE		**slotp = &slot;
+
+    if (0 == pi->key_cache) {
+	return new_hash_key(pi, key, klen);
+    }
+    if (str_key_cache == pi->key_cache || sym_key_cache == pi->key_cache) {
+	if (KEY_CACHE_MAX <= KEY_COUNT_GET(oj_key_cache_size)) {
+	    slotp = 0; // full so lookup only
+	}
+    }
+    if (Qundef != (rkey = oj_key_hash_get(pi->key_cache, key, klen, slotp))) {
+	KEY_COUNT_INC(oj_key_cache_hits);
+	return rkey;
+    }
+    KEY_COUNT_INC(oj_key_cache_misses);
+    rkey = new_hash_key(pi, key, klen);
+    if (T_STRING == rb_type(rkey)) {
+	rkey = rb_str_freeze(rkey);
+    }
+    if (0 != slot) {
+	*slot = rkey;
+	if (str_key_cache == pi->key_cache || sym_key_cache == pi->key_cache) {
+	    KEY_COUNT_INC(oj_key_cache_size);
+	}
+    }
+    return rkey;
 }
 
 void
@@ -779,7 +1305,7 @@ oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const
     if (0 == pi->json) {
 	oj_err_set(&pi->err, err_clas, "%s at line %d, column %d [%s:%d]", msg, pi->rd.line, pi->rd.col, file, line);
     } else {
-	_oj_err_set_with_location(&pi->err, err_clas, msg, pi->json, pi->cur - 1, file, line);
+	_oj_err_set_with_location(&pi->err, err_clas, msg, pi->json, pi->cur - 1, pi->json_line, file, line);
     }
 }
 
@@ -805,14 +1331,161 @@ oj_pi_set_input_str(ParseInfo pi, volatile VALUE *inputp) {
     pi->end = pi->json + RSTRING_LEN(*inputp);
 }
 
-VALUE
-oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yieldOk) {
-    char		*buf = 0;
-    volatile VALUE	input;
+typedef struct _ScanArgs {
+    const char		*json;
+    size_t		len;
+    struct _ScanIndex	si;
+} *ScanArgs;
+
+static void*
+scan_index(void *x) {
+    ScanArgs	sa = (ScanArgs)x;
+
+    if (oj_scan_index(sa->json, sa->len, &sa->si)) {
+	oj_scan_sizes(sa->json, &sa->si);
+    }
+
+    return 0;
+}
+
+// Parses one document from pi->json up to pi->end once the stack and key
+// cache are set up. A Ruby exception raised while parsing is not re-raised
+// but left as the tag in *linep. Parse errors are left in pi->err. An owned
+// buffer is one no other thread can modify. With part set the input is only
+// part of a document so values left open on the stack are not an error.
+static VALUE
+parse_doc(ParseInfo pi, int owned, int part, int *linep) {
+    volatile VALUE	result;
+    struct _ScanArgs	sa;
+
+    sa.si.pos = 0;
+    sa.si.sizes = 0;
+    sa.si.cnt = 0;
+    if (SCAN_INDEX_MIN <= pi->end - pi->json) {
+	sa.json = pi->json;
+	sa.len = pi->end - pi->json;
+	// A buffer owned by the parser can not change so other Ruby threads
+	// are free to run while it is scanned. A Ruby String could be
+	// modified so the GVL is kept for those.
+	if (owned) {
+	    oj_without_gvl(scan_index, &sa);
+	} else {
+	    scan_index(&sa);
+	}
+    }
+    pi->sindex = sa.si.pos;
+    pi->ssizes = sa.si.sizes;
+    pi->col_size = 0;
+    if (Yes == pi->options.circular) {
+	pi->circ_array = oj_circ_array_new();
+    } else {
+	pi->circ_array = 0;
+    }
+    if (No == pi->options.allow_gc) {
+	rb_gc_disable();
+    }
+    rb_protect(protect_parse, (VALUE)pi, linep);
+    result = stack_head_val(&pi->stack);
+    if (No == pi->options.allow_gc) {
+	rb_gc_enable();
+    }
+    if (!err_has(&pi->err) && !part) {
+	// If the stack is not empty then the JSON terminated early.
+	Val	v;
+
+	if (0 != (v = stack_peek(&pi->stack))) {
+	    switch (v->next) {
+	    case NEXT_ARRAY_NEW:
+	    case NEXT_ARRAY_ELEMENT:
+	    case NEXT_ARRAY_COMMA:
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
+		break;
+	    case NEXT_HASH_NEW:
+	    case NEXT_HASH_KEY:
+	    case NEXT_HASH_COLON:
+	    case NEXT_HASH_VALUE:
+	    case NEXT_HASH_COMMA:
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
+		break;
+	    default:
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+	    }
+	}
+    }
+    if (!err_has(&pi->err) && 0 == *linep && No == pi->options.quirks_mode) {
+	switch (rb_type(result)) {
+	case T_NIL:
+	case T_TRUE:
+	case T_FALSE:
+	case T_FIXNUM:
+	case T_FLOAT:
+	case T_CLASS:
+	case T_STRING:
+	case T_SYMBOL:
+	    oj_err_set(&pi->err, oj_parse_error_class, "unexpected non-document value");
+	    break;
+	default:
+	    // okay
+	    break;
+	}
+    }
+    if (0 != pi->circ_array) {
+	oj_circ_array_free(pi->circ_array);
+	pi->circ_array = 0;
+    }
+    pi->sindex = 0;
+    pi->ssizes = 0;
+    oj_scan_index_free(&sa.si);
+
+    return result;
+}
+
+// Parses pi->json up to pi->end. The buf, if not NULL, is freed when done
+// or unmapped if map_len is not zero.
+static VALUE
+parse_input(ParseInfo pi, char *buf, size_t map_len) {
     volatile VALUE	wrapped_stack;
+    volatile VALUE	wrapped_keys;
+    volatile VALUE	wrapped_only;
     volatile VALUE	result = Qnil;
     int			line = 0;
-    int			free_json = 0;
+
+    pi->json_line = 1;
+    // GC can run at any time. When it runs any Object created by C will be
+    // freed. We protect against this by wrapping the value stack in a ruby
+    // data object and poviding a mark function for ruby objects on the
+    // value stack (while it is in scope).
+    wrapped_keys = oj_key_cache_start(pi);
+    wrapped_only = oj_only_start(pi);
+    wrapped_stack = oj_stack_init(&pi->stack);
+    result = parse_doc(pi, 0 != buf, 0, &line);
+    DATA_PTR(wrapped_stack) = 0;
+    // proceed with cleanup
+    if (0 != map_len) {
+	oj_unmap_file(buf, map_len);
+    } else if (0 != buf) {
+	xfree(buf);
+    }
+    stack_cleanup(&pi->stack);
+    oj_key_cache_stop(pi, wrapped_keys);
+    oj_only_stop(pi, wrapped_only);
+    if (0 != line) {
+	rb_jump_tag(line);
+    }
+    if (err_has(&pi->err)) {
+	if (Qnil != pi->err_class) {
+	    pi->err.clas = pi->err_class;
+	}
+	oj_err_raise(&pi->err);
+    }
+    return result;
+}
+
+VALUE
+oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yieldOk) {
+    char		*buf = 0;
+    size_t		map_len = 0;
+    volatile VALUE	input;
 
     if (argc < 1) {
 	rb_raise(rb_eArgError, "Wrong number of arguments to parse.");
@@ -829,7 +1502,7 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     if (0 != json) {
 	pi->json = json;
 	pi->end = json + len;
-	free_json = 1;
+	buf = json;
     } else if (T_STRING == rb_type(input)) {
 	oj_pi_set_input_str(pi, &input);
     } else if (Qnil == input && Yes == pi->options.nilnil) {
@@ -844,20 +1517,26 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 #if !IS_WINDOWS
 	} else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0))) {
 	    int		fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
-	    ssize_t	cnt;
-	    size_t	len = lseek(fd, 0, SEEK_END);
-
-	    lseek(fd, 0, SEEK_SET);
-	    buf = ALLOC_N(char, len + 1);
-	    pi->json = buf;
-	    pi->end = buf + len;
-	    if (0 >= (cnt = read(fd, (char*)pi->json, len)) || cnt != (ssize_t)len) {
-		if (0 != buf) {
-		    xfree(buf);
+
+	    if (0 != (buf = oj_map_file(fd, &map_len, pi->options.mem_map))) {
+		pi->json = buf;
+		pi->end = buf + map_len;
+	    } else {
+		ssize_t	cnt;
+		size_t	len = lseek(fd, 0, SEEK_END);
+
+		lseek(fd, 0, SEEK_SET);
+		buf = ALLOC_N(char, len + 1);
+		pi->json = buf;
+		pi->end = buf + len;
+		if (0 >= (cnt = oj_read_fd(fd, (char*)pi->json, len)) || cnt != (ssize_t)len) {
+		    if (0 != buf) {
+			xfree(buf);
+		    }
+		    rb_raise(rb_eIOError, "failed to read from IO Object.");
 		}
-		rb_raise(rb_eIOError, "failed to read from IO Object.");
+		((char*)pi->json)[len] = '\0';
 	    }
-	    ((char*)pi->json)[len] = '\0';
 	    /* skip UTF-8 BOM if present */
 	    if (0xEF == (uint8_t)*pi->json && 0xBB == (uint8_t)pi->json[1] && 0xBF == (uint8_t)pi->json[2]) {
 		pi->json += 3;
@@ -870,58 +1549,44 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 	    rb_raise(rb_eArgError, "strict_parse() expected a String or IO Object.");
 }
     }
-    if (Yes == pi->options.circular) {
-	pi->circ_array = oj_circ_array_new();
-    } else {
-	pi->circ_array = 0;
-    }
-    if (No == pi->options.allow_gc) {
-	rb_gc_disable();
-    }
-    // GC can run at any time. When it runs any Object created by C will be
-    // freed. We protect against this by wrapping the value stack in a ruby
-    // data object and poviding a mark function for ruby objects on the
-    // value stack (while it is in scope).
-    wrapped_stack = oj_stack_init(&pi->stack);
-    rb_protect(protect_parse, (VALUE)pi, &line);
-    result = stack_head_val(&pi->stack);
-    DATA_PTR(wrapped_stack) = 0;
-    if (No == pi->options.allow_gc) {
-	rb_gc_enable();
-    }
-    if (!err_has(&pi->err)) {
-	// If the stack is not empty then the JSON terminated early.
-	Val	v;
+    return parse_input(pi, buf, map_len);
+}
 
-	if (0 != (v = stack_peek(&pi->stack))) {
-	    switch (v->next) {
-	    case NEXT_ARRAY_NEW:
-	    case NEXT_ARRAY_ELEMENT:
-	    case NEXT_ARRAY_COMMA:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
-		break;
-	    case NEXT_HASH_NEW:
-	    case NEXT_HASH_KEY:
-	    case NEXT_HASH_COLON:
-	    case NEXT_HASH_VALUE:
-	    case NEXT_HASH_COMMA:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
-		break;
-	    default:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
-	    }
-	}
+// Parses a file mapped with oj_map_file(). The mapping is released before
+// returning.
+VALUE
+oj_pi_parse_mapped(ParseInfo pi, char *json, size_t len) {
+    pi->json = json;
+    pi->end = json + len;
+    /* skip UTF-8 BOM if present */
+    if (0xEF == (uint8_t)*pi->json && 0xBB == (uint8_t)pi->json[1] && 0xBF == (uint8_t)pi->json[2]) {
+	pi->json += 3;
     }
-    // proceed with cleanup
-    if (0 != pi->circ_array) {
-	oj_circ_array_free(pi->circ_array);
+    return parse_input(pi, json, len);
+}
+
+// Parses pi->json up to pi->end with a ParseInfo kept by an Oj::Parser or
+// Oj::PushParser. The stack, key cache, and :only paths are set up once by
+// the parser and are reset instead of being recreated for each document. A
+// top level array left open on the stack by an earlier part is continued.
+// Qundef is returned if part is set and the array is still open.
+static VALUE
+parse_reused(ParseInfo pi, int part) {
+    volatile VALUE	result;
+    int			line = 0;
+
+    pi->proc = Qundef;
+    err_init(&pi->err);
+    if (stack_empty(&pi->stack)) {
+	pi->stack.head->val = Qundef;
+	pi->stack.head->next = NEXT_NONE;
     }
-    if (0 != buf) {
-	xfree(buf);
-    } else if (free_json) {
-	xfree(json);
+    result = parse_doc(pi, 0, part, &line);
+    if (part && 0 == line && !err_has(&pi->err) && !stack_empty(&pi->stack)) {
+	return Qundef;
     }
-    stack_cleanup(&pi->stack);
+    pi->stack.tail = pi->stack.head;
+    pi->stack.head->val = Qundef;
     if (0 != line) {
 	rb_jump_tag(line);
     }
@@ -931,31 +1596,369 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 	}
 	oj_err_raise(&pi->err);
     }
-    if (pi->options.quirks_mode == No) {
-	switch (rb_type(result)) {
-	case T_NIL:
-	case T_TRUE:
-	case T_FALSE:
-	case T_FIXNUM:
-	case T_FLOAT:
-	case T_CLASS:
-	case T_STRING:
-	case T_SYMBOL: {
-	    struct _Err	err;
+    return result;
+}
 
-	    if (Qnil == pi->err_class) {
-		err.clas = oj_parse_error_class;
-	    } else {
-		err.clas = pi->err_class;
+VALUE
+oj_pi_parse_reused(ParseInfo pi, VALUE input) {
+    if (T_STRING != rb_type(input)) {
+	if (Qnil == input && Yes == pi->options.nilnil) {
+	    return Qnil;
+	}
+	rb_raise(rb_eArgError, "Oj::Parser.parse() expected a String.");
+    }
+    // Values are on the stack only while a document is being parsed.
+    if (!stack_empty(&pi->stack)) {
+	rb_raise(rb_eRuntimeError, "Oj::Parser.parse() called while already parsing.");
+    }
+    oj_pi_set_input_str(pi, &input);
+    pi->json_line = 1;
+
+    return parse_reused(pi, 0);
+}
+
+// Parses one document from a buffer that is followed by a '\0'. The line is
+// the line number of the start of the buffer in the input.
+VALUE
+oj_pi_parse_reused_buf(ParseInfo pi, const char *json, const char *end, long line) {
+    pi->json = json;
+    pi->end = end;
+    pi->json_line = line;
+
+    return parse_reused(pi, 0);
+}
+
+// Parses the next part of a top level array from a buffer that is followed
+// by a '\0'. The array stays on the stack between parts so the callbacks for
+// each element are made once the element is complete. The part that closes
+// the array is parsed with oj_pi_parse_reused_buf(), which returns the
+// array. Qundef is returned until then. A parse error or raise drops the
+// array.
+VALUE
+oj_pi_parse_part_buf(ParseInfo pi, const char *json, const char *end, long line) {
+    pi->json = json;
+    pi->end = end;
+    pi->json_line = line;
+
+    return parse_reused(pi, 1);
+}
+
+#define LINE_BUF_SIZE	0x00010000
+
+typedef struct _LineReader {
+    struct _ParseInfo	*pi;
+    volatile VALUE	input;
+    int			fd;
+    size_t		off;	// next byte to copy from a String
+    int			eof;
+    long		line;	// line number of head
+    char		*buf;
+    char		*head;	// start of the next line
+    char		*end;	// end of the data read
+    size_t		size;
+    long		batch;
+    int			skip;
+    volatile VALUE	docs;
+    volatile VALUE	errors;
+    volatile VALUE	all;	// accumulated docs when there is no block
+    volatile VALUE	wrapped_stack;
+    volatile VALUE	wrapped_keys;
+    volatile VALUE	wrapped_only;
+} *LineReader;
+
+static VALUE
+readpartial_cb(VALUE x) {
+    LineReader	lr = (LineReader)x;
+    VALUE	args[1];
+
+    args[0] = ULONG2NUM(lr->size - (lr->end - lr->buf));
+
+    return rb_funcall2(lr->input, oj_readpartial_id, 1, args);
+}
+
+static VALUE
+eof_cb(VALUE x, VALUE err) {
+    return Qnil;
+}
+
+// Moves any partial line to the front of the buffer, growing it if the line
+// fills it, and reads more. Returns 0 at the end of the input.
+static int
+line_reader_fill(LineReader lr) {
+    size_t		len = lr->end - lr->head;
+    size_t		max;
+    volatile VALUE	rstr = Qnil;
+
+    if (lr->buf != lr->head) {
+	memmove(lr->buf, lr->head, len);
+	lr->head = lr->buf;
+	lr->end = lr->buf + len;
+    }
+    if (lr->size <= len) {
+	lr->size *= 2;
+	REALLOC_N(lr->buf, char, lr->size + 1);
+	lr->head = lr->buf;
+	lr->end = lr->buf + len;
+    }
+    max = lr->size - len;
+    if (0 < lr->fd) {
+	ssize_t	cnt = oj_read_fd(lr->fd, lr->end, max);
+
+	if (0 > cnt) {
+	    rb_raise(rb_eIOError, "read failed. [%d:%s]", errno, strerror(errno));
+	}
+	lr->end += cnt;
+
+	return (0 < cnt);
+    }
+    if (T_STRING == rb_type(lr->input)) {
+	size_t	slen = RSTRING_LEN(lr->input);
+
+	if (slen <= lr->off) {
+	    return 0;
+	}
+	if (slen - lr->off < max) {
+	    max = slen - lr->off;
+	}
+	memcpy(lr->end, RSTRING_PTR(lr->input) + lr->off, max);
+	lr->off += max;
+	lr->end += max;
+
+	return 1;
+    }
+    if (rb_respond_to(lr->input, oj_readpartial_id)) {
+	rstr = rb_rescue2(readpartial_cb, (VALUE)lr, eof_cb, Qnil, rb_eEOFError, (VALUE)0);
+    } else {
+	VALUE	args[1];
+
+	args[0] = ULONG2NUM(max);
+	rstr = rb_funcall2(lr->input, oj_read_id, 1, args);
+    }
+    if (Qnil == rstr) {
+	return 0;
+    }
+    StringValue(rstr);
+    if ((size_t)RSTRING_LEN(rstr) < max) {
+	max = RSTRING_LEN(rstr);
+    }
+    memcpy(lr->end, RSTRING_PTR(rstr), max);
+    lr->end += max;
+
+    return (0 < max);
+}
+
+static void
+line_reader_yield(LineReader lr) {
+    if (Qnil != lr->all || (0 == RARRAY_LEN(lr->docs) && 0 == RARRAY_LEN(lr->errors))) {
+	return;
+    }
+    rb_yield_values(2, lr->docs, lr->errors);
+    lr->docs = rb_ary_new2(lr->batch);
+    lr->errors = rb_ary_new();
+}
+
+// Parses the line from lr->head to end which has been terminated with a
+// '\0'. Lines with nothing but white space are skipped.
+static void
+parse_line(LineReader lr, char *end) {
+    ParseInfo		pi = lr->pi;
+    const char		*s = lr->head;
+    volatile VALUE	result;
+    int			line = 0;
+
+    for (; s < end; s++) {
+	if (' ' != *s && '\t' != *s && '\r' != *s && '\f' != *s) {
+	    break;
+	}
+    }
+    if (s == end) {
+	return;
+    }
+    pi->json = lr->head;
+    pi->end = end;
+    pi->json_line = lr->line;
+    err_init(&pi->err);
+    pi->stack.tail = pi->stack.head;
+    pi->stack.head->val = Qundef;
+    pi->stack.head->next = NEXT_NONE;
+    result = parse_doc(pi, 1, 0, &line);
+    if (0 != line) {
+	volatile VALUE	err = rb_errinfo();
+
+	if (!lr->skip || !rb_obj_is_kind_of(err, rb_eStandardError)) {
+	    rb_jump_tag(line);
+	}
+	rb_set_errinfo(Qnil);
+	rb_ary_push(lr->errors, rb_ary_new3(2, LONG2NUM(lr->line), rb_funcall(err, rb_intern("message"), 0)));
+    } else if (err_has(&pi->err)) {
+	if (Qnil != pi->err_class) {
+	    pi->err.clas = pi->err_class;
+	}
+	if (!lr->skip) {
+	    oj_err_raise(&pi->err);
+	}
+	rb_ary_push(lr->errors, rb_ary_new3(2, LONG2NUM(lr->line), rb_str_new2(pi->err.msg)));
+    } else if (Qnil == lr->all) {
+	rb_ary_push(lr->docs, result);
+	if (lr->batch <= RARRAY_LEN(lr->docs)) {
+	    line_reader_yield(lr);
+	}
+    } else {
+	rb_ary_push(lr->all, result);
+    }
+}
+
+static VALUE
+protect_lines(VALUE x) {
+    LineReader	lr = (LineReader)x;
+    char	*nl;
+
+    while (1) {
+	if (0 != (nl = memchr(lr->head, '\n', lr->end - lr->head))) {
+	    *nl = '\0';
+	    parse_line(lr, nl);
+	    lr->head = nl + 1;
+	    lr->line++;
+	} else if (!lr->eof) {
+	    lr->eof = !line_reader_fill(lr);
+	} else {
+	    if (lr->head < lr->end) {
+		*lr->end = '\0';
+		parse_line(lr, lr->end);
 	    }
-	    snprintf(err.msg, sizeof(err.msg), "unexpected non-document value");
-	    oj_err_raise(&err);
 	    break;
 	}
-	default:
-	    // okay
+    }
+    line_reader_yield(lr);
+
+    return (Qnil == lr->all) ? Qnil : lr->all;
+}
+
+static VALUE
+cleanup_lines(VALUE x) {
+    LineReader	lr = (LineReader)x;
+
+    DATA_PTR(lr->wrapped_stack) = 0;
+    stack_cleanup(&lr->pi->stack);
+    oj_key_cache_stop(lr->pi, lr->wrapped_keys);
+    oj_only_stop(lr->pi, lr->wrapped_only);
+    xfree(lr->buf);
+
+    return Qnil;
+}
+
+/* Parses newline delimited JSON from a String or IO, one document per line.
+ * Documents are collected into Arrays of up to batch documents which are
+ * yielded along with an Array of [line, message] pairs for lines that failed
+ * to parse when skip is true. Without skip the first bad line raises. With
+ * no block all the documents are returned in one Array.
+ */
+VALUE
+oj_pi_parse_ndjson(VALUE input, ParseInfo pi, long batch, int skip, long first_line) {
+    struct _LineReader	lr;
+    VALUE		clas = rb_obj_class(input);
+
+    memset(&lr, 0, sizeof(lr));
+    lr.pi = pi;
+    lr.input = input;
+    lr.line = first_line;
+    lr.batch = (0 < batch) ? batch : 1;
+    lr.skip = skip;
+    if (rb_block_given_p()) {
+	lr.all = Qnil;
+	lr.docs = rb_ary_new2(lr.batch);
+	lr.errors = rb_ary_new();
+    } else {
+	lr.all = rb_ary_new();
+	lr.docs = Qnil;
+	lr.errors = rb_ary_new();
+    }
+    if (oj_stringio_class == clas) {
+	lr.input = rb_funcall2(input, oj_string_id, 0, 0);
+#if !IS_WINDOWS
+    } else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0))) {
+	lr.fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
+#endif
+    } else if (T_STRING != rb_type(input) &&
+	       !rb_respond_to(input, oj_readpartial_id) && !rb_respond_to(input, oj_read_id)) {
+	rb_raise(rb_eArgError, "load_ndjson() expected a String or IO Object.");
+    }
+    pi->proc = Qundef;
+    lr.size = LINE_BUF_SIZE;
+    lr.buf = ALLOC_N(char, lr.size + 1);
+    lr.head = lr.buf;
+    lr.end = lr.buf;
+    lr.wrapped_keys = oj_key_cache_start(pi);
+    lr.wrapped_only = oj_only_start(pi);
+    lr.wrapped_stack = oj_stack_init(&pi->stack);
+
+    return rb_ensure(protect_lines, (VALUE)&lr, cleanup_lines, (VALUE)&lr);
+}
+
+static void
+add_part(VALUE parts, size_t start, size_t end, long line) {
+    rb_ary_push(parts, rb_ary_new3(3, ULONG2NUM(start), ULONG2NUM(end - start), LONG2NUM(line)));
+}
+
+/* Splits newline delimited JSON in a String or File into parts of about
+ * part_size bytes that end on a line boundary. Files are mapped for the
+ * scan. Returns an Array of [offset, length, first_line] for each part.
+ */
+VALUE
+oj_ndjson_parts(VALUE input, size_t part_size) {
+    volatile VALUE	parts = rb_ary_new();
+    const char		*json;
+    const char		*s;
+    const char		*end;
+    const char		*next;
+    char		*map = 0;
+    size_t		len = 0;
+    size_t		start = 0;
+    long		line = 1;
+    long		start_line = 1;
+
+    if (0 == part_size) {
+	part_size = 1;
+    }
+    if (T_STRING == rb_type(input)) {
+	json = RSTRING_PTR(input);
+	len = RSTRING_LEN(input);
+#if !IS_WINDOWS
+    } else if (rb_cFile == rb_obj_class(input)) {
+	int	fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
+
+	if (0 == (map = oj_map_file(fd, &len, MapOn))) {
+	    struct stat	st;
+
+	    if (0 != fstat(fd, &st) || 0 != st.st_size) {
+		rb_raise(rb_eIOError, "failed to map the file.");
+	    }
+	    return parts;
+	}
+	json = map;
+#endif
+    } else {
+	rb_raise(rb_eArgError, "ndjson_parts() expected a String or File.");
+    }
+    end = json + len;
+    next = json + part_size;
+    for (s = json; s < end; s++) {
+	if (0 == (s = memchr(s, '\n', end - s))) {
 	    break;
 	}
+	line++;
+	if (next <= s + 1 && s + 1 < end) {
+	    add_part(parts, start, s + 1 - json, start_line);
+	    start = s + 1 - json;
+	    start_line = line;
+	    next = s + 1 + part_size;
+	}
     }
-    return result;
+    if (start < len) {
+	add_part(parts, start, len, start_line);
+    }
+    if (0 != map) {
+	oj_unmap_file(map, len);
+    }
+    return parts;
 }
@@ -38,6 +38,8 @@
 #include "oj.h"
 #include "val_stack.h"
 #include "circarray.h"
+#include "hash.h"
+#include "only.h"
 #include "reader.h"
 
 typedef struct _NumInfo {
@@ -62,6 +64,9 @@ typedef struct _ParseInfo {
     const char		*json;
     const char		*cur;
     const char		*end;
+    const uint32_t	*sindex;	// structural index or NULL, see scan_index.h
+    const uint32_t	*ssizes;	// container sizes for sindex or NULL
+    long		json_line;	// line number of json in the input
     // used for the stream parser
     struct _Reader	rd;
 
@@ -71,6 +76,7 @@ typedef struct _ParseInfo {
     struct _ValStack	stack;
     CircArray		circ_array;
     int			expect_value;
+    size_t		col_size;	// expected members of a new array or hash, 0 if unknown
     VALUE		proc;
     VALUE		(*start_hash)(struct _ParseInfo *pi);
     void		(*end_hash)(struct _ParseInfo *pi);
@@ -84,23 +90,99 @@ typedef struct _ParseInfo {
     void		(*array_append_cstr)(struct _ParseInfo *pi, const char *str, size_t len, const char *orig);
     void		(*array_append_num)(struct _ParseInfo *pi, NumInfo ni);
     void		(*array_append_value)(struct _ParseInfo *pi, VALUE value);
+    // Optional, appends a run of numbers converted by oj_num_as_value().
+    void		(*array_append_values)(struct _ParseInfo *pi, const VALUE *vals, long cnt);
 
     void		(*add_cstr)(struct _ParseInfo *pi, const char *str, size_t len, const char *orig);
     void		(*add_num)(struct _ParseInfo *pi, NumInfo ni);
     void		(*add_value)(struct _ParseInfo *pi, VALUE val);
     VALUE		err_class;
+    Hash		key_cache;	// 0 unless :cache_keys is on
+    struct _OnlyNode	*only;		// 0 unless :only is set
+    struct _OnlyNode	*packed;	// 0 unless :packed is set
 } *ParseInfo;
 
+// Sets the :only paths for the members of the hash or array just pushed.
+static inline void
+only_start(ParseInfo pi) {
+    Val		v = stack_peek(&pi->stack);
+    OnlyNode	node = (pi->stack.head < v) ? (v - 1)->kid : pi->only;
+
+    v->only = (0 == node || node->all) ? 0 : node;
+}
+
+// Matches a hash key against the :only and :packed paths of the hash.
+static inline void
+only_key(Val parent, const char *key, size_t klen) {
+    if (0 != parent->only) {
+	parent->kid = oj_only_kid(parent->only, key, klen);
+    }
+    if (0 != parent->pack) {
+	parent->pkid = oj_only_kid(parent->pack, key, klen);
+    }
+}
+
+// Sets the :packed paths for the members of the hash or array just pushed.
+static inline void
+packed_start(ParseInfo pi) {
+    Val		v = stack_peek(&pi->stack);
+    OnlyNode	node = (pi->stack.head < v) ? (v - 1)->pkid : pi->packed;
+
+    v->pack = (0 == node || node->all) ? 0 : node;
+}
+
+// Returns true if an array read next is on a :packed path.
+static inline bool
+packed_next(ParseInfo pi) {
+    Val		parent = stack_peek(&pi->stack);
+    OnlyNode	node = (0 == parent) ? pi->packed : parent->pkid;
+
+    return (0 != node && node->all);
+}
+
 extern void	oj_parse2(ParseInfo pi);
 extern void	oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const char *format, ...);
 extern VALUE	oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yieldOk);
+extern VALUE	oj_pi_parse_mapped(ParseInfo pi, char *json, size_t len);
+extern VALUE	oj_pi_parse_reused(ParseInfo pi, VALUE input);
+extern VALUE	oj_pi_parse_reused_buf(ParseInfo pi, const char *json, const char *end, long line);
+extern VALUE	oj_pi_parse_part_buf(ParseInfo pi, const char *json, const char *end, long line);
+extern VALUE	oj_pi_parse_ndjson(VALUE input, ParseInfo pi, long batch, int skip, long first_line);
+extern VALUE	oj_ndjson_parts(VALUE input, size_t part_size);
 extern VALUE	oj_num_as_value(NumInfo ni);
+extern double	oj_num_as_double(NumInfo ni);
+extern VALUE	oj_calc_hash_key(ParseInfo pi, const char *key, size_t klen);
+extern VALUE	oj_key_cache_start(ParseInfo pi);
+extern void	oj_key_cache_stop(ParseInfo pi, VALUE wrapped_cache);
+extern void	oj_key_cache_reuse(ParseInfo pi, Hash *ownp);
+extern VALUE	oj_only_start(ParseInfo pi);
+extern void	oj_only_stop(ParseInfo pi, VALUE wrapped_only);
+
+// The key cache counters are updated by loads in any Ractor so they are read
+// and changed atomically where the compiler supports it.
+#if defined(__GNUC__) && defined(__ATOMIC_RELAXED)
+#define KEY_COUNT_GET(c)	__atomic_load_n(&(c), __ATOMIC_RELAXED)
+#define KEY_COUNT_INC(c)	__atomic_fetch_add(&(c), 1, __ATOMIC_RELAXED)
+#define KEY_COUNT_SET(c, v)	__atomic_store_n(&(c), (v), __ATOMIC_RELAXED)
+#else
+#define KEY_COUNT_GET(c)	(c)
+#define KEY_COUNT_INC(c)	((c)++)
+#define KEY_COUNT_SET(c, v)	((c) = (v))
+#endif
+
+extern size_t	oj_key_cache_hits;
+extern size_t	oj_key_cache_misses;
+extern size_t	oj_key_cache_size;
+extern void	oj_key_cache_clear();
 
 extern void	oj_set_strict_callbacks(ParseInfo pi);
+extern bool	oj_strict_array_nums(ParseInfo pi);
 extern void	oj_set_object_callbacks(ParseInfo pi);
 extern void	oj_set_compat_callbacks(ParseInfo pi);
+extern void	oj_set_scp_callbacks(ParseInfo pi, VALUE handler);
 
 extern void	oj_sparse2(ParseInfo pi);
 extern VALUE	oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd);
+extern VALUE	oj_pi_sparse_next(ParseInfo pi);
 
 #endif /* __OJ_PARSE_H__ */
@@ -0,0 +1,700 @@
+/* parser.c
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "parse.h"
+
+typedef struct _Parser {
+    struct _ParseInfo	pi;
+    Hash		keys;	// key cache kept between parses or 0
+    VALUE		io;	// input of the reader used by load() or Qnil
+    int			reading;	// set while load() is reading a document
+} *Parser;
+
+typedef enum {
+    PUSH_WHITE	= 'w', // between top level values
+    PUSH_COL	= 'c', // in an array or hash
+    PUSH_STR	= 's', // in a string
+    PUSH_ESC	= 'e', // after a backslash in a string
+    PUSH_SCALAR	= 'v', // in a top level number or literal
+    PUSH_SLASH	= '/', // after a '/' that may start a comment
+    PUSH_LINE	= 'l', // in a // comment
+    PUSH_BLOCK	= 'b', // in a block comment
+    PUSH_STAR	= '*', // after a '*' in a block comment
+} PushState;
+
+typedef struct _Push {
+    struct _Parser	p;
+    char		*buf;
+    size_t		size;
+    size_t		len;	// bytes in buf
+    size_t		start;	// start of the value being scanned
+    size_t		pos;	// next byte to scan
+    char		*nul;	// where a '\0' replaced saved or 0
+    long		line;	// line number at pos
+    long		start_line;
+    int			depth;
+    int			part;	// top level array parsed in parts at each comma
+    int			skip;	// set while a part is parsed, left set if it raised
+    char		state;	// PushState
+    char		after;	// PushState to return to after a comment
+    char		saved;
+    int			busy;
+    VALUE		proc;	// block given to new() or Qnil
+    VALUE		docs;	// values for feed() to return or Qnil
+} *Push;
+
+static VALUE	parser_class = Qnil;
+static VALUE	push_parser_class = Qnil;
+
+static void
+parser_mark_state(Parser p) {
+    oj_stack_mark(&p->pi.stack);
+    if (0 != p->keys) {
+	oj_hash_mark(p->keys);
+    }
+    rb_gc_mark(p->io);
+    rb_gc_mark(p->pi.options.hash_class);
+    rb_gc_mark(p->pi.options.only);
+    rb_gc_mark(p->pi.options.packed);
+    rb_gc_mark(p->pi.handler);
+}
+
+static void
+parser_mark(void *ptr) {
+    parser_mark_state((Parser)ptr);
+}
+
+static void
+parser_cleanup(Parser p) {
+    stack_cleanup(&p->pi.stack);
+    reader_cleanup(&p->pi.rd);
+    if (0 != p->keys) {
+	oj_hash_destroy(p->keys);
+    }
+    if (0 != p->pi.only) {
+	oj_only_destroy(p->pi.only);
+    }
+    if (0 != p->pi.packed) {
+	oj_only_destroy(p->pi.packed);
+    }
+}
+
+static void
+parser_free(void *ptr) {
+    parser_cleanup((Parser)ptr);
+    xfree(ptr);
+}
+
+static void
+parser_init(Parser p) {
+    memset(p, 0, sizeof(struct _Parser));
+    p->pi.options = oj_default_options;
+    p->pi.handler = Qnil;
+    p->pi.err_class = Qnil;
+    p->io = Qnil;
+    oj_stack_setup(&p->pi.stack);
+}
+
+// Called once the parser is wrapped so the values the options hold are
+// marked and the parser is freed if they are not valid. A handler replaces
+// the callbacks for the mode with ones that call the Oj::ScHandler methods.
+static void
+parser_setup(Parser p, VALUE ropts, VALUE handler) {
+    if (Qnil != ropts) {
+	Check_Type(ropts, T_HASH);
+	oj_parse_options(ropts, &p->pi.options);
+    }
+    if (Qnil != handler) {
+	oj_set_scp_callbacks(&p->pi, handler);
+    } else {
+	switch (p->pi.options.mode) {
+	case StrictMode:
+	    oj_set_strict_callbacks(&p->pi);
+	    break;
+	case NullMode:
+	case CompatMode:
+	    oj_set_compat_callbacks(&p->pi);
+	    break;
+	case ObjectMode:
+	default:
+	    oj_set_object_callbacks(&p->pi);
+	    break;
+	}
+    }
+    if (Qnil != p->pi.options.only) {
+	p->pi.only = oj_only_create(p->pi.options.only);
+    }
+    if (Qnil != p->pi.options.packed) {
+	p->pi.packed = oj_only_create(p->pi.options.packed);
+    }
+}
+
+/* Document-class: Oj::Parser
+ *
+ * A parser that is set up once with a mode and load options and then used
+ * for many documents. The options are not looked at again and the value
+ * stack, key cache, and :only paths are kept between calls to parse() so
+ * parsing many small documents does less work per document than
+ * Oj.load(). Documents can also be read one at a time from an IO with a
+ * reader that is kept between calls. A parser must not be used by more than
+ * one thread at a time.
+ */
+
+/* call-seq: new(options) => Oj::Parser
+ *
+ * Creates a new parser.
+ *
+ * @param [Hash] options load options (same as default_options) including
+ *   :mode which must be :object, :strict, :compat, or :null
+ */
+static VALUE
+parser_new(int argc, VALUE *argv, VALUE self) {
+    Parser		p = ALLOC(struct _Parser);
+    volatile VALUE	wrapped;
+
+    parser_init(p);
+    wrapped = Data_Wrap_Struct(parser_class, parser_mark, parser_free, p);
+    parser_setup(p, (1 <= argc) ? *argv : Qnil, Qnil);
+
+    return wrapped;
+}
+
+/* call-seq: parse(json) => Object, Hash, Array, String, Fixnum, Float, true, false, or nil
+ *
+ * Parses a JSON document String according to the mode and options given
+ * when the parser was created. Raises an exception if the JSON is malformed.
+ *
+ * @param [String] json JSON String to parse
+ */
+static VALUE
+parser_parse(VALUE self, VALUE json) {
+    Parser	p = (Parser)DATA_PTR(self);
+
+    oj_key_cache_reuse(&p->pi, &p->keys);
+
+    return oj_pi_parse_reused(&p->pi, json);
+}
+
+/* call-seq: load(io) => Object, Hash, Array, String, Fixnum, Float, true, false, or nil
+ *
+ * Reads the next JSON document from an IO such as a socket or pipe
+ * according to the mode and options given when the parser was created. The
+ * parser keeps reading where the previous document ended as long as the
+ * same IO is passed so any data read past the end of a document is used for
+ * the next one and the read buffer is reused. Passing a different IO or
+ * calling load() after a parse error starts over with a new reader.
+ * Raises EOFError when there are no more documents.
+ *
+ * @param [IO] io IO or object that responds to readpartial() or read()
+ */
+static VALUE
+parser_load(VALUE self, VALUE io) {
+    Parser		p = (Parser)DATA_PTR(self);
+    volatile VALUE	result;
+
+    if (T_STRING == rb_type(io)) {
+	rb_raise(rb_eArgError, "Oj::Parser.load() expected an IO, use parse() for a String.");
+    }
+    // Values are on the stack only while a document is being parsed.
+    if (!stack_empty(&p->pi.stack)) {
+	rb_raise(rb_eRuntimeError, "Oj::Parser.load() called while already parsing.");
+    }
+    if (io != p->io || p->reading) {
+	reader_cleanup(&p->pi.rd);
+	p->io = Qnil;
+	oj_reader_init(&p->pi.rd, io, 0);
+	p->io = io;
+    }
+    oj_key_cache_reuse(&p->pi, &p->keys);
+    p->reading = 1;
+    result = oj_pi_sparse_next(&p->pi);
+    p->reading = 0;
+    if (Qundef == result) {
+	rb_raise(rb_eEOFError, "end of JSON input");
+    }
+    return result;
+}
+
+static void
+push_mark(void *ptr) {
+    Push	push = (Push)ptr;
+
+    parser_mark_state(&push->p);
+    rb_gc_mark(push->proc);
+    rb_gc_mark(push->docs);
+}
+
+static void
+push_free(void *ptr) {
+    Push	push = (Push)ptr;
+
+    parser_cleanup(&push->p);
+    xfree(push->buf);
+    xfree(push);
+}
+
+static void
+push_reset(Push push) {
+    push->len = 0;
+    push->start = 0;
+    push->pos = 0;
+    push->line = 1;
+    push->start_line = 1;
+    push->depth = 0;
+    push->part = 0;
+    push->skip = 0;
+    push->state = PUSH_WHITE;
+    push->after = PUSH_WHITE;
+}
+
+/* Document-class: Oj::PushParser
+ *
+ * A parser for input that arrives in chunks, such as data from an evented
+ * server, that can not be read with blocking calls. Chunks are passed to
+ * feed() and may end anywhere, even in the middle of a string, escape
+ * sequence, or number. Each top level value is parsed as soon as its last
+ * byte has been fed except for a top level array, each element of which is
+ * parsed as soon as it is complete so only the element being read is
+ * buffered. A top level number or literal is only known to be complete when
+ * the next byte or finish() arrives.
+ */
+
+/* call-seq: new(handler=nil, options={}) { |value| } => Oj::PushParser
+ *
+ * Creates a new push parser. With a block each top level value is yielded
+ * when it is complete. With an Oj::ScHandler its methods are called as they
+ * are for Oj.sc_parse(), those for the elements of a top level array as each
+ * element is complete and the rest once a top level value is complete.
+ * Otherwise feed() and finish() return the values completed.
+ *
+ * @param [Oj::ScHandler] handler optional callback handler
+ * @param [Hash] options load options (same as default_options) including
+ *   :mode which must be :object, :strict, :compat, or :null
+ */
+static VALUE
+push_new(int argc, VALUE *argv, VALUE self) {
+    Push		push = ALLOC(struct _Push);
+    volatile VALUE	wrapped;
+    VALUE		handler = Qnil;
+    VALUE		ropts = Qnil;
+
+    if (1 <= argc && T_HASH == rb_type(*argv)) {
+	ropts = *argv;
+    } else if (1 <= argc) {
+	handler = *argv;
+	if (2 <= argc) {
+	    ropts = argv[1];
+	}
+    }
+    parser_init(&push->p);
+    push->buf = 0;
+    push->size = 0;
+    push->nul = 0;
+    push->busy = 0;
+    push->proc = Qnil;
+    push->docs = Qnil;
+    push_reset(push);
+    wrapped = Data_Wrap_Struct(push_parser_class, push_mark, push_free, push);
+    parser_setup(&push->p, ropts, handler);
+    if (rb_block_given_p()) {
+	push->proc = rb_block_proc();
+    }
+
+    return wrapped;
+}
+
+// Parses the value from start up to end and delivers it. The scan state is
+// already past the value so a raise leaves the parser ready for more input.
+// With part set the input is only part of a top level array and nothing is
+// delivered until the part that closes the array.
+static void
+push_emit(Push push, size_t start, size_t end, long line, int part) {
+    volatile VALUE	value;
+
+    push->nul = push->buf + end;
+    push->saved = *push->nul;
+    *push->nul = '\0';
+    oj_key_cache_reuse(&push->p.pi, &push->p.keys);
+    if (part) {
+	value = oj_pi_parse_part_buf(&push->p.pi, push->buf + start, push->nul, line);
+    } else {
+	value = oj_pi_parse_reused_buf(&push->p.pi, push->buf + start, push->nul, line);
+    }
+    *push->nul = push->saved;
+    push->nul = 0;
+    if (Qundef == value || Qnil != push->p.pi.handler) {
+	return;
+    }
+    if (Qnil != push->proc) {
+	rb_proc_call(push->proc, rb_ary_new3(1, value));
+    } else {
+	rb_ary_push(push->docs, value);
+    }
+}
+
+// Parses the elements of a top level array read since the last part, up to
+// the comma at pos. After a part raises the rest of the array is skipped.
+static void
+push_part(Push push) {
+    size_t	start = push->start;
+    long	line = push->start_line;
+
+    push->start = push->pos;
+    push->start_line = push->line;
+    if (!push->skip) {
+	push->skip = 1;
+	push_emit(push, start, push->pos, line, 1);
+	push->skip = 0;
+    }
+}
+
+// Parses the rest of a top level value from start up to end and delivers
+// it unless it is the end of an array that was dropped by a raise.
+static void
+push_last(Push push, size_t start, size_t end, long line) {
+    int	skip = push->skip;
+
+    push->part = 0;
+    push->skip = 0;
+    if (!skip) {
+	push_emit(push, start, end, line, 0);
+    }
+}
+
+// Finds the end of each top level value in the buffered input, parsing the
+// values as they are found. Only the state of the scan is kept when the end
+// of the input is reached so the next chunk continues where this one left
+// off.
+static void
+push_scan(Push push) {
+    char	c;
+
+    while (push->pos < push->len) {
+	c = push->buf[push->pos];
+	switch (push->state) {
+	case PUSH_WHITE:
+	    switch (c) {
+	    case ' ':
+	    case '\t':
+	    case '\f':
+	    case '\r':
+	    case '\n':
+		break;
+	    case '/':
+		push->after = PUSH_WHITE;
+		push->state = PUSH_SLASH;
+		break;
+	    case '{':
+	    case '[':
+		push->start = push->pos;
+		push->start_line = push->line;
+		push->depth = 1;
+		push->state = PUSH_COL;
+		// Circular references and a :packed top level array need the
+		// whole array.
+		push->part = ('[' == c && Yes != push->p.pi.options.circular &&
+			      !(0 != push->p.pi.packed && push->p.pi.packed->all));
+		break;
+	    case '"':
+		push->start = push->pos;
+		push->start_line = push->line;
+		push->depth = 0;
+		push->state = PUSH_STR;
+		break;
+	    default:
+		push->start = push->pos;
+		push->start_line = push->line;
+		push->state = PUSH_SCALAR;
+		break;
+	    }
+	    break;
+	case PUSH_COL:
+	    switch (c) {
+	    case '"':
+		push->state = PUSH_STR;
+		break;
+	    case '{':
+	    case '[':
+		push->depth++;
+		break;
+	    case '}':
+	    case ']':
+		if (0 == --push->depth) {
+		    push->pos++;
+		    push->state = PUSH_WHITE;
+		    push_last(push, push->start, push->pos, push->start_line);
+		    push->start = push->pos;
+		    continue;
+		}
+		break;
+	    case ',':
+		if (1 == push->depth && push->part) {
+		    push_part(push);
+		}
+		break;
+	    case '/':
+		push->after = PUSH_COL;
+		push->state = PUSH_SLASH;
+		break;
+	    default:
+		break;
+	    }
+	    break;
+	case PUSH_STR:
+	    if ('\\' == c) {
+		push->state = PUSH_ESC;
+	    } else if ('"' == c) {
+		if (0 == push->depth) {
+		    push->pos++;
+		    push->state = PUSH_WHITE;
+		    push_emit(push, push->start, push->pos, push->start_line, 0);
+		    push->start = push->pos;
+		    continue;
+		}
+		push->state = PUSH_COL;
+	    }
+	    break;
+	case PUSH_ESC:
+	    push->state = PUSH_STR;
+	    break;
+	case PUSH_SCALAR:
+	    switch (c) {
+	    case ' ':
+	    case '\t':
+	    case '\f':
+	    case '\r':
+	    case '\n':
+	    case '{':
+	    case '[':
+	    case '}':
+	    case ']':
+	    case ',':
+	    case '"':
+	    case '/':
+		// Not consumed, the next value or comment starts here.
+		push->state = PUSH_WHITE;
+		push_emit(push, push->start, push->pos, push->start_line, 0);
+		push->start = push->pos;
+		continue;
+	    default:
+		break;
+	    }
+	    break;
+	case PUSH_SLASH:
+	    if ('/' == c) {
+		push->state = PUSH_LINE;
+	    } else if ('*' == c) {
+		push->state = PUSH_BLOCK;
+	    } else if (PUSH_WHITE == push->after) {
+		// Not a comment so let the parser report it.
+		push->start = push->pos - 1;
+		push->start_line = push->line;
+		push->state = PUSH_SCALAR;
+		continue;
+	    } else {
+		push->state = push->after;
+		continue;
+	    }
+	    break;
+	case PUSH_LINE:
+	    if ('\n' == c) {
+		push->state = push->after;
+	    }
+	    break;
+	case PUSH_BLOCK:
+	    if ('*' == c) {
+		push->state = PUSH_STAR;
+	    }
+	    break;
+	case PUSH_STAR:
+	    if ('/' == c) {
+		push->state = push->after;
+	    } else if ('*' != c) {
+		push->state = PUSH_BLOCK;
+	    }
+	    break;
+	default:
+	    break;
+	}
+	if ('\n' == c) {
+	    push->line++;
+	}
+	push->pos++;
+    }
+    if (PUSH_WHITE == push->state) {
+	push->start = push->pos;
+    }
+}
+
+static VALUE
+push_feed_cb(VALUE x) {
+    Push	push = (Push)x;
+
+    push_scan(push);
+
+    return push->docs;
+}
+
+static VALUE
+push_finish_cb(VALUE x) {
+    Push	push = (Push)x;
+    size_t	start;
+    size_t	end;
+    long	line;
+    int		pending;
+    int		skip;
+
+    push_scan(push);
+    // Whatever is left is either a top level number or literal that is now
+    // complete or something the parser will report as not terminated. A
+    // trailing // comment is fine.
+    pending = (PUSH_WHITE != push->state && !(PUSH_LINE == push->state && PUSH_WHITE == push->after));
+    start = push->start;
+    end = push->len;
+    line = push->start_line;
+    skip = push->skip;
+    push_reset(push);
+    if (pending && !skip) {
+	push_emit(push, start, end, line, 0);
+    }
+    return push->docs;
+}
+
+static VALUE
+push_done(VALUE x) {
+    Push	push = (Push)x;
+
+    if (0 != push->nul) {
+	*push->nul = push->saved;
+	push->nul = 0;
+    }
+    push->docs = Qnil;
+    push->busy = 0;
+
+    return Qnil;
+}
+
+static void
+push_check(Push push) {
+    if (push->busy) {
+	rb_raise(rb_eRuntimeError, "Oj::PushParser called while already parsing.");
+    }
+}
+
+static void
+push_begin(Push push) {
+    push->busy = 1;
+    push->docs = (Qnil == push->proc && Qnil == push->p.pi.handler) ? rb_ary_new() : Qnil;
+}
+
+// Appends a chunk to the buffer, first dropping anything before the value
+// being scanned.
+static void
+push_append(Push push, VALUE data) {
+    size_t	len = RSTRING_LEN(data);
+
+    if (0 < push->start) {
+	memmove(push->buf, push->buf + push->start, push->len - push->start);
+	push->len -= push->start;
+	push->pos -= push->start;
+	push->start = 0;
+    }
+    if (push->size < push->len + len + 1) {
+	size_t	size = (0 == push->size) ? 4096 : push->size;
+
+	while (size < push->len + len + 1) {
+	    size *= 2;
+	}
+	REALLOC_N(push->buf, char, size);
+	push->size = size;
+    }
+    memcpy(push->buf + push->len, RSTRING_PTR(data), len);
+    push->len += len;
+}
+
+/* call-seq: feed(data) => Array or nil
+ *
+ * Adds the next chunk of input. Each top level value completed by the chunk
+ * is parsed and yielded to the block given to new() or passed to the
+ * handler. Without a block or handler the values are returned in an Array,
+ * in which case a parse error in the chunk also discards the values before
+ * it.
+ *
+ * @param [String] data next part of the JSON input
+ */
+static VALUE
+push_feed(VALUE self, VALUE data) {
+    Push	push = (Push)DATA_PTR(self);
+
+    push_check(push);
+    StringValue(data);
+    push_append(push, data);
+    push_begin(push);
+
+    return rb_ensure(push_feed_cb, (VALUE)push, push_done, (VALUE)push);
+}
+
+/* call-seq: finish() => Array or nil
+ *
+ * Ends the input. A top level number or literal at the end is parsed and
+ * delivered like the values from feed(). An incomplete value raises an
+ * Oj::ParseError. The parser is then ready for a new stream of input.
+ */
+static VALUE
+push_finish(VALUE self) {
+    Push	push = (Push)DATA_PTR(self);
+
+    push_check(push);
+    push_begin(push);
+
+    return rb_ensure(push_finish_cb, (VALUE)push, push_done, (VALUE)push);
+}
+
+void
+oj_init_parser() {
+    parser_class = rb_define_class_under(Oj, "Parser", rb_cObject);
+    rb_gc_register_address(&parser_class);
+    rb_undef_alloc_func(parser_class);
+    rb_define_module_function(parser_class, "new", parser_new, -1);
+    rb_define_method(parser_class, "parse", parser_parse, 1);
+    rb_define_method(parser_class, "load", parser_load, 1);
+
+    push_parser_class = rb_define_class_under(Oj, "PushParser", rb_cObject);
+    rb_gc_register_address(&push_parser_class);
+    rb_undef_alloc_func(push_parser_class);
+    rb_define_module_function(push_parser_class, "new", push_new, -1);
+    rb_define_method(push_parser_class, "feed", push_feed, 1);
+    rb_define_method(push_parser_class, "finish", push_finish, 0);
+}
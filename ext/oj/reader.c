@@ -42,6 +42,7 @@
 #include "ruby.h"
 #include "oj.h"
 #include "reader.h"
+#include "nogvl.h"
 
 #define BUF_PAD	4
 
@@ -229,7 +230,7 @@ read_from_fd(Reader reader) {
     ssize_t	cnt;
     size_t	max = reader->end - reader->tail;
 
-    cnt = read(reader->fd, reader->tail, max);
+    cnt = oj_read_fd(reader->fd, reader->tail, max);
     if (cnt <= 0) {
 	return -1;
     } else if (0 != cnt) {
@@ -64,8 +64,9 @@ reader_get(Reader reader) {
     if ('\n' == *reader->tail) {
 	reader->line++;
 	reader->col = 0;
+    } else {
+	reader->col++;
     }
-    reader->col++;
     
     return *reader->tail++;
 }
@@ -74,7 +75,7 @@ static inline void
 reader_backup(Reader reader) {
     reader->tail--;
     reader->col--;
-    if (0 >= reader->col) {
+    if ('\n' == *reader->tail) {
 	reader->line--;
 	// allow col to be negative since we never backup twice in a row
     }
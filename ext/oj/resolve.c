@@ -102,6 +102,10 @@ oj_name2class(ParseInfo pi, const char *name, size_t len, int auto_define) {
     if (No == pi->options.class_cache) {
 	return resolve_classpath(pi, name, len, auto_define);
     }
+    // Cached classes never change so a hit does not need the lock.
+    if (Qnil != (clas = oj_class_hash_peek(name, len))) {
+	return clas;
+    }
 #if USE_PTHREAD_MUTEX
     pthread_mutex_lock(&oj_cache_mutex);
 #elif USE_RB_MUTEX
@@ -109,7 +113,7 @@ oj_name2class(ParseInfo pi, const char *name, size_t len, int auto_define) {
 #endif
     if (Qnil == (clas = oj_class_hash_get(name, len, &slot))) {
 	if (Qundef != (clas = resolve_classpath(pi, name, len, auto_define))) {
-	    *slot = clas;
+	    oj_hash_set_slot(slot, clas);
 	}
     }
 #if USE_PTHREAD_MUTEX
@@ -0,0 +1,228 @@
+/* scan.h
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __OJ_SCAN_H__
+#define __OJ_SCAN_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "oj.h"
+
+// The vector width is picked by extconf.rb. OJ_USE_AVX2 and OJ_USE_SSE2 are
+// only defined when the compiler targets those instruction sets. Everything
+// else falls back to scanning a 64 bit word at a time.
+#ifdef OJ_USE_AVX2
+#include <immintrin.h>
+#elif defined(OJ_USE_SSE2)
+#include <emmintrin.h>
+#endif
+
+#define SWAR_ONES	0x0101010101010101ULL
+#define SWAR_HIGHS	0x8080808080808080ULL
+
+// Non-zero if any byte in the word is zero. Bytes above the first zero byte
+// can be flagged incorrectly so only use this to decide if a word is clean.
+#define swar_has_zero(x)	(((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+#define swar_has_byte(x, c)	swar_has_zero((x) ^ (SWAR_ONES * (uint8_t)(c)))
+// Non-zero if any byte in the word is less than n, n must be 128 or less.
+#define swar_has_less(x, n)	(((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+
+inline static int
+scan_special(char c) {
+    return ('"' == c || '\\' == c || '\0' == c);
+}
+
+/* Returns a pointer to the first '"', '\\', or '\0' between s and end or end
+ * if there are none. Never reads at or past end.
+ */
+inline static const char*
+oj_scan_str(const char *s, const char *end) {
+#ifdef OJ_USE_AVX2
+    {
+	const __m256i	quote = _mm256_set1_epi8('"');
+	const __m256i	back = _mm256_set1_epi8('\\');
+	const __m256i	zero = _mm256_setzero_si256();
+
+	for (; s + 32 <= end; s += 32) {
+	    __m256i	v = _mm256_loadu_si256((const __m256i*)s);
+	    __m256i	m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+								_mm256_cmpeq_epi8(v, back)),
+					    _mm256_cmpeq_epi8(v, zero));
+	    uint32_t	mask = (uint32_t)_mm256_movemask_epi8(m);
+
+	    if (0 != mask) {
+		return s + __builtin_ctz(mask);
+	    }
+	}
+    }
+#endif
+#if defined(OJ_USE_AVX2) || defined(OJ_USE_SSE2)
+    {
+	const __m128i	quote = _mm_set1_epi8('"');
+	const __m128i	back = _mm_set1_epi8('\\');
+	const __m128i	zero = _mm_setzero_si128();
+
+	for (; s + 16 <= end; s += 16) {
+	    __m128i	v = _mm_loadu_si128((const __m128i*)s);
+	    __m128i	m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+						      _mm_cmpeq_epi8(v, back)),
+					 _mm_cmpeq_epi8(v, zero));
+	    int		mask = _mm_movemask_epi8(m);
+
+	    if (0 != mask) {
+		return s + __builtin_ctz(mask);
+	    }
+	}
+    }
+#else
+    for (; s + 8 <= end; s += 8) {
+	uint64_t	w;
+
+	memcpy(&w, s, sizeof(w));
+	if (swar_has_byte(w, '"') || swar_has_byte(w, '\\') || swar_has_zero(w)) {
+	    break;
+	}
+    }
+#endif
+    for (; s < end; s++) {
+	if (scan_special(*s)) {
+	    break;
+	}
+    }
+    return s;
+}
+
+/* Returns a pointer to the first character between s and end that must be
+ * escaped when dumping with the escape mode or end if the rest is clean. The
+ * cmap is the escape table for the mode and is used for whatever the vector
+ * loop does not cover. Never reads at or past end.
+ */
+inline static const char*
+oj_scan_clean(const char *s, const char *end, char mode, const char *cmap) {
+    int	keep_nl = (NLEsc == mode);
+    int	hibit = (ASCIIEsc == mode || XSSEsc == mode);
+    int	xss = (XSSEsc == mode);
+
+#ifdef OJ_USE_AVX2
+    {
+	const __m256i	ctrl = _mm256_set1_epi8(0x1F);
+	const __m256i	nl = _mm256_set1_epi8('\n');
+	const __m256i	quote = _mm256_set1_epi8('"');
+	const __m256i	back = _mm256_set1_epi8('\\');
+	const __m256i	del = _mm256_set1_epi8(0x7F);
+	const __m256i	amp = _mm256_set1_epi8('&');
+	const __m256i	slash = _mm256_set1_epi8('/');
+	const __m256i	lt = _mm256_set1_epi8('<');
+	const __m256i	gt = _mm256_set1_epi8('>');
+
+	for (; s + 32 <= end; s += 32) {
+	    __m256i	v = _mm256_loadu_si256((const __m256i*)s);
+	    __m256i	m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl), v);
+	    uint32_t	mask;
+
+	    if (keep_nl) {
+		m = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, nl), m);
+	    }
+	    m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, back)));
+	    if (hibit) {
+		m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, del), v));
+	    }
+	    if (xss) {
+		m = _mm256_or_si256(m, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, slash)),
+						       _mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt))));
+	    }
+	    if (0 != (mask = (uint32_t)_mm256_movemask_epi8(m))) {
+		return s + __builtin_ctz(mask);
+	    }
+	}
+    }
+#endif
+#if defined(OJ_USE_AVX2) || defined(OJ_USE_SSE2)
+    {
+	const __m128i	ctrl = _mm_set1_epi8(0x1F);
+	const __m128i	nl = _mm_set1_epi8('\n');
+	const __m128i	quote = _mm_set1_epi8('"');
+	const __m128i	back = _mm_set1_epi8('\\');
+	const __m128i	del = _mm_set1_epi8(0x7F);
+	const __m128i	amp = _mm_set1_epi8('&');
+	const __m128i	slash = _mm_set1_epi8('/');
+	const __m128i	lt = _mm_set1_epi8('<');
+	const __m128i	gt = _mm_set1_epi8('>');
+
+	for (; s + 16 <= end; s += 16) {
+	    __m128i	v = _mm_loadu_si128((const __m128i*)s);
+	    __m128i	m = _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v);
+	    int		mask;
+
+	    if (keep_nl) {
+		m = _mm_andnot_si128(_mm_cmpeq_epi8(v, nl), m);
+	    }
+	    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, back)));
+	    if (hibit) {
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, del), v));
+	    }
+	    if (xss) {
+		m = _mm_or_si128(m, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, slash)),
+						 _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt))));
+	    }
+	    if (0 != (mask = _mm_movemask_epi8(m))) {
+		return s + __builtin_ctz(mask);
+	    }
+	}
+    }
+#else
+    // Newlines are allowed in NLEsc mode but still stop the word scan. The
+    // table check below lets them through.
+    for (; s + 8 <= end; s += 8) {
+	uint64_t	w;
+
+	memcpy(&w, s, sizeof(w));
+	if (swar_has_less(w, 0x20) || swar_has_byte(w, '"') || swar_has_byte(w, '\\')) {
+	    break;
+	}
+	if (hibit && (0 != (w & SWAR_HIGHS) || swar_has_byte(w, 0x7F))) {
+	    break;
+	}
+	if (xss && (swar_has_byte(w, '&') || swar_has_byte(w, '/') || swar_has_byte(w, '<') || swar_has_byte(w, '>'))) {
+	    break;
+	}
+    }
+    (void)keep_nl;
+#endif
+    for (; s < end; s++) {
+	if ('1' != cmap[(uint8_t)*s]) {
+	    break;
+	}
+    }
+    return s;
+}
+
+#endif /* __OJ_SCAN_H__ */
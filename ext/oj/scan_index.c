@@ -0,0 +1,456 @@
+/* scan_index.c
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#if USE_PTHREAD_MUTEX
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "oj.h"
+#include "scan_index.h"
+
+#ifdef OJ_USE_AVX2
+#include <immintrin.h>
+#elif defined(OJ_USE_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* The index is built 64 bytes at a time in the manner of simdjson. Each block
+ * is reduced to bit masks, one bit per byte, for white space, structural
+ * characters, quotes, backslashes, and slashes. Escaped quotes are removed
+ * and a prefix xor of the quotes gives the bytes inside strings. Bits are
+ * then set for structural characters and opening quotes outside of strings
+ * and for the first byte of any other run of non-white characters.
+ *
+ * Nothing here calls Ruby so it can run without the GVL. Memory comes from
+ * malloc for the same reason.
+ */
+
+#define MAX_PARTS	8
+#define EVEN_BITS	0x5555555555555555ULL
+
+typedef struct _Block {
+    uint64_t	ws;
+    uint64_t	op;
+    uint64_t	quote;
+    uint64_t	back;
+    uint64_t	slash;
+} *Block;
+
+typedef struct _Part {
+    const char	*json;
+    size_t	start;
+    size_t	end;
+    uint64_t	escaped;	// carry, first byte of the next block is escaped
+    uint64_t	in_string;	// all ones if the next block starts in a string
+    uint64_t	scalar;		// 1 if the last byte was part of a value run
+    int		odd_quotes;
+    int		fail;		// comment found or out of memory
+    uint32_t	*pos;
+    size_t	cnt;
+    size_t	size;
+} *Part;
+
+enum {
+    WS_CLS	= 0x01,
+    OP_CLS	= 0x02,
+    QUOTE_CLS	= 0x04,
+    BACK_CLS	= 0x08,
+    SLASH_CLS	= 0x10,
+};
+
+static uint8_t	char_class[256] = {
+    0,0,0,0,0,0,0,0,0,1,1,0,1,1,0,0, // \t \n \f \r
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    1,0,4,0,0,0,0,0,0,0,0,0,2,0,0,16, // space " , /
+    0,0,0,0,0,0,0,0,0,0,2,0,0,0,0,0, // :
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,2,8,2,0,0, // [ \ ]
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,2,0,2,0,0, // { }
+};
+
+#if defined(OJ_USE_AVX2) || defined(OJ_USE_SSE2)
+inline static uint64_t
+cmp_mask(__m128i v0, __m128i v1, __m128i v2, __m128i v3, char c) {
+    const __m128i	m = _mm_set1_epi8(c);
+
+    return (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, m)) |
+	((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, m)) << 16) |
+	((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v2, m)) << 32) |
+	((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v3, m)) << 48);
+}
+#endif
+
+static void
+classify(const char *s, Block b) {
+#if defined(OJ_USE_AVX2) || defined(OJ_USE_SSE2)
+    __m128i	v0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i	v1 = _mm_loadu_si128((const __m128i*)(s + 16));
+    __m128i	v2 = _mm_loadu_si128((const __m128i*)(s + 32));
+    __m128i	v3 = _mm_loadu_si128((const __m128i*)(s + 48));
+
+    b->ws = cmp_mask(v0, v1, v2, v3, ' ') | cmp_mask(v0, v1, v2, v3, '\n') |
+	cmp_mask(v0, v1, v2, v3, '\r') | cmp_mask(v0, v1, v2, v3, '\t') | cmp_mask(v0, v1, v2, v3, '\f');
+    b->op = cmp_mask(v0, v1, v2, v3, ',') | cmp_mask(v0, v1, v2, v3, ':') |
+	cmp_mask(v0, v1, v2, v3, '[') | cmp_mask(v0, v1, v2, v3, ']') |
+	cmp_mask(v0, v1, v2, v3, '{') | cmp_mask(v0, v1, v2, v3, '}');
+    b->quote = cmp_mask(v0, v1, v2, v3, '"');
+    b->back = cmp_mask(v0, v1, v2, v3, '\\');
+    b->slash = cmp_mask(v0, v1, v2, v3, '/');
+#else
+    int	i;
+
+    memset(b, 0, sizeof(struct _Block));
+    for (i = 0; i < 64; i++) {
+	uint8_t		c = char_class[(uint8_t)s[i]];
+	uint64_t	bit = (uint64_t)1 << i;
+
+	if (0 != c) {
+	    if (WS_CLS & c) { b->ws |= bit; }
+	    if (OP_CLS & c) { b->op |= bit; }
+	    if (QUOTE_CLS & c) { b->quote |= bit; }
+	    if (BACK_CLS & c) { b->back |= bit; }
+	    if (SLASH_CLS & c) { b->slash |= bit; }
+	}
+    }
+#endif
+}
+
+// Returns the bits of characters escaped by a backslash. Runs of backslashes
+// escape every other character. The carry handles runs across blocks.
+inline static uint64_t
+find_escaped(uint64_t back, uint64_t *escaped) {
+    uint64_t	follows_escape;
+    uint64_t	odd_starts;
+    uint64_t	even_starts;
+
+    back &= ~*escaped;
+    follows_escape = back << 1 | *escaped;
+    odd_starts = back & ~EVEN_BITS & ~follows_escape;
+    *escaped = __builtin_uaddll_overflow(odd_starts, back, (unsigned long long*)&even_starts);
+
+    return (EVEN_BITS ^ (even_starts << 1)) & follows_escape;
+}
+
+inline static uint64_t
+prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+
+    return x;
+}
+
+// Loads the block at off, padding past the end of the part with spaces.
+inline static const char*
+load_block(Part p, size_t off, char *pad) {
+    if (off + 64 <= p->end) {
+	return p->json + off;
+    }
+    memset(pad, ' ', 64);
+    memcpy(pad, p->json + off, p->end - off);
+
+    return pad;
+}
+
+// First pass over a part, only the parity of the unescaped quotes is needed.
+static void
+count_quotes(Part p) {
+    struct _Block	b;
+    char		pad[64];
+    size_t		off;
+    int			cnt = 0;
+
+    for (off = p->start; off < p->end; off += 64) {
+	classify(load_block(p, off, pad), &b);
+	cnt += __builtin_popcountll(b.quote & ~find_escaped(b.back, &p->escaped));
+    }
+    p->odd_quotes = cnt & 1;
+}
+
+static void
+index_part(Part p) {
+    struct _Block	b;
+    char		pad[64];
+    size_t		off;
+
+    p->escaped = 0;
+    for (off = p->start; off < p->end; off += 64) {
+	uint64_t	quote;
+	uint64_t	in_str;
+	uint64_t	scalar;
+	uint64_t	bits;
+
+	classify(load_block(p, off, pad), &b);
+	quote = b.quote & ~find_escaped(b.back, &p->escaped);
+	in_str = prefix_xor(quote) ^ p->in_string;
+	p->in_string = (uint64_t)((int64_t)in_str >> 63);
+	if (0 != (b.slash & ~in_str)) {
+	    p->fail = 1; // comments are left to the byte by byte parser
+	    return;
+	}
+	scalar = ~(b.op | b.ws | b.quote | in_str);
+	bits = (b.op & ~in_str) | (quote & in_str) | (scalar & ~(scalar << 1 | p->scalar));
+	p->scalar = scalar >> 63;
+	// Room for up to 64 more positions and the sentinel.
+	if (p->size < p->cnt + 64 + 1) {
+	    uint32_t	*pos;
+
+	    p->size = (p->size < 1024) ? 1024 : p->size * 2;
+	    if (0 == (pos = (uint32_t*)realloc(p->pos, sizeof(uint32_t) * p->size))) {
+		p->fail = 1;
+		return;
+	    }
+	    p->pos = pos;
+	}
+	for (; 0 != bits; bits &= bits - 1) {
+	    p->pos[p->cnt++] = (uint32_t)(off + __builtin_ctzll(bits));
+	}
+    }
+}
+
+#if USE_PTHREAD_MUTEX
+static void*
+count_quotes_thread(void *x) {
+    count_quotes((Part)x);
+    return 0;
+}
+
+static void*
+index_part_thread(void *x) {
+    index_part((Part)x);
+    return 0;
+}
+
+// Runs func on all the parts, the first on the calling thread.
+static void
+run_parts(struct _Part *parts, int cnt, void* (*func)(void*)) {
+    pthread_t	threads[MAX_PARTS];
+    int		started[MAX_PARTS];
+    int		i;
+
+    for (i = 1; i < cnt; i++) {
+	started[i] = (0 == pthread_create(&threads[i], 0, func, parts + i));
+    }
+    func(parts);
+    for (i = 1; i < cnt; i++) {
+	if (started[i]) {
+	    pthread_join(threads[i], 0);
+	} else {
+	    func(parts + i);
+	}
+    }
+}
+#endif
+
+static int
+part_count(size_t len) {
+    int		cnt = 1;
+#if USE_PTHREAD_MUTEX
+    long	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (MAX_PARTS < cpus) {
+	cpus = MAX_PARTS;
+    }
+    while (cnt < cpus && (size_t)(cnt + 1) * SCAN_PART_MIN <= len) {
+	cnt++;
+    }
+#endif
+    return cnt;
+}
+
+/* Builds the index for len bytes of json. Returns 0 if there is no index
+ * because the JSON has comments, is too large for 32 bit offsets, or memory
+ * ran out. The parser then works byte by byte as usual.
+ */
+int
+oj_scan_index(const char *json, size_t len, ScanIndex si) {
+    struct _Part	parts[MAX_PARTS];
+    int			cnt = part_count(len);
+    int			i;
+    int			fail = 0;
+    size_t		total = 1;
+    uint32_t		*pos;
+
+    si->pos = 0;
+    si->sizes = 0;
+    si->cnt = 0;
+    if (UINT32_MAX <= len) {
+	return 0;
+    }
+    memset(parts, 0, sizeof(parts));
+    for (i = 0; i < cnt; i++) {
+	Part	p = parts + i;
+
+	p->json = json;
+	p->start = (0 == i) ? 0 : parts[i - 1].end;
+	p->end = (cnt - 1 == i) ? len : len / cnt * (i + 1);
+	// Never split right after a backslash so no part starts escaped.
+	while (p->end < len && p->start < p->end && '\\' == json[p->end - 1]) {
+	    p->end++;
+	}
+    }
+#if USE_PTHREAD_MUTEX
+    if (1 < cnt) {
+	run_parts(parts, cnt, count_quotes_thread);
+	for (i = 1; i < cnt; i++) {
+	    Part	p = parts + i;
+
+	    p->escaped = 0;
+	    p->in_string = (parts[i - 1].odd_quotes ^ (parts[i - 1].in_string & 1)) ? ~(uint64_t)0 : 0;
+	    if (0 == p->in_string && p->start < p->end) {
+		uint8_t	c = char_class[(uint8_t)json[p->start - 1]];
+
+		p->scalar = (0 == ((WS_CLS | OP_CLS | QUOTE_CLS) & c));
+	    }
+	}
+	run_parts(parts, cnt, index_part_thread);
+    } else {
+	index_part(parts);
+    }
+#else
+    index_part(parts);
+#endif
+    for (i = 0; i < cnt; i++) {
+	if (parts[i].fail) {
+	    fail = 1;
+	}
+	total += parts[i].cnt;
+    }
+    if (!fail && 1 == cnt && 0 != parts->pos) {
+	pos = parts->pos; // reuse, index_part leaves room for the sentinel
+    } else if (fail || 0 == (pos = (uint32_t*)malloc(sizeof(uint32_t) * total))) {
+	for (i = 0; i < cnt; i++) {
+	    free(parts[i].pos);
+	}
+	return 0;
+    } else {
+	uint32_t	*p = pos;
+
+	for (i = 0; i < cnt; i++) {
+	    if (0 < parts[i].cnt) {
+		memcpy(p, parts[i].pos, sizeof(uint32_t) * parts[i].cnt);
+		p += parts[i].cnt;
+	    }
+	    free(parts[i].pos);
+	}
+    }
+    pos[total - 1] = (uint32_t)len;
+    si->pos = pos;
+    si->cnt = total;
+
+    return 1;
+}
+
+/* Counts the members of every array and hash in an index built by
+ * oj_scan_index. An opener is followed directly by its closer when empty and
+ * otherwise holds one more member than the commas at its own depth. Returns
+ * 0 if memory ran out, in which case there are no sizes.
+ */
+int
+oj_scan_sizes(const char *json, ScanIndex si) {
+    uint32_t	*pos = si->pos;
+    uint32_t	*sizes;
+    uint32_t	*stack;
+    size_t	depth = 0;
+    size_t	max = 64;
+    size_t	i;
+
+    if (0 == pos || 0 == (sizes = (uint32_t*)malloc(sizeof(uint32_t) * si->cnt))) {
+	return 0;
+    }
+    if (0 == (stack = (uint32_t*)malloc(sizeof(uint32_t) * max))) {
+	free(sizes);
+	return 0;
+    }
+    // The last entry is the sentinel so there is always a next entry.
+    for (i = 0; i + 1 < si->cnt; i++) {
+	switch (json[pos[i]]) {
+	case '[':
+	case '{':
+	    switch (json[pos[i + 1]]) {
+	    case ']':
+	    case '}':
+		sizes[i] = 0;
+		break;
+	    default:
+		sizes[i] = 1;
+		break;
+	    }
+	    if (max <= depth) {
+		uint32_t	*s = (uint32_t*)realloc(stack, sizeof(uint32_t) * max * 2);
+
+		if (0 == s) {
+		    free(stack);
+		    free(sizes);
+		    return 0;
+		}
+		stack = s;
+		max *= 2;
+	    }
+	    stack[depth++] = (uint32_t)i;
+	    break;
+	case ',':
+	    if (0 < depth) {
+		sizes[stack[depth - 1]]++;
+	    }
+	    break;
+	case ']':
+	case '}':
+	    // Mismatched closers are left for the parser to report.
+	    if (0 < depth) {
+		depth--;
+	    }
+	    break;
+	default:
+	    break;
+	}
+    }
+    free(stack);
+    si->sizes = sizes;
+
+    return 1;
+}
+
+void
+oj_scan_index_free(ScanIndex si) {
+    free(si->pos);
+    free(si->sizes);
+    si->pos = 0;
+    si->sizes = 0;
+    si->cnt = 0;
+}
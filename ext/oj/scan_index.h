@@ -0,0 +1,59 @@
+/* scan_index.h
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __OJ_SCAN_INDEX_H__
+#define __OJ_SCAN_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Documents at least this long are indexed before parsing.
+#define SCAN_INDEX_MIN	0x00040000
+// Each extra thread used to build the index gets at least this much.
+#define SCAN_PART_MIN	0x00100000
+
+/* Offsets of every structural character, opening quote, and start of a
+ * number or literal outside of strings, in order, followed by the length of
+ * the document as a sentinel. If not NULL, sizes runs parallel to pos and
+ * holds the member count of each array or hash at the entry of its opening
+ * bracket. The counts are only hints for allocating containers.
+ */
+typedef struct _ScanIndex {
+    uint32_t	*pos;
+    uint32_t	*sizes;
+    size_t	cnt;
+} *ScanIndex;
+
+extern int	oj_scan_index(const char *json, size_t len, ScanIndex si);
+extern int	oj_scan_sizes(const char *json, ScanIndex si);
+extern void	oj_scan_index_free(ScanIndex si);
+
+#endif /* __OJ_SCAN_INDEX_H__ */
@@ -182,6 +182,51 @@ array_append_value(ParseInfo pi, VALUE value) {
     rb_funcall(pi->handler, oj_array_append_id, 2, stack_peek(&pi->stack)->val, value);
 }
 
+// Sets the callbacks that call the methods of an Oj::ScHandler.
+void
+oj_set_scp_callbacks(ParseInfo pi, VALUE handler) {
+    pi->handler = handler;
+    pi->start_hash = rb_respond_to(pi->handler, oj_hash_start_id) ? start_hash : noop_start;
+    pi->end_hash = rb_respond_to(pi->handler, oj_hash_end_id) ? end_hash : noop_end;
+    pi->hash_key = rb_respond_to(pi->handler, oj_hash_key_id) ? hash_key : noop_hash_key;
+    pi->start_array = rb_respond_to(pi->handler, oj_array_start_id) ? start_array : noop_start;
+    pi->end_array = rb_respond_to(pi->handler, oj_array_end_id) ? end_array : noop_end;
+    if (rb_respond_to(pi->handler, oj_hash_set_id)) {
+	pi->hash_set_value = hash_set_value;
+	pi->hash_set_cstr = hash_set_cstr;
+	pi->hash_set_num = hash_set_num;
+	pi->expect_value = 1;
+    } else {
+	pi->hash_set_value = noop_hash_set_value;
+	pi->hash_set_cstr = noop_hash_set_cstr;
+	pi->hash_set_num = noop_hash_set_num;
+	pi->expect_value = 0;
+    }
+    if (rb_respond_to(pi->handler, oj_array_append_id)) {
+	pi->array_append_value = array_append_value;
+	pi->array_append_cstr = array_append_cstr;
+	pi->array_append_num = array_append_num;
+	pi->expect_value = 1;
+    } else {
+	pi->array_append_value = noop_array_append_value;
+	pi->array_append_cstr = noop_array_append_cstr;
+	pi->array_append_num = noop_array_append_num;
+	pi->expect_value = 0;
+    }
+    pi->array_append_values = 0;
+    if (rb_respond_to(pi->handler, oj_add_value_id)) {
+	pi->add_cstr = add_cstr;
+	pi->add_num = add_num;
+	pi->add_value = add_value;
+	pi->expect_value = 1;
+    } else {
+	pi->add_cstr = noop_add_cstr;
+	pi->add_num = noop_add_num;
+	pi->add_value = noop_add_value;
+	pi->expect_value = 0;
+    }
+}
+
 VALUE
 oj_sc_parse(int argc, VALUE *argv, VALUE self) {
     struct _ParseInfo	pi;
@@ -197,46 +242,7 @@ oj_sc_parse(int argc, VALUE *argv, VALUE self) {
     } else {
 	pi.proc = Qundef;
     }
-    pi.handler = *argv;
-
-    pi.start_hash = rb_respond_to(pi.handler, oj_hash_start_id) ? start_hash : noop_start;
-    pi.end_hash = rb_respond_to(pi.handler, oj_hash_end_id) ? end_hash : noop_end;
-    pi.hash_key = rb_respond_to(pi.handler, oj_hash_key_id) ? hash_key : noop_hash_key;
-    pi.start_array = rb_respond_to(pi.handler, oj_array_start_id) ? start_array : noop_start;
-    pi.end_array = rb_respond_to(pi.handler, oj_array_end_id) ? end_array : noop_end;
-    if (rb_respond_to(pi.handler, oj_hash_set_id)) {
-	pi.hash_set_value = hash_set_value;
-	pi.hash_set_cstr = hash_set_cstr;
-	pi.hash_set_num = hash_set_num;
-	pi.expect_value = 1;
-    } else {
-	pi.hash_set_value = noop_hash_set_value;
-	pi.hash_set_cstr = noop_hash_set_cstr;
-	pi.hash_set_num = noop_hash_set_num;
-	pi.expect_value = 0;
-    }
-    if (rb_respond_to(pi.handler, oj_array_append_id)) {
-	pi.array_append_value = array_append_value;
-	pi.array_append_cstr = array_append_cstr;
-	pi.array_append_num = array_append_num;
-	pi.expect_value = 1;
-    } else {
-	pi.array_append_value = noop_array_append_value;
-	pi.array_append_cstr = noop_array_append_cstr;
-	pi.array_append_num = noop_array_append_num;
-	pi.expect_value = 0;
-    }
-    if (rb_respond_to(pi.handler, oj_add_value_id)) {
-	pi.add_cstr = add_cstr;
-	pi.add_num = add_num;
-	pi.add_value = add_value;
-	pi.expect_value = 1;
-    } else {
-	pi.add_cstr = noop_add_cstr;
-	pi.add_num = noop_add_num;
-	pi.add_value = noop_add_value;
-	pi.expect_value = 0;
-    }
+    oj_set_scp_callbacks(&pi, *argv);
 
     if (T_STRING == rb_type(input)) {
 	return oj_pi_parse(argc - 1, argv + 1, &pi, 0, 0, 1);
@@ -38,6 +38,8 @@
 #include "parse.h"
 #include "buf.h"
 #include "hash.h" // for oj_strndup()
+#include "mapped.h"
+#include "scan.h"
 #include "val_stack.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
@@ -315,6 +317,7 @@ read_escaped_str(ParseInfo pi) {
 		parent->key = "";
 		parent->klen = 0;
 	    }
+	    only_key(parent, buf.head, buf_len(&buf));
 	    parent->k1 = *pi->rd.str;
 	    parent->next = NEXT_HASH_COLON;
 	    break;
@@ -339,12 +342,29 @@ read_escaped_str(ParseInfo pi) {
     buf_cleanup(&buf);
 }
 
+// Moves past the buffered string characters that are not a quote, backslash,
+// or NULL while keeping the line and column the same as reader_get() would.
+static void
+skip_str_chars(Reader rd) {
+    const char	*t = rd->tail;
+    const char	*s = oj_scan_str(t, rd->read_end);
+    const char	*nl;
+
+    for (; 0 != (nl = memchr(t, '\n', s - t)); t = nl + 1) {
+	rd->line++;
+	rd->col = 0;
+    }
+    rd->col += (int)(s - t);
+    rd->tail = (char*)s;
+}
+
 static void
 read_str(ParseInfo pi) {
     Val		parent = stack_peek(&pi->stack);
     char	c;
 
     reader_protect(&pi->rd);
+    skip_str_chars(&pi->rd);
     while ('\"' != (c = reader_get(&pi->rd))) {
 	if ('\0' == c) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
@@ -355,6 +375,7 @@ read_str(ParseInfo pi) {
 	    reader_release(&pi->rd);
 	    return;
 	}
+	skip_str_chars(&pi->rd);
     }
     if (0 == parent) { // simple add
 	pi->add_cstr(pi, pi->rd.str, pi->rd.tail - pi->rd.str - 1, pi->rd.str);
@@ -378,6 +399,7 @@ read_str(ParseInfo pi) {
 		parent->kalloc = 0;
 	    }
 	    parent->key_val = pi->hash_key(pi, parent->key, parent->klen);
+	    only_key(parent, parent->key, parent->klen);
 	    parent->k1 = *pi->rd.str;
 	    parent->next = NEXT_HASH_COLON;
 	    break;
@@ -402,52 +424,60 @@ read_str(ParseInfo pi) {
     reader_release(&pi->rd);
 }
 
-static void
-read_num(ParseInfo pi) {
-    struct _NumInfo	ni;
-    char		c;
+// Reads a number into ni. The reader is left protected so ni->str stays valid
+// until reader_release() is called. Returns false, with the error set, if it
+// is not a number.
+static bool
+scan_num(ParseInfo pi, NumInfo ni) {
+    char	c;
 
     reader_protect(&pi->rd);
-    ni.i = 0;
-    ni.num = 0;
-    ni.div = 1;
-    ni.di = 0;
-    ni.len = 0;
-    ni.exp = 0;
-    ni.big = 0;
-    ni.infinity = 0;
-    ni.nan = 0;
-    ni.neg = 0;
-    ni.hasExp = 0;
-    ni.no_big = (FloatDec == pi->options.bigdec_load);
+    ni->i = 0;
+    ni->num = 0;
+    ni->div = 1;
+    ni->di = 0;
+    ni->len = 0;
+    ni->exp = 0;
+    ni->big = 0;
+    ni->infinity = 0;
+    ni->nan = 0;
+    ni->neg = 0;
+    ni->hasExp = 0;
+    ni->no_big = (FloatDec == pi->options.bigdec_load);
     c = reader_get(&pi->rd);
     if ('-' == c) {
 	c = reader_get(&pi->rd);
-	ni.neg = 1;
+	ni->neg = 1;
     } else if ('+' == c) {
 	c = reader_get(&pi->rd);
     }
     if ('I' == c) {
 	if (0 != reader_expect(&pi->rd, "nfinity")) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
-	    return;
+	    return false;
+	}
+	ni->infinity = 1;
+    } else if ('N' == c || 'n' == c) {
+	if ('a' != reader_get(&pi->rd) || ('N' != (c = reader_get(&pi->rd)) && 'n' != c)) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+	    return false;
 	}
-	ni.infinity = 1;
+	ni->nan = 1;
     } else {
 	int	dec_cnt = 0;
 
 	for (; '0' <= c && c <= '9'; c = reader_get(&pi->rd)) {
-	    if (0 < ni.i) {
+	    if (0 < ni->i) {
 		dec_cnt++;
 	    }
-	    if (ni.big) {
-		ni.big++;
+	    if (ni->big) {
+		ni->big++;
 	    } else {
 		int	d = (c - '0');
 
-		ni.i = ni.i * 10 + d;
-		if (INT64_MAX <= ni.i || DEC_MAX < dec_cnt) {
-		    ni.big = 1;
+		ni->i = ni->i * 10 + d;
+		if (INT64_MAX <= ni->i || DEC_MAX < dec_cnt) {
+		    ni->big = 1;
 		}
 	    }
 	}
@@ -456,21 +486,21 @@ read_num(ParseInfo pi) {
 	    for (; '0' <= c && c <= '9'; c = reader_get(&pi->rd)) {
 		int	d = (c - '0');
 
-		if (0 < ni.num || 0 < ni.i) {
+		if (0 < ni->num || 0 < ni->i) {
 		    dec_cnt++;
 		}
-		ni.num = ni.num * 10 + d;
-		ni.div *= 10;
-		ni.di++;
-		if (INT64_MAX <= ni.div || DEC_MAX < dec_cnt) {
-		    ni.big = 1;
+		ni->num = ni->num * 10 + d;
+		ni->div *= 10;
+		ni->di++;
+		if (INT64_MAX <= ni->div || DEC_MAX < dec_cnt) {
+		    ni->big = 1;
 		}
 	    }
 	}
 	if ('e' == c || 'E' == c) {
 	    int	eneg = 0;
 
-	    ni.hasExp = 1;
+	    ni->hasExp = 1;
 	    c = reader_get(&pi->rd);
 	    if ('-' == c) {
 		c = reader_get(&pi->rd);
@@ -479,40 +509,101 @@ read_num(ParseInfo pi) {
 		c = reader_get(&pi->rd);
 	    }
 	    for (; '0' <= c && c <= '9'; c = reader_get(&pi->rd)) {
-		ni.exp = ni.exp * 10 + (c - '0');
-		if (EXP_MAX <= ni.exp) {
-		    ni.big = 1;
+		ni->exp = ni->exp * 10 + (c - '0');
+		if (EXP_MAX <= ni->exp) {
+		    ni->big = 1;
 		}
 	    }
 	    if (eneg) {
-		ni.exp = -ni.exp;
+		ni->exp = -ni->exp;
 	    }
 	}
-	ni.len = pi->rd.tail - pi->rd.str;
+	ni->len = pi->rd.tail - pi->rd.str;
 	if (0 != c) {
 	    reader_backup(&pi->rd);
 	}
     }
-    ni.str = pi->rd.str;
-    ni.len = pi->rd.tail - pi->rd.str;
+    ni->str = pi->rd.str;
+    ni->len = pi->rd.tail - pi->rd.str;
     // Check for special reserved values for Infinity and NaN.
-    if (ni.big) {
-	if (0 == strcasecmp(INF_VAL, ni.str)) {
-	    ni.infinity = 1;
-	} else if (0 == strcasecmp(NINF_VAL, ni.str)) {
-	    ni.infinity = 1;
-	    ni.neg = 1;
-	} else if (0 == strcasecmp(NAN_VAL, ni.str)) {
-	    ni.nan = 1;
+    if (ni->big) {
+	if (0 == strcasecmp(INF_VAL, ni->str)) {
+	    ni->infinity = 1;
+	} else if (0 == strcasecmp(NINF_VAL, ni->str)) {
+	    ni->infinity = 1;
+	    ni->neg = 1;
+	} else if (0 == strcasecmp(NAN_VAL, ni->str)) {
+	    ni->nan = 1;
 	}
     }
     if (BigDec == pi->options.bigdec_load) {
-	ni.big = 1;
+	ni->big = 1;
+    }
+    return true;
+}
+
+static void
+read_num(ParseInfo pi) {
+    struct _NumInfo	ni;
+
+    if (!scan_num(pi, &ni)) {
+	return;
     }
     add_num_value(pi, &ni);
     reader_release(&pi->rd);
 }
 
+// Reads an array on a :packed path into a binary String of native doubles in
+// place of an Array. Only numbers are allowed in the array, including
+// Infinity and NaN if the mode allows them.
+static void
+read_packed(ParseInfo pi) {
+    struct _Buf		buf;
+    struct _NumInfo	ni;
+    double		d;
+    volatile VALUE	rstr;
+    char		c;
+
+    buf_init(&buf);
+    c = reader_next_non_white(&pi->rd);
+    if (']' != c) {
+	while (1) {
+	    if ('\0' == c || 0 == strchr("+-0123456789INn", c)) {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected a number in a packed array");
+		break;
+	    }
+	    reader_backup(&pi->rd);
+	    if (!scan_num(pi, &ni)) {
+		break;
+	    }
+	    // Rejected where the strict array_append_num callback would.
+	    if ((ni.infinity || ni.nan) && oj_strict_array_nums(pi)) {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+		break;
+	    }
+	    d = oj_num_as_double(&ni);
+	    reader_release(&pi->rd);
+	    buf_append_string(&buf, (const char*)&d, sizeof(d));
+	    c = reader_next_non_white(&pi->rd);
+	    if (']' == c) {
+		break;
+	    }
+	    if (',' != c) {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected a comma or array close");
+		break;
+	    }
+	    c = reader_next_non_white(&pi->rd);
+	}
+    }
+    if (err_has(&pi->err)) {
+	buf_cleanup(&buf);
+	return;
+    }
+    rstr = rb_str_new(buf.head, buf_len(&buf));
+    buf_cleanup(&buf);
+    add_value(pi, rstr);
+}
+
 static void
 read_nan(ParseInfo pi) {
     struct _NumInfo	ni;
@@ -542,11 +633,141 @@ read_nan(ParseInfo pi) {
     add_num_value(pi, &ni);
 }
 
+// Reads past a value that is not wanted, either because the hash_key callback
+// asked to skip it or it is not on an :only path. Only string and container
+// boundaries are tracked so nothing is created for the value and it is not
+// otherwise checked.
+static void
+skip_value(ParseInfo pi) {
+    int		depth = 0;
+    int		empty = 1;
+    char	c;
+
+    while (1) {
+	switch (c = reader_get(&pi->rd)) {
+	case ' ':
+	case '\t':
+	case '\f':
+	case '\n':
+	case '\r':
+	    continue;
+	case '"':
+	    while ('"' != (c = reader_get(&pi->rd))) {
+		if ('\\' == c) {
+		    c = reader_get(&pi->rd);
+		}
+		if ('\0' == c) {
+		    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
+		    return;
+		}
+	    }
+	    break;
+	case '{':
+	case '[':
+	    depth++;
+	    break;
+	case '}':
+	case ']':
+	case ',':
+	    if (0 == depth) {
+		reader_backup(&pi->rd);
+		goto DONE;
+	    }
+	    if (',' != c) {
+		depth--;
+	    }
+	    break;
+	case '/':
+	    skip_comment(pi);
+	    if (err_has(&pi->err)) {
+		return;
+	    }
+	    continue;
+	case '\0':
+	    if (0 == depth) {
+		goto DONE;
+	    }
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+	    return;
+	default:
+	    break;
+	}
+	empty = 0;
+    }
+ DONE:
+    if (empty) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected a value");
+    }
+}
+
+// Skips the next value if no :only path goes through it. Only hashes and
+// arrays are kept on the way to the end of a path.
+static int
+only_skip(ParseInfo pi, OnlyNode kid) {
+    if (0 != kid) {
+	char	c;
+
+	if (kid->all) {
+	    return 0;
+	}
+	c = reader_next_non_white(&pi->rd);
+	reader_backup(&pi->rd);
+	if ('{' == c || '[' == c) {
+	    return 0;
+	}
+    }
+    skip_value(pi);
+
+    return 1;
+}
+
+// Skips array elements not on an :only path up to the next one to keep or
+// the array close.
+static void
+only_elements(ParseInfo pi, Val array) {
+    char	c;
+
+    while (1) {
+	c = reader_next_non_white(&pi->rd);
+	reader_backup(&pi->rd);
+	if (']' == c || !only_skip(pi, array->kid) || err_has(&pi->err)) {
+	    break;
+	}
+	if (',' != reader_get(&pi->rd)) {
+	    reader_backup(&pi->rd);
+	    array->next = NEXT_ARRAY_COMMA;
+	    break;
+	}
+	array->next = NEXT_ARRAY_ELEMENT;
+    }
+}
+
 static void
 array_start(ParseInfo pi) {
-    VALUE	v = pi->start_array(pi);
+    VALUE	v;
+
+    // The stream parser can not look ahead to count members.
+    pi->col_size = 0;
+    v = pi->start_array(pi);
 
     stack_push(&pi->stack, v, NEXT_ARRAY_NEW);
+    if (0 != pi->packed) {
+	Val	array = stack_peek(&pi->stack);
+
+	packed_start(pi);
+	if (0 != array->pack) {
+	    array->pkid = oj_only_wild(array->pack);
+	}
+    }
+    if (0 != pi->only) {
+	Val	array = stack_peek(&pi->stack);
+
+	only_start(pi);
+	if (0 != array->only) {
+	    array->kid = oj_only_wild(array->only);
+	    only_elements(pi, array);
+	}
+    }
 }
 
 static void
@@ -565,9 +786,18 @@ array_end(ParseInfo pi) {
 
 static void
 hash_start(ParseInfo pi) {
-    volatile VALUE	v = pi->start_hash(pi);
+    volatile VALUE	v;
+
+    pi->col_size = 0;
+    v = pi->start_hash(pi);
 
     stack_push(&pi->stack, v, NEXT_HASH_NEW);
+    if (0 != pi->packed) {
+	packed_start(pi);
+    }
+    if (0 != pi->only) {
+	only_start(pi);
+    }
 }
 
 static void
@@ -594,6 +824,9 @@ comma(ParseInfo pi) {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected comma");
     } else if (NEXT_ARRAY_COMMA == parent->next) {
 	parent->next = NEXT_ARRAY_ELEMENT;
+	if (0 != parent->only) {
+	    only_elements(pi, parent);
+	}
     } else if (NEXT_HASH_COMMA == parent->next) {
 	parent->next = NEXT_HASH_KEY;
     } else {
@@ -606,14 +839,32 @@ colon(ParseInfo pi) {
     Val	parent = stack_peek(&pi->stack);
 
     if (0 != parent && NEXT_HASH_COLON == parent->next) {
-	parent->next = NEXT_HASH_VALUE;
+	int	skip = (oj_skip_key == parent->key_val);
+
+	if (skip) {
+	    skip_value(pi);
+	} else if (0 != parent->only) {
+	    skip = only_skip(pi, parent->kid);
+	}
+	if (skip) {
+	    if (parent->kalloc) {
+		xfree((char*)parent->key);
+	    }
+	    parent->key = 0;
+	    parent->kalloc = 0;
+	    parent->next = NEXT_HASH_COMMA;
+	} else {
+	    parent->next = NEXT_HASH_VALUE;
+	}
     } else {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected colon");
     }
 }
 
-void
-oj_sparse2(ParseInfo pi) {
+// Parses the documents from the reader. With once set it returns as soon as
+// one document is complete, leaving the reader just after it.
+static void
+sparse_docs(ParseInfo pi, int once) {
     int		first = 1;
     char	c;
 
@@ -622,6 +873,7 @@ oj_sparse2(ParseInfo pi) {
 	c = reader_next_non_white(&pi->rd);
 	if (!first && '\0' != c) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected characters after the JSON document");
+	    return;
 	}
 	switch (c) {
 	case '{':
@@ -634,7 +886,11 @@ oj_sparse2(ParseInfo pi) {
 	    colon(pi);
 	    break;
 	case '[':
-	    array_start(pi);
+	    if (0 != pi->packed && packed_next(pi)) {
+		read_packed(pi);
+	    } else {
+		array_start(pi);
+	    }
 	    break;
 	case ']':
 	    array_end(pi);
@@ -718,6 +974,9 @@ oj_sparse2(ParseInfo pi) {
 	    return;
 	}
 	if (stack_empty(&pi->stack)) {
+	    if (once) {
+		return;
+	    }
 	    if (Qundef != pi->proc) {
 		if (Qnil == pi->proc) {
 		    rb_yield(stack_head_val(&pi->stack));
@@ -740,6 +999,11 @@ oj_sparse2(ParseInfo pi) {
     }
 }
 
+void
+oj_sparse2(ParseInfo pi) {
+    sparse_docs(pi, 0);
+}
+
 static VALUE
 protect_parse(VALUE pip) {
     oj_sparse2((ParseInfo)pip);
@@ -747,10 +1011,45 @@ protect_parse(VALUE pip) {
     return Qnil;
 }
 
+static VALUE
+protect_next(VALUE pip) {
+    sparse_docs((ParseInfo)pip, 1);
+
+    return Qnil;
+}
+
+// If the stack is not empty then the JSON terminated early.
+static void
+check_terminated(ParseInfo pi) {
+    Val	v;
+
+    if (err_has(&pi->err) || 0 == (v = stack_peek(&pi->stack))) {
+	return;
+    }
+    switch (v->next) {
+    case NEXT_ARRAY_NEW:
+    case NEXT_ARRAY_ELEMENT:
+    case NEXT_ARRAY_COMMA:
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
+	break;
+    case NEXT_HASH_NEW:
+    case NEXT_HASH_KEY:
+    case NEXT_HASH_COLON:
+    case NEXT_HASH_VALUE:
+    case NEXT_HASH_COMMA:
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
+	break;
+    default:
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+    }
+}
+
 VALUE
 oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     volatile VALUE	input;
     volatile VALUE	wrapped_stack;
+    volatile VALUE	wrapped_keys;
+    volatile VALUE	wrapped_only;
     VALUE		result = Qnil;
     int			line = 0;
 
@@ -769,6 +1068,16 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     } else {
 	pi->proc = Qundef;
     }
+    if (0 != fd) {
+	char	*json;
+	size_t	len;
+
+	// A mapped file is parsed in place by the string parser.
+	if (0 != (json = oj_map_file(fd, &len, pi->options.mem_map))) {
+	    close(fd);
+	    return oj_pi_parse_mapped(pi, json, len);
+	}
+    }
     oj_reader_init(&pi->rd, input, fd);
     pi->json = 0; // indicates reader is in use
 
@@ -784,6 +1093,8 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     // freed. We protect against this by wrapping the value stack in a ruby
     // data object and poviding a mark function for ruby objects on the
     // value stack (while it is in scope).
+    wrapped_keys = oj_key_cache_start(pi);
+    wrapped_only = oj_only_start(pi);
     wrapped_stack = oj_stack_init(&pi->stack);
     rb_protect(protect_parse, (VALUE)pi, &line);
     result = stack_head_val(&pi->stack);
@@ -791,34 +1102,15 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     if (No == pi->options.allow_gc) {
 	rb_gc_enable();
     }
-    if (!err_has(&pi->err)) {
-	// If the stack is not empty then the JSON terminated early.
-	Val	v;
-
-	if (0 != (v = stack_peek(&pi->stack))) {
-	    switch (v->next) {
-	    case NEXT_ARRAY_NEW:
-	    case NEXT_ARRAY_ELEMENT:
-	    case NEXT_ARRAY_COMMA:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
-		break;
-	    case NEXT_HASH_NEW:
-	    case NEXT_HASH_KEY:
-	    case NEXT_HASH_COLON:
-	    case NEXT_HASH_VALUE:
-	    case NEXT_HASH_COMMA:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
-		break;
-	    default:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
-	    }
-	}
-    }
+    check_terminated(pi);
     // proceed with cleanup
     if (0 != pi->circ_array) {
 	oj_circ_array_free(pi->circ_array);
     }
     stack_cleanup(&pi->stack);
+    reader_cleanup(&pi->rd);
+    oj_key_cache_stop(pi, wrapped_keys);
+    oj_only_stop(pi, wrapped_only);
     if (0 != fd) {
 	close(fd);
     }
@@ -833,3 +1125,48 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     }
     return result;
 }
+
+// Reads the next document from a reader kept by an Oj::Parser and set up
+// with oj_reader_init(). The reader is left just after the document so the
+// next call continues from there and keeps any buffer it has grown. Returns
+// Qundef if there are no more documents.
+VALUE
+oj_pi_sparse_next(ParseInfo pi) {
+    volatile VALUE	result;
+    int			line = 0;
+
+    pi->json = 0; // indicates reader is in use
+    pi->proc = Qundef;
+    pi->stack.head->val = Qundef;
+    pi->stack.head->next = NEXT_NONE;
+    if (Yes == pi->options.circular) {
+	pi->circ_array = oj_circ_array_new();
+    } else {
+	pi->circ_array = 0;
+    }
+    if (No == pi->options.allow_gc) {
+	rb_gc_disable();
+    }
+    rb_protect(protect_next, (VALUE)pi, &line);
+    result = pi->stack.head->val; // Qundef if nothing was read
+    if (No == pi->options.allow_gc) {
+	rb_gc_enable();
+    }
+    check_terminated(pi);
+    if (0 != pi->circ_array) {
+	oj_circ_array_free(pi->circ_array);
+	pi->circ_array = 0;
+    }
+    pi->stack.tail = pi->stack.head;
+    pi->stack.head->val = Qundef;
+    if (0 != line) {
+	rb_jump_tag(line);
+    }
+    if (err_has(&pi->err)) {
+	if (Qnil != pi->err_class) {
+	    pi->err.clas = pi->err_class;
+	}
+	oj_err_raise(&pi->err);
+    }
+    return result;
+}
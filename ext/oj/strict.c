@@ -73,6 +73,11 @@ start_hash(ParseInfo pi) {
     if (Qnil != pi->options.hash_class) {
 	return rb_class_new_instance(0, NULL, pi->options.hash_class);
     }
+#if HAVE_RB_HASH_NEW_CAPA
+    if (0 < pi->col_size) {
+	return rb_hash_new_capa((long)pi->col_size);
+    }
+#endif
     return rb_hash_new();
 }
 
@@ -81,7 +86,7 @@ calc_hash_key(ParseInfo pi, Val parent) {
     volatile VALUE	rkey = parent->key_val;
 
     if (Qundef == rkey) {
-	rkey = rb_str_new(parent->key, parent->klen);
+	return oj_calc_hash_key(pi, parent->key, parent->klen);
     }
     rkey = oj_encode(rkey);
     if (Yes == pi->options.sym_key) {
@@ -113,6 +118,9 @@ hash_set_value(ParseInfo pi, Val parent, VALUE value) {
 
 static VALUE
 start_array(ParseInfo pi) {
+    if (0 < pi->col_size) {
+	return rb_ary_new2((long)pi->col_size);
+    }
     return rb_ary_new();
 }
 
@@ -137,6 +145,18 @@ array_append_value(ParseInfo pi, VALUE value) {
     rb_ary_push(stack_peek(&pi->stack)->val, value);
 }
 
+static void
+array_append_values(ParseInfo pi, const VALUE *vals, long cnt) {
+    rb_ary_cat(stack_peek(&pi->stack)->val, vals, cnt);
+}
+
+// Returns true if numbers in arrays are added by the strict callbacks, which
+// reject Infinity and NaN.
+bool
+oj_strict_array_nums(ParseInfo pi) {
+    return (array_append_num == pi->array_append_num);
+}
+
 void
 oj_set_strict_callbacks(ParseInfo pi) {
     pi->start_hash = start_hash;
@@ -150,6 +170,7 @@ oj_set_strict_callbacks(ParseInfo pi) {
     pi->array_append_cstr = array_append_cstr;
     pi->array_append_num = array_append_num;
     pi->array_append_value = array_append_value;
+    pi->array_append_values = array_append_values;
     pi->add_cstr = add_cstr;
     pi->add_num = add_num;
     pi->add_value = add_value;
@@ -31,8 +31,8 @@
 #include "oj.h"
 #include "val_stack.h"
 
-static void
-mark(void *ptr) {
+void
+oj_stack_mark(void *ptr) {
     ValStack	stack = (ValStack)ptr;
     Val		v;
 
@@ -60,8 +60,10 @@ mark(void *ptr) {
 #endif
 }
 
-VALUE
-oj_stack_init(ValStack stack) {
+// Sets up an empty stack. Used directly when the stack is part of a longer
+// lived object that marks it with oj_stack_mark().
+void
+oj_stack_setup(ValStack stack) {
 #if USE_PTHREAD_MUTEX
     pthread_mutex_init(&stack->mutex, 0);
 #elif USE_RB_MUTEX
@@ -77,7 +79,13 @@ oj_stack_init(ValStack stack) {
     stack->head->klen = 0;
     stack->head->clen = 0;
     stack->head->next = NEXT_NONE;
-    return Data_Wrap_Struct(oj_cstack_class, mark, 0, stack);
+}
+
+VALUE
+oj_stack_init(ValStack stack) {
+    oj_stack_setup(stack);
+
+    return Data_Wrap_Struct(oj_cstack_class, oj_stack_mark, 0, stack);
 }
 
 const char*
@@ -52,6 +52,8 @@ typedef enum {
     NEXT_HASH_COMMA	= 'n',
 } ValNext;
 
+struct _OnlyNode;
+
 typedef struct _Val {
     volatile VALUE	val;
     const char		*key;
@@ -61,6 +63,10 @@ typedef struct _Val {
 	const char	*classname;
 	OddArgs		odd_args;
     };
+    struct _OnlyNode	*only;	// :only paths for members or 0 to keep all
+    struct _OnlyNode	*kid;	// :only paths for the current member
+    struct _OnlyNode	*pack;	// :packed paths for members or 0 if none
+    struct _OnlyNode	*pkid;	// :packed paths for the current member
     uint16_t		klen;
     uint16_t		clen;
     char		next; // ValNext
@@ -82,6 +88,8 @@ typedef struct _ValStack {
 } *ValStack;
 
 extern VALUE	oj_stack_init(ValStack stack);
+extern void	oj_stack_setup(ValStack stack);
+extern void	oj_stack_mark(void *ptr);
 
 inline static int
 stack_empty(ValStack stack) {
@@ -130,6 +138,10 @@ stack_push(ValStack stack, VALUE val, ValNext next) {
     stack->tail->classname = 0;
     stack->tail->key = 0;
     stack->tail->key_val = Qundef;
+    stack->tail->only = 0;
+    stack->tail->kid = 0;
+    stack->tail->pack = 0;
+    stack->tail->pkid = 0;
     stack->tail->clen = 0;
     stack->tail->klen = 0;
     stack->tail->kalloc = 0;
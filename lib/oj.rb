@@ -37,6 +37,7 @@ require 'oj/bag'
 require 'oj/easy_hash'
 require 'oj/error'
 require 'oj/mimic'
+require 'oj/ndjson'
 require 'oj/saj'
 require 'oj/schandler'
 
@@ -0,0 +1,113 @@
+require 'etc'
+
+module Oj
+
+  # Approximate size in bytes of the parts parsed by each Ractor in
+  # Oj.load_ndjson_parallel().
+  NDJSON_PART_SIZE = 0x01000000
+
+  # Loads newline delimited JSON from a String or File in parallel. The input
+  # is split at line boundaries by Oj.ndjson_parts() and the parts are parsed
+  # with Oj.load_ndjson() by up to :ractors Ractors at a time. Results are
+  # delivered in input order. The documents and skipped line errors of each
+  # part are yielded together or, without a block, all the documents are
+  # returned in one Array. Without Ractor support the parts are parsed in the
+  # calling thread.
+  #
+  # @param [String|File] input newline delimited JSON
+  # @param [Hash] options Oj.load_ndjson() options and
+  #   - :ractors [Fixnum] number of parts parsed at once, default Etc.nprocessors
+  #   - :part_size [Fixnum] approximate size of each part, default NDJSON_PART_SIZE
+  def self.load_ndjson_parallel(input, options={})
+    opts = options.dup
+    ractors = opts.delete(:ractors) || Etc.nprocessors
+    part_size = opts.delete(:part_size) || NDJSON_PART_SIZE
+    opts.delete(:first_line)
+    if input.is_a?(File)
+      path = input.path
+      src = nil
+    else
+      path = nil
+      src = input.frozen? ? input : input.dup.freeze
+    end
+    all = block_given? ? nil : []
+    deliver = lambda { |result|
+      docs, errors = result
+      if all.nil?
+        yield(docs, errors)
+      else
+        all.concat(docs)
+      end
+    }
+    parts = ndjson_parts(input, part_size)
+    if !defined?(Ractor) || 1 >= ractors || 1 >= parts.size
+      parts.each { |off, len, line| deliver.call(ndjson_part(src, path, off, len, line, opts)) }
+    else
+      src = Ractor.make_shareable(src)
+      opts = Ractor.make_shareable(ndjson_copy(opts))
+      pending = []
+      begin
+        parts.each { |off, len, line|
+          # Results are copied back. Moving them is cheaper but not reliable
+          # with all Ruby versions.
+          pending << Ractor.new(src, path, off, len, line, opts) { |*args|
+            Thread.current.report_on_exception = false
+            Oj.ndjson_part(*args)
+          }
+          deliver.call(take_part(pending.shift)) if ractors <= pending.size
+        }
+        deliver.call(take_part(pending.shift)) until pending.empty?
+      ensure
+        # A Ractor can not be killed so when a part fails or the block
+        # raises the parts already started are waited for and dropped.
+        pending.each { |r| r.take rescue nil }
+      end
+    end
+    all
+  end
+
+  # Parses one part for load_ndjson_parallel() and returns the documents and
+  # errors.
+  def self.ndjson_part(src, path, off, len, line, opts)
+    if path.nil?
+      json = src.byteslice(off, len)
+    else
+      json = File.open(path, 'rb') { |f|
+        f.seek(off)
+        f.read(len) || ''
+      }
+    end
+    docs = []
+    errors = []
+    load_ndjson(json, opts.merge(:first_line => line, :batch => 10000)) { |d, e|
+      docs.concat(d)
+      errors.concat(e)
+    }
+    [docs, errors]
+  end
+
+  # Returns a copy of value with the Arrays, Hashes, and Strings in it
+  # duplicated so making the copy shareable does not freeze the caller's
+  # options.
+  def self.ndjson_copy(value)
+    case value
+    when Array
+      value.map { |v| ndjson_copy(v) }
+    when Hash
+      value.each_with_object({}) { |(k, v), h| h[ndjson_copy(k)] = ndjson_copy(v) }
+    when String
+      value.dup
+    else
+      value
+    end
+  end
+  private_class_method :ndjson_copy
+
+  def self.take_part(r)
+    r.take
+  rescue Ractor::RemoteError => e
+    raise e.cause, cause: nil
+  end
+  private_class_method :take_part
+
+end # Oj
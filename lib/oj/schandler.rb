@@ -67,6 +67,8 @@ module Oj
   # When a hash key is encountered the hash_key method is called with the parsed
   # hash value key. The return value from the call is then used as the key in
   # the key-value pair that follows.
+  # If Oj::ScHandler::SKIP is returned the value of the key is skipped and no
+  # callbacks are made for it or any elements it contains.
   #
   #    hash_key
   #
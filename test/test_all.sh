@@ -22,6 +22,12 @@ echo "----- File loading tests (test_file.rb) -----"
 ruby test_file.rb
 echo "----- Hash loading tests (test_hash.rb) -----"
 ruby test_hash.rb
+echo "----- Float parsing tests (test_float.rb) -----"
+ruby test_float.rb
+echo "----- NDJSON loading tests (test_ndjson.rb) -----"
+ruby test_ndjson.rb
+echo "----- Reusable parser tests (test_parser.rb) -----"
+ruby test_parser.rb
 # only run if <= 1.9.3
 echo "----- Mimic tests (isolated/test_mimic_after.rb) -----"
 ruby isolated/test_mimic_after.rb
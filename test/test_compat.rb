@@ -387,6 +387,17 @@ class CompatJuice < Minitest::Test
     assert_equal(expected, obj)
   end
 
+  # Packed arrays allow Infinity and NaN as compat mode numbers do.
+  def test_packed_special
+    json = '{"a":[1,Infinity,-Infinity,NaN]}'
+    [json, StringIO.new(json)].each { |input|
+      a = Oj.compat_load(input, :packed => ['/a'])['a'].unpack('d*')
+      assert_equal([1.0, Float::INFINITY, -Float::INFINITY], a[0, 3])
+      assert(a[3].nan?)
+    }
+    assert_raises(Oj::ParseError) { Oj.compat_load('[1,Inf]', :packed => ['']) }
+  end
+
   def dump_and_load(obj, trace=false)
     json = Oj.dump(obj, :indent => 2, :mode => :compat)
     puts json if trace
@@ -359,6 +359,23 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_open_file_mmap
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    json = '{"a":[1,2,"th\\u00e9 \\"three\\""]}'
+    File.open(filename, 'w') { |f| f.write(json) }
+    [true, false].each { |m|
+      Oj::Doc.open_file(filename, :mmap => m) do |doc|
+        assert_equal(5, doc.size)
+        assert_equal("th\u00e9 \"three\"", doc.fetch('/a/3'))
+      end
+      doc = Oj::Doc.open_file(filename, :mmap => m)
+      assert_equal(2, doc.fetch('/a/2'))
+      doc.close()
+    }
+    # parsing in place must not change the file
+    assert_equal(json, File.read(filename))
+  end
+
   def test_open_close
     json = %{{"a":[1,2,3]}}
     doc = Oj::Doc.open(json)
@@ -420,6 +437,21 @@ class DocTest < Minitest::Test
     end
   end
 
+  # Large dumps to a file are written out as the buffer fills and a failed
+  # write raises with the errno of the failure.
+  def test_dump_file
+    json = Oj.dump((0...20000).map { |i| { 'i' => i, 's' => "value #{i}" } }, :mode => :strict)
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    Oj::Doc.open(json) do |doc|
+      doc.dump(nil, filename)
+      assert_equal(json, File.read(filename))
+      if File.exist?('/dev/full')
+        err = assert_raises(IOError) { doc.dump(nil, '/dev/full') }
+        assert(err.message.include?("[#{Errno::ENOSPC::Errno}:"), err.message)
+      end
+    end
+  end
+
   def test_each_leaf
     results = Oj::Doc.open('[1,[2,3]]') do |doc|
       h = {}
@@ -455,4 +487,80 @@ class DocTest < Minitest::Test
     assert_equal({'/x' => true, '/y' => 58, '/z/1' => 1, '/z/2' => 2, '/z/3' => 3}, results)
   end
 
+  def test_lazy
+    json = %|{"a":[1,{"b":"x\\"y","c":[]}],/*z*/"d":{"e":[2.5,null]},"f":{}}|
+    expected = Oj::Doc.open(json) { |doc| [doc.size, doc.fetch, doc.dump] }
+    Oj::Doc.open(json, :lazy => true) do |doc|
+      assert_equal(expected[0], doc.size)
+      assert_equal(Array, doc.type('/a'))
+      assert_equal('x"y', doc.fetch('/a/2/b'))
+      doc.move('/d/e')
+      assert_equal('/d/e', doc.where?)
+      assert_equal(2.5, doc.fetch('1'))
+      assert_equal(['/d/e/1', '/d/e/2'], [].tap { |r| doc.each_child { |d| r << d.where? } })
+      doc.home
+      assert_equal(expected[1], doc.fetch)
+      assert_equal(expected[2], doc.dump)
+    end
+  end
+
+  def test_wide_fetch
+    h = {}
+    100.times { |i| h["k#{i}"] = i }
+    json = %|{"a":#{Oj.dump((1..100).to_a)},"h":#{Oj.dump(h, :mode => :strict)[0..-2]},"a/b":-1,"k5":-2}}|
+    Oj::Doc.open(json) do |doc|
+      # Repeated lookups switch from walking the elements to an index.
+      3.times {
+        100.times { |i|
+          assert_equal(i + 1, doc.fetch("/a/#{i + 1}"))
+          assert_equal(i, doc.fetch("/h/k#{i}"))
+        }
+        assert_equal(1, doc.fetch('/a/0'))
+        assert_nil(doc.fetch('/a/101'))
+        assert_nil(doc.fetch('/h/k100'))
+        assert_equal(-1, doc.fetch('/h/a\\/b'))
+      }
+      doc.move('/h/k42')
+      assert_equal(43, doc.fetch('../k43'))
+    end
+  end
+
+  def test_many_elements
+    obj = (1..3000).map { |i| {'i' => i, 'a' => (0...(i % 7)).to_a, 'h' => {}} }
+    obj << (1..5000).to_a
+    json = Oj.dump(obj, :mode => :strict)
+    [false, true].each { |lazy|
+      Oj::Doc.open(json, :lazy => lazy) do |doc|
+        assert_equal(json, doc.dump)
+        assert_equal(obj, doc.fetch)
+        assert_equal(2999, doc.fetch('/2999/i'))
+        assert_equal(5, doc.fetch('/2995/a/6'))
+        assert_equal(5000, doc.fetch('/3001/5000'))
+      end
+    }
+  end
+
+  def test_lazy_error
+    Oj::Doc.open('[1,[2,}]', :lazy => true) do |doc|
+      assert_equal(1, doc.fetch('/1'))
+      assert_raises(Oj::ParseError) { doc.fetch('/2/1') }
+    end
+    assert_raises(Oj::ParseError) { Oj::Doc.open('[1,"x]', :lazy => true) }
+  end
+
+  def test_deep_nesting
+    depth = 100_000
+    json = '[' * depth + '{"a":1}' + ']' * depth
+    [false, true].each { |lazy|
+      Oj::Doc.open(json, :lazy => lazy) do |doc|
+        assert_equal(Array, doc.type('/1/1/1'))
+        assert_equal(depth + 2, doc.size) unless lazy
+      end
+    }
+    Oj::Doc.open('{"x":' * depth + 'true' + '}' * depth) do |doc|
+      assert_equal(depth + 1, doc.size)
+      assert_equal(Hash, doc.type('/x/x/x'))
+    end
+  end
+
 end # DocTest
@@ -220,6 +220,88 @@ class FileJuice < Minitest::Test
     dump_and_load(DateTime.new(2012, 6, 19), false)
   end
 
+  def test_mmap
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    obj = { 'a' => [1, 2.5, "th\u00e9 \"three\""], 'b' => nil }
+    File.open(filename, 'w') { |f| f.write(Oj.dump(obj, :mode => :strict)) }
+    [true, false, :auto].each { |m|
+      assert_equal(obj, Oj.load_file(filename, :mode => :strict, :mmap => m))
+    }
+    File.open(filename, 'w') { |f| f.write('{"a":[1,2') }
+    assert_raises(Oj::ParseError) { Oj.load_file(filename, :mode => :strict, :mmap => true) }
+  end
+
+  # A file that exactly fills the mapped pages must still be terminated.
+  def test_mmap_whole_pages
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    obj = ['x' * (0x10000 - 4)]
+    File.open(filename, 'w') { |f| f.write(Oj.dump(obj, :mode => :strict)) }
+    assert_equal(0x10000, File.size(filename))
+    assert_equal(obj, Oj.load_file(filename, :mode => :strict, :mmap => true))
+    File.open(filename) { |f| assert_equal(obj, Oj.load(f, :mode => :strict, :mmap => true)) }
+  end
+
+  # File reads and writes are made without the GVL so several threads can
+  # be dumping and loading at once.
+  def test_threaded_io
+    obj = { 'a' => (0...20000).map { |i| "value #{i}" }, 'b' => [1, 2.5, nil, true] }
+    threads = (0...4).map { |t|
+      Thread.new {
+        filename = File.join(File.dirname(__FILE__), "file_test_#{t}.json")
+        begin
+          3.times {
+            Oj.to_file(filename, obj, :mode => :strict)
+            assert_equal(obj, Oj.load_file(filename, :mode => :strict, :mmap => false))
+            File.open(filename, 'w') { |f| Oj.to_stream(f, obj, :mode => :strict) }
+            File.open(filename) { |f| assert_equal(obj, Oj.load(f, :mode => :strict, :mmap => false)) }
+            assert_equal(obj, Oj::Doc.open_file(filename, :mmap => false) { |doc| doc.fetch() })
+          }
+        ensure
+          File.delete(filename) if File.exist?(filename)
+        end
+      }
+    }
+    threads.each { |t| t.join }
+  end
+
+  # Writing more than a pipe holds waits for the reading thread.
+  def test_pipe_stream
+    obj = ['x' * 1_000_000]
+    r, w = IO.pipe
+    reader = Thread.new { r.read }
+    Oj.to_stream(w, obj, :mode => :strict)
+    w.close
+    assert_equal(obj, Oj.load(reader.value, :mode => :strict))
+    r.close
+  end
+
+  class Sink
+    attr_reader :writes, :json
+    def initialize
+      @writes = 0
+      @json = ''
+    end
+    def write(s)
+      @writes += 1
+      @json << s
+    end
+  end
+
+  # Large dumps are written out in pieces as the buffer fills instead of
+  # all at once at the end.
+  def test_flushed_stream
+    obj = (0...20000).map { |i| { 'i' => i, 's' => "value #{i}", 'a' => [nil, true, 1.5], 'e' => {} } }
+    [{ :mode => :strict }, { :mode => :strict, :indent => 2 }, { :mode => :compat, :omit_nil => true }].each { |opts|
+      sink = Sink.new
+      Oj.to_stream(sink, obj, opts)
+      assert(1 < sink.writes)
+      assert_equal(Oj.dump(obj, opts), sink.json)
+      filename = File.join(File.dirname(__FILE__), 'file_test.json')
+      Oj.to_file(filename, obj, opts)
+      assert_equal(Oj.dump(obj, opts), File.read(filename))
+    }
+  end
+
   def dump_and_load(obj, trace=false)
     filename = File.join(File.dirname(__FILE__), 'file_test.json')
     File.open(filename, "w") { |f|
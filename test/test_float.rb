@@ -0,0 +1,77 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+$: << File.dirname(__FILE__)
+
+require 'helper'
+
+# Float parsing must give the same correctly rounded result as strtod which
+# is what String#to_f uses.
+class FloatParseTest < Minitest::Test
+
+  HARD_CASES = %w{
+    0.1
+    0.3
+    1e23
+    8.589973e9
+    9007199254740993.0
+    9007199254740992.999999999999999
+    7.3177701707893310e15
+    123456789012345.6
+    1.00000000000000011102230246251565404236316680908203125
+    2.2250738585072011e-308
+    2.2250738585072014e-308
+    4.35679e-306
+    5e-324
+    4.9406564584124654e-324
+    2.4703282292062327e-324
+    2.4703282292062328e-324
+    1.7976931348623157e308
+    1.7976931348623158e308
+    1e-400
+    1e400
+    0.0e5
+    -0.0
+  }
+
+  def test_hard_cases
+    HARD_CASES.each { |s| check(s) }
+  end
+
+  def test_random_digits
+    rand = Random.new(1234)
+    5000.times {
+      digits = (1..rand.rand(1..25)).map { rand.rand(10).to_s }.join
+      pt = rand.rand(1..digits.size)
+      s = "#{digits[0...pt]}.#{digits[pt..-1]}"
+      s += '0' if s.end_with?('.')
+      s += "e#{rand.rand(-330..310)}" if 0 == rand.rand(2)
+      s = '-' + s if 0 == rand.rand(2)
+      check(s)
+    }
+  end
+
+  def test_random_doubles
+    rand = Random.new(4321)
+    5000.times {
+      d = rand.bytes(8).unpack('d')[0]
+      next if d.nan? || d.infinite?
+      check(d.to_s)
+      check('%.*e' % [rand.rand(0..16), d])
+    }
+  end
+
+  def check(s)
+    expected = s.to_f
+    actual = Oj.load(s, :mode => :strict, :bigdecimal_load => :float)
+    assert(expected.eql?(actual), "#{s} parsed as #{actual} instead of #{expected}")
+    actual = Oj.load("[#{s}]", :mode => :compat, :bigdecimal_load => :float)[0]
+    assert(expected.eql?(actual), "#{s} in array parsed as #{actual} instead of #{expected}")
+    # The default :auto mode returns a Float for 15 or fewer significant digits.
+    if 15 >= s.sub(/e.*/i, '').delete('-.').sub(/^0+/, '').size
+      actual = Oj.load(s, :mode => :strict)
+      assert(expected.eql?(actual), "#{s} auto parsed as #{actual} instead of #{expected}")
+    end
+  end
+
+end # FloatParseTest
@@ -0,0 +1,163 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+$: << File.dirname(__FILE__)
+
+require 'helper'
+
+class NdjsonTest < Minitest::Test
+
+  LINES = %{{"a":1}
+[1,2]
+
+  {"b":true}  \r
+"x"
+}
+
+  def test_string
+    assert_equal([{ 'a' => 1 }, [1, 2], { 'b' => true }, 'x'], Oj.load_ndjson(LINES, :mode => :strict))
+  end
+
+  def test_no_trailing_newline
+    assert_equal([1, 2], Oj.load_ndjson("1\n2", :mode => :strict))
+  end
+
+  def test_batch
+    batches = []
+    json = (1..10).map { |i| %{{"i":#{i}}} }.join("\n")
+    Oj.load_ndjson(json, :mode => :compat, :batch => 4) { |docs, errors|
+      assert_equal([], errors)
+      batches << docs.map { |d| d['i'] }
+    }
+    assert_equal([[1, 2, 3, 4], [5, 6, 7, 8], [9, 10]], batches)
+  end
+
+  def test_error_line
+    err = assert_raises(Oj::ParseError) { Oj.load_ndjson(%{1\n2\n\n[3,}, :mode => :strict) }
+    assert(err.message.include?('line 4'), err.message)
+  end
+
+  def test_skip_errors
+    docs = []
+    errors = []
+    Oj.load_ndjson(%{1\n[2,\n3\n{}{}\n4}, :mode => :strict, :skip_errors => true, :batch => 2) { |d, e|
+      docs += d
+      errors += e
+    }
+    assert_equal([1, 3, 4], docs)
+    assert_equal([2, 4], errors.map { |e| e[0] })
+  end
+
+  def test_break
+    assert_equal(:done, Oj.load_ndjson(%{1\n2\n3}, :mode => :strict, :batch => 1) { |d| break :done })
+    assert_equal([1], Oj.load_ndjson('1', :mode => :strict))
+  end
+
+  def test_file
+    filename = File.join(File.dirname(__FILE__), 'ndjson_test.json')
+    rows = (0...5000).map { |i| { 'i' => i, 's' => 'x' * (i % 100) } }
+    File.open(filename, 'w') { |f| rows.each { |r| f.puts(Oj.dump(r, :mode => :strict)) } }
+    File.open(filename) { |f| assert_equal(rows, Oj.load_ndjson(f, :mode => :strict)) }
+  ensure
+    File.delete(filename) if File.exist?(filename)
+  end
+
+  def test_pipe
+    r, w = IO.pipe
+    writer = Thread.new { 3000.times { |i| w.puts(%{{"i":#{i}}}) }; w.close }
+    cnt = 0
+    Oj.load_ndjson(r, :mode => :strict, :batch => 500) { |docs| cnt += docs.size }
+    writer.join
+    r.close
+    assert_equal(3000, cnt)
+  end
+
+  def test_long_line
+    line = Oj.dump(['y' * 200_000], :mode => :strict)
+    assert_equal([['y' * 200_000]] * 2, Oj.load_ndjson(StringIO.new("#{line}\n#{line}\n"), :mode => :strict))
+  end
+
+  def test_parts
+    json = %{1\n22\n333\n4444\n}
+    assert_equal([[0, 5, 1], [5, 4, 3], [9, 5, 4]], Oj.ndjson_parts(json, 4))
+    assert_equal([[0, json.size, 1]], Oj.ndjson_parts(json, 100))
+  end
+
+  def test_first_line
+    err = assert_raises(Oj::ParseError) { Oj.load_ndjson(%{1\n[}, :mode => :strict, :first_line => 10) }
+    assert(err.message.include?('line 11'), err.message)
+  end
+
+  def test_parallel
+    rows = (0...2000).map { |i| { 'i' => i, 's' => 'x' * (i % 50) } }
+    json = rows.map { |r| Oj.dump(r, :mode => :strict) }.join("\n")
+    assert_equal(rows, Oj.load_ndjson_parallel(json, :mode => :strict, :part_size => 4096, :ractors => 3))
+
+    filename = File.join(File.dirname(__FILE__), 'ndjson_test.json')
+    File.write(filename, json)
+    File.open(filename) { |f|
+      assert_equal(rows, Oj.load_ndjson_parallel(f, :mode => :strict, :part_size => 4096, :ractors => 3))
+    }
+
+    bad = json.sub('"i":1500,', '"i":1500,,')
+    err = assert_raises(Oj::ParseError) {
+      Oj.load_ndjson_parallel(bad, :mode => :strict, :part_size => 4096, :ractors => 3)
+    }
+    assert(err.message.include?('line 1501'), err.message)
+    assert(ractors_finished?)
+    assert_raises(RuntimeError) {
+      Oj.load_ndjson_parallel(json, :mode => :strict, :part_size => 4096, :ractors => 3) { |d, e| raise 'stop' }
+    }
+    assert(ractors_finished?)
+    docs = []
+    errors = []
+    Oj.load_ndjson_parallel(bad, :mode => :strict, :part_size => 4096, :ractors => 3, :skip_errors => true) { |d, e|
+      docs.concat(d)
+      errors.concat(e)
+    }
+    assert_equal(1999, docs.size)
+    assert_equal([1501], errors.map { |e| e[0] })
+
+    only = ['/i']
+    opts = { :mode => :strict, :part_size => 4096, :ractors => 3, :only => only }
+    assert_equal(rows.map { |r| { 'i' => r['i'] } }, Oj.load_ndjson_parallel(json, opts))
+    assert(!only.frozen?)
+    assert(!only[0].frozen?)
+    assert(!opts.frozen?)
+  ensure
+    File.delete(filename) if File.exist?(filename)
+  end
+
+  # Ractors that have been taken may take a moment to be counted as gone.
+  def ractors_finished?
+    return true unless defined?(Ractor)
+    100.times {
+      return true if 1 == Ractor.count
+      sleep(0.01)
+    }
+    false
+  end
+
+  def test_ractor_settings
+    skip 'no Ractors' unless defined?(Ractor)
+    r = Ractor.new {
+      Thread.current.report_on_exception = false
+      begin
+        Oj.default_options = { :mode => :strict }
+      rescue Ractor::UnsafeError
+        Oj.load('{"a":[1,2]}', :mode => :strict, :cache_keys => :global)
+      end
+    }
+    assert_equal({ 'a' => [1, 2] }, r.take)
+    r = Ractor.new {
+      Thread.current.report_on_exception = false
+      Oj.load('{"^":{"x":1}}', :mode => :compat, :create_id => '^', :create_additions => false)
+    }
+    Oj.default_options = { :create_id => 'kind' }
+    Oj.default_options = { :create_id => nil }
+    assert_equal({ '^' => { 'x' => 1 } }, r.take)
+  ensure
+    Oj.default_options = { :create_id => 'json_class' }
+  end
+
+end # NdjsonTest
@@ -734,6 +734,19 @@ class ObjectJuice < Minitest::Test
     dump_and_load(h, false)
   end
 
+  def test_threaded_class_cache
+    json = Oj.dump((1..50).map { |i| Jeez.new(i, i * 2) }, :mode => :object)
+    threads = (1..4).map {
+      Thread.new {
+        20.times.all? {
+          a = Oj.load(json, :mode => :object)
+          50 == a.size && a.all? { |j| Jeez == j.class && j.y == j.x * 2 }
+        }
+      }
+    }
+    threads.each { |t| assert(t.value) }
+  end
+
   def dump_and_load(obj, trace=false)
     json = Oj.dump(obj, :indent => 2, :mode => :object)
     puts json if trace
@@ -0,0 +1,259 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+$: << File.dirname(__FILE__)
+
+require 'helper'
+require 'stringio'
+
+class ParserTest < Minitest::Test
+
+  class Reenter
+    class << self
+      attr_accessor :parser
+    end
+    attr_reader :err
+
+    def initialize(err)
+      @err = err
+    end
+
+    def self.json_create(h)
+      parser.parse('[1]')
+      new(nil)
+    rescue RuntimeError => e
+      new(e)
+    end
+  end
+
+  def test_strict
+    p = Oj::Parser.new(:mode => :strict)
+    assert_equal({ 'a' => [1, 2.5, 'x', nil, true] }, p.parse('{"a":[1,2.5,"x",null,true]}'))
+    assert_equal([], p.parse('[]'))
+    assert_raises(Oj::ParseError) { p.parse('[1,}') }
+  end
+
+  def test_many
+    p = Oj::Parser.new(:mode => :compat)
+    1000.times { |i|
+      assert_equal({ 'i' => i, 'a' => [i] * (i % 100) }, p.parse(%{{"i":#{i},"a":#{([i] * (i % 100)).to_s}}}))
+    }
+  end
+
+  def test_options
+    p = Oj::Parser.new(:mode => :strict, :symbol_keys => true, :quirks_mode => true)
+    assert_equal({ :a => { :b => 2 } }, p.parse('{"a":{"b":2}}'))
+    assert_equal(3, p.parse('3'))
+    p = Oj::Parser.new(:mode => :strict, :quirks_mode => false)
+    assert_raises(Oj::ParseError) { p.parse('3') }
+    p = Oj::Parser.new(:mode => :strict, :nilnil => true)
+    assert_nil(p.parse(nil))
+    assert_raises(ArgumentError) { p.parse(7) }
+    assert_raises(ArgumentError) { Oj::Parser.new(:mode => :bad) }
+  end
+
+  def test_error_then_parse
+    p = Oj::Parser.new(:mode => :strict)
+    assert_raises(Oj::ParseError) { p.parse('{"a":[1,') }
+    assert_equal({ 'a' => [1] }, p.parse('{"a":[1]}'))
+  end
+
+  def test_cache_keys
+    p = Oj::Parser.new(:mode => :strict, :cache_keys => true)
+    k1 = p.parse('{"key":1}').keys[0]
+    k2 = p.parse('[{"key":2}]')[0].keys[0]
+    assert(k1.frozen?)
+    assert_same(k1, k2)
+  end
+
+  def test_only
+    p = Oj::Parser.new(:mode => :strict, :only => ['/a/*/b'])
+    assert_equal({ 'a' => [{ 'b' => 1 }, {}] }, p.parse('{"a":[{"b":1,"c":2},{"c":3}],"d":4}'))
+    assert_equal({ 'a' => [] }, p.parse('{"a":[],"d":4}'))
+  end
+
+  def test_deep
+    p = Oj::Parser.new(:mode => :strict)
+    2.times {
+      v = p.parse('[' * 1000 + '1' + ']' * 1000)
+      999.times { v = v[0] }
+      assert_equal([1], v)
+    }
+    assert_equal([[]], p.parse('[[]]'))
+  end
+
+  def test_reenter
+    p = Oj::Parser.new(:mode => :compat, :create_id => 'json_class')
+    Reenter.parser = p
+    obj = p.parse('{"json_class":"ParserTest::Reenter"}')
+    assert_equal(Reenter, obj.class)
+    assert_equal(RuntimeError, obj.err.class)
+    assert_equal([2], p.parse('[2]'))
+  end
+
+  def test_load
+    p = Oj::Parser.new(:mode => :strict, :quirks_mode => true)
+    io = StringIO.new(%{{"a":1} [2]\n3\n  })
+    assert_equal({ 'a' => 1 }, p.load(io))
+    assert_equal([2], p.load(io))
+    assert_equal(3, p.load(io))
+    assert_raises(EOFError) { p.load(io) }
+    assert_raises(ArgumentError) { p.load('[1]') }
+  end
+
+  def test_load_pipe
+    p = Oj::Parser.new(:mode => :compat)
+    big = 'x' * 20000
+    r, w = IO.pipe
+    writer = Thread.new {
+      3.times { |i| w.write(%{{"i":#{i},"big":"#{big}"}\n[#{i}]}) }
+      w.close
+    }
+    docs = []
+    assert_raises(EOFError) { loop { docs << p.load(r) } }
+    writer.join
+    assert_equal([0, [0], 1, [1], 2, [2]], docs.map { |d| d.is_a?(Hash) ? d['i'] : d })
+    assert_equal(big, docs[2]['big'])
+  end
+
+  def test_load_error
+    p = Oj::Parser.new(:mode => :strict)
+    io = StringIO.new('[1] {"a":} [3]')
+    assert_equal([1], p.load(io))
+    assert_raises(Oj::ParseError) { p.load(io) }
+    assert_equal([4], p.load(StringIO.new('[4]')))
+  end
+
+  class Collector < Oj::ScHandler
+    attr_reader :calls
+
+    def initialize
+      @calls = []
+    end
+
+    def hash_start
+      {}
+    end
+
+    def hash_set(h, key, value)
+      h[key] = value
+    end
+
+    def array_start
+      []
+    end
+
+    def array_append(a, value)
+      a << value
+    end
+
+    def add_value(value)
+      @calls << value
+    end
+  end
+
+  PUSH_JSON = <<'JSON'
+{"a":[1,2.5e3,"x\"y}",{"b":null}],"c":"\u00e9]"} [true] "top" 12
+-3.5e2 /* c { */ {"d":[]} // x ]
+ null  7
+JSON
+  PUSH_VALUES = [{ 'a' => [1, 2500.0, 'x"y}', { 'b' => nil }], 'c' => "\u00e9]" },
+                 [true], 'top', 12, -350.0, { 'd' => [] }, nil, 7]
+
+  def test_push_bytes
+    p = Oj::PushParser.new(:mode => :compat, :quirks_mode => true)
+    values = []
+    PUSH_JSON.each_char { |c| values.concat(p.feed(c)) }
+    values.concat(p.finish)
+    assert_equal(PUSH_VALUES, values)
+  end
+
+  def test_push_chunks
+    [2, 5, 11, 64].each { |n|
+      values = []
+      p = Oj::PushParser.new(:mode => :strict, :quirks_mode => true) { |v| values << v }
+      PUSH_JSON.b.scan(/.{1,#{n}}/m).each { |chunk| assert_nil(p.feed(chunk.force_encoding('UTF-8'))) }
+      p.finish
+      assert_equal(PUSH_VALUES, values)
+    }
+  end
+
+  def test_push_handler
+    h = Collector.new
+    p = Oj::PushParser.new(h, :quirks_mode => true)
+    p.feed('{"a":[1,{"b"')
+    assert_equal([], h.calls)
+    p.feed(':2}]} 3')
+    assert_equal([{ 'a' => [1, { 'b' => 2 }] }], h.calls)
+    p.finish
+    assert_equal([{ 'a' => [1, { 'b' => 2 }] }, 3], h.calls)
+  end
+
+  class Tracer < Collector
+    def array_start
+      @calls << :array_start
+      []
+    end
+
+    def array_append(a, value)
+      @calls << value
+      a << value
+    end
+
+    def array_end
+      @calls << :array_end
+    end
+  end
+
+  # The elements of a top level array are delivered as each one completes
+  # instead of when the array closes.
+  def test_push_array_elements
+    h = Tracer.new
+    p = Oj::PushParser.new(h)
+    p.feed('[{"a":[1,')
+    assert_equal([], h.calls)
+    p.feed('2]}, "x" ,')
+    assert_equal([:array_start, :array_start, 1, 2, :array_end, { 'a' => [1, 2] }, 'x'], h.calls)
+    p.feed('3')
+    assert_equal(7, h.calls.size)
+    p.feed(' ] ')
+    assert_equal([3, :array_end, [{ 'a' => [1, 2] }, 'x', 3]], h.calls[7..-1])
+
+    values = []
+    p = Oj::PushParser.new(:mode => :strict) { |v| values << v }
+    rows = (0...1000).map { |i| { 'i' => i, 's' => 'x' * (i % 20) } }
+    Oj.dump(rows, :mode => :strict, :indent => 1).scan(/.{1,7}/m).each { |chunk| p.feed(chunk) }
+    assert_equal([rows], values)
+
+    p = Oj::PushParser.new(:mode => :strict)
+    assert_raises(Oj::ParseError) { p.feed('[1,x,3] [4') }
+    assert_equal([[4, 5]], p.feed(',5]'))
+    assert_equal([], p.feed('[6,7,'))
+    assert_raises(Oj::ParseError) { p.finish }
+    assert_equal([[8]], p.feed('[8]'))
+  end
+
+  def test_push_errors
+    p = Oj::PushParser.new(:mode => :strict)
+    assert_raises(Oj::ParseError) { p.feed('[1,}') }
+    assert_equal([[3]], p.feed('[3]'))
+    assert_equal([], p.feed('["4'))
+    assert_raises(Oj::ParseError) { p.finish }
+    assert_equal([[5]], p.feed('[5]'))
+    assert_equal([], p.finish)
+  end
+
+  def test_push_reenter
+    p = nil
+    err = nil
+    p = Oj::PushParser.new(:mode => :strict) { |v|
+      begin
+        p.feed('[2]')
+      rescue RuntimeError => e
+        err = e
+      end
+    }
+    p.feed('[1]')
+    assert_equal(RuntimeError, err.class)
+  end
+end
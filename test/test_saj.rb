@@ -173,6 +173,48 @@ class SajTest < Minitest::Test
                   [:hash_end, nil]], handler.calls)
   end
 
+  def test_escaped_key
+    handler = AllSaj.new()
+    json = %{{"a\\u0062":[1],"c":{"d":"e\\n"}}}
+    Oj.saj_parse(handler, json)
+    assert_equal([[:hash_start, nil],
+                  [:array_start, 'ab'],
+                  [:add_value, 1, nil],
+                  [:array_end, 'ab'],
+                  [:hash_start, 'c'],
+                  [:add_value, "e\n", 'd'],
+                  [:hash_end, 'c'],
+                  [:hash_end, nil]], handler.calls)
+  end
+
+  def test_io
+    handler = AllSaj.new()
+    Oj.saj_parse(handler, StringIO.new($json))
+    expected = AllSaj.new()
+    Oj.saj_parse(expected, $json)
+    assert_equal(expected.calls, handler.calls)
+  end
+
+  def test_pipe_stream
+    counter = Class.new(Oj::Saj) {
+      attr_reader :count
+      def add_value(value, key)
+        @count = (@count || 0) + 1
+      end
+    }.new
+    r, w = IO.pipe
+    writer = Thread.new {
+      w.write('[')
+      20000.times { |i| w.write(%{{"i":#{i},"s":"#{'x' * 40}"},}) }
+      w.write('null]')
+      w.close
+    }
+    Oj.saj_parse(counter, r)
+    writer.join
+    r.close
+    assert_equal(40001, counter.count)
+  end
+
   def test_fixnum_bad
     handler = AllSaj.new()
     json = %{12345xyz}
@@ -180,7 +222,45 @@ class SajTest < Minitest::Test
     assert_equal([:add_value, 12345, nil], handler.calls.first)
     type, message, line, column = handler.calls.last
     assert_equal([:error, 1, 6], [type, line, column])
-    assert_match(%r{invalid format, extra characters at line 1, column 6 \[(?:[a-z\.]+/)*saj\.c:\d+\]}, message)
+    assert_match(%r{unexpected characters after the JSON document at line 1, column 6 \[(?:[a-z\.]+/)*parse\.c:\d+\]}, message)
+  end
+
+  def test_not_terminated
+    [%{[1,2}, StringIO.new(%{[1,2})].each { |json|
+      handler = AllSaj.new()
+      Oj.saj_parse(handler, json)
+      assert_equal([[:array_start, nil],
+                    [:add_value, 1, nil],
+                    [:add_value, 2, nil]], handler.calls[0..-2])
+      type, message, line, column = handler.calls.last
+      assert_equal([:error, 1, 4], [type, line, column])
+      assert_match(%r{^Array not terminated at line 1, column 4 }, message)
+    }
+    assert_raises(Oj::ParseError) { Oj.saj_parse(Oj::Saj.new, %{[1,2}) }
+  end
+
+  def test_empty_element
+    [%{[1,,2]}, StringIO.new(%{[1,,2]})].each { |json|
+      handler = AllSaj.new()
+      Oj.saj_parse(handler, json)
+      assert_equal([[:array_start, nil], [:add_value, 1, nil]], handler.calls[0..-2])
+      type, message, line, column = handler.calls.last
+      assert_equal([:error, 1, 4], [type, line, column])
+      assert_match(%r{^unexpected comma at line 1, column 4 }, message)
+    }
+  end
+
+  def test_extra_document
+    [%{[1]\n [2]}, StringIO.new(%{[1]\n [2]})].each { |json|
+      handler = AllSaj.new()
+      Oj.saj_parse(handler, json)
+      assert_equal([[:array_start, nil],
+                    [:add_value, 1, nil],
+                    [:array_end, nil]], handler.calls[0..-2])
+      type, message, line, column = handler.calls.last
+      assert_equal([:error, 2, 2], [type, line, column])
+      assert_match(%r{^unexpected characters after the JSON document at line 2, column 2 }, message)
+    }
   end
 
 end
@@ -72,6 +72,15 @@ class AllHandler < Oj::ScHandler
 
 end # AllHandler
 
+class SkipHandler < AllHandler
+  def hash_key(key)
+    @calls << [:hash_key, key]
+    return Oj::ScHandler::SKIP unless 'num' == key
+    key
+  end
+
+end # SkipHandler
+
 class Closer < AllHandler
   attr_accessor :io
   def initialize(io)
@@ -257,6 +266,52 @@ class ScpTest < Minitest::Test
                   [:add_value, {}]], handler.calls)
   end
 
+  def test_skip
+    handler = SkipHandler.new()
+    json = '{"a":[1,{"b":"x]}"}],"num":3,"s":"q\\\\\\"}",/* } */"h":{"c":[]}}'
+    Oj.sc_parse(handler, json)
+    assert_equal([[:hash_start],
+                  [:hash_key, 'a'],
+                  [:hash_key, 'num'],
+                  [:hash_set, 'num', 3],
+                  [:hash_key, 's'],
+                  [:hash_key, 'h'],
+                  [:hash_end],
+                  [:add_value, {}]], handler.calls)
+  end
+
+  def test_skip_stream
+    handler = SkipHandler.new()
+    Oj.sc_parse(handler, StringIO.new($json))
+    assert_equal([[:hash_start],
+                  [:hash_key, 'array'],
+                  [:hash_key, 'boolean'],
+                  [:hash_end],
+                  [:add_value, {}]], handler.calls)
+  end
+
+  def test_skip_bad
+    ['{"a":}', '{"a":[1,2}', '{"a":"x'].each do |json|
+      assert_raises(Oj::ParseError) { Oj.sc_parse(SkipHandler.new(), json) }
+      assert_raises(Oj::ParseError) { Oj.sc_parse(SkipHandler.new(), StringIO.new(json)) }
+    end
+  end
+
+  # Skipped values are not validated beyond string and bracket boundaries.
+  def test_skip_unchecked
+    json = '{"a":{"b":[1,,tru]},"num":3}'
+    [json, StringIO.new(json)].each do |input|
+      handler = SkipHandler.new()
+      Oj.sc_parse(handler, input)
+      assert_equal([[:hash_start],
+                    [:hash_key, 'a'],
+                    [:hash_key, 'num'],
+                    [:hash_set, 'num', 3],
+                    [:hash_end],
+                    [:add_value, {}]], handler.calls)
+    end
+  end
+
   def test_double
     handler = AllHandler.new()
     json = %{{"one":true,"two":false}{"three":true,"four":false}}
@@ -243,6 +243,103 @@ class StrictJuice < Minitest::Test
     assert_equal([{ 'x' => 1 }, { 'y' => 2 }], results)
   end
 
+  # Large documents are parsed using a structural index built before parsing.
+  def test_large_indexed
+    row = { 'a"b\\' => ['x\\', '\\"', "y\\\\\"z", 1.5, -7, true, nil, {}], 'c' => { ' d ' => '[{,:}]' } }
+    obj = (0...4000).map { |i| row.merge('i' => i) }
+    [Oj.dump(obj, :mode => :strict), Oj.dump(obj, :mode => :strict, :indent => 2)].each { |json|
+      assert(256 * 1024 < json.size)
+      assert_equal(obj, Oj.strict_load(json))
+    }
+    json = Oj.dump(obj, :mode => :strict)
+    assert_raises(Oj::ParseError) { Oj.strict_load(json.sub('"i":3999', '"i":3999x')) }
+    assert_raises(Oj::ParseError) { Oj.strict_load(json.sub('true', 'truex')) }
+    assert_equal(obj, Oj.load(json.sub('[', '[ /* x */ '), :mode => :compat))
+  end
+
+  # Containers in indexed documents are created with the member count from
+  # the index so sizes must come out right however the members are nested.
+  def test_large_sized
+    obj = (0...3000).map { |i|
+      { 'e' => [], 'h' => {}, 'n' => [[], [{}], [[1, ','], { ',' => [2] }]], 'a' => (0...(i % 40)).to_a, "k#{i}" => { ',' => ']' } }
+    }
+    json = Oj.dump(obj, :mode => :strict)
+    assert(256 * 1024 < json.size)
+    assert_equal(obj, Oj.strict_load(json))
+    assert_raises(Oj::ParseError) { Oj.strict_load(json.sub('[]', ']]')) }
+    assert_raises(Oj::ParseError) { Oj.strict_load(json.sub('{}', '{,}')) }
+  end
+
+  # Documents where every byte is a token fill the index completely, which
+  # must still leave room for the end marker.
+  def test_large_dense
+    [1024, 256 * 1024, 256 * 1024 + 64].each { |len|
+      json = '[' + '1,' * ((len - 4) / 2) + '[]]'
+      assert_equal(len, json.size)
+      obj = Oj.strict_load(json)
+      assert_equal((len - 4) / 2 + 1, obj.size)
+      assert_equal([], obj[-1])
+    }
+    json = Oj.dump((0...30000).map { |i| { 'i' => i } }, :mode => :strict, :indent => 1)
+    assert_equal(30000, Oj.compat_load(json.sub('"i":29000', '"i":/* x */29000')).size)
+  end
+
+  def test_only
+    json = %{{"user":{"id":7,"name":"x","tags":[1,2]},"items":[{"sku":"a","n":1},2,{"sku":"b","x":{"y":"]"}}],"w":null}}
+    expected = {'user' => {'id' => 7}, 'items' => [{'sku' => 'a'}, {'sku' => 'b'}]}
+    [json, StringIO.new(json)].each { |input|
+      assert_equal(expected, Oj.strict_load(input, :only => ['/user/id', '/items/*/sku']))
+      input.rewind if input.respond_to?(:rewind)
+    }
+    assert_equal({'user' => {'id' => 7, 'name' => 'x', 'tags' => [1, 2]}, 'w' => nil},
+                 Oj.strict_load(json, :only => ['/user', '/w']))
+    assert_equal({'user' => {'id' => 7}, 'items' => []}, Oj.strict_load(json, :only => ['/*/id']))
+    assert_equal({'a/b' => 1, 'c~' => 2}, Oj.strict_load('{"a/b":1,"c~":2,"d":3}', :only => ['/a~1b', '/c~0']))
+    assert_equal(Oj.strict_load(json), Oj.strict_load(json, :only => ['']))
+    assert_raises(Oj::ParseError) { Oj.strict_load('{"a":[1,}', :only => ['/b']) }
+    # Skipped values are not validated beyond string and bracket boundaries.
+    ['{"a":{"b":[1,2,}},"c":1}', StringIO.new('{"a":{"b":[1,2,}},"c":1}')].each { |input|
+      assert_equal({'c' => 1}, Oj.strict_load(input, :only => ['/c']))
+    }
+    assert_raises(ArgumentError) { Oj.strict_load(json, :only => ['user']) }
+  end
+
+  def test_number_run
+    nums = (0...300).map { |i| [i, -i * 1_000_000_007, i * 0.25, 10**20 + i] }.flatten
+    assert_equal({ 'n' => nums, 'm' => [1, 'x', 2] }, Oj.strict_load(Oj.dump({ 'n' => nums, 'm' => [1, 'x', 2] }, :mode => :strict)))
+    assert_equal([[1, 2], [], [3, [4]], 5], Oj.strict_load('[ [1 ,2] ,[],[3,[4]],5 ]'))
+    assert_raises(Oj::ParseError) { Oj.strict_load('[1,2,]') }
+    assert_raises(Oj::ParseError) { Oj.strict_load('[1,2 3]') }
+    assert_raises(Oj::ParseError) { Oj.strict_load('[1,-Infinity]') }
+  end
+
+  def test_packed
+    json = '{"t":[1, 2.5,-3,1e3],"s":[{"v":[1,2]},{"v":[]}],"x":[1,2]}'
+    expected = { 't' => [1.0, 2.5, -3.0, 1000.0], 's' => [{ 'v' => [1.0, 2.0] }, { 'v' => [] }], 'x' => [1, 2] }
+    [json, StringIO.new(json)].each { |input|
+      obj = Oj.strict_load(input, :packed => ['/t', '/s/*/v'])
+      assert_equal(Encoding::ASCII_8BIT, obj['t'].encoding)
+      obj['t'] = obj['t'].unpack('d*')
+      obj['s'].each { |h| h['v'] = h['v'].unpack('d*') }
+      assert_equal(expected, obj)
+    }
+    assert_equal([1.0, 2.0], Oj.strict_load('[1,2]', :packed => ['']).unpack('d*'))
+    assert_equal({ 't' => [1.0, 2.5, -3.0, 1000.0].pack('d*') }, Oj.strict_load(json, :packed => ['/t'], :only => ['/t']))
+    assert_raises(Oj::ParseError) { Oj.strict_load('{"t":[1,"2"]}', :packed => ['/t']) }
+    assert_raises(Oj::ParseError) { Oj.strict_load(StringIO.new('{"t":[1,[2]]}'), :packed => ['/t']) }
+    assert_raises(ArgumentError) { Oj.strict_load(json, :packed => ['t']) }
+  end
+
+  # Packed arrays follow the strict number rules whichever parser reads them.
+  def test_packed_special
+    ['[1,Infinity]', '[-Infinity]', '[NaN,2]', '[1,-NaN]'].each { |json|
+      msgs = [json, StringIO.new(json)].map { |input|
+        assert_raises(Oj::ParseError) { Oj.strict_load(input, :packed => ['']) }.message.sub(/ \[.*/, '')
+      }
+      assert_equal(msgs[0], msgs[1])
+    }
+  end
+
   def dump_and_load(obj, trace=false)
     json = Oj.dump(obj, :indent => 2)
     puts json if trace
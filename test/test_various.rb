@@ -139,6 +139,9 @@ class Juice < Minitest::Test
       :quirks_mode=>false,
       :allow_invalid_unicode=>true,
       :float_precision=>13,
+      :float_format=>:fast,
+      :mmap=>false,
+      :cache_keys=>:global,
       :mode=>:strict,
       :escape_mode=>:ascii,
       :time_format=>:unix_zone,
@@ -151,6 +154,8 @@ class Juice < Minitest::Test
       :nan=>:huge,
       :hash_class=>Hash,
       :omit_nil=>false,
+      :only=>['/a'],
+      :packed=>['/p'],
     }
     Oj.default_options = alt
     opts = Oj.default_options()
@@ -228,6 +233,69 @@ class Juice < Minitest::Test
     assert_equal('-95.640172', Oj.dump(-95.640172))
   end
 
+  def test_float_dump_fast
+    Oj.default_options = { :float_format => :fast }
+    assert_equal('1405460727.723866', Oj.dump(1405460727.723866))
+    assert_equal('0.1', Oj.dump(0.1))
+    assert_equal('-95.640172', Oj.dump(-95.640172))
+    assert_equal('0.0001', Oj.dump(0.0001))
+    assert_equal('1.0e-05', Oj.dump(0.00001))
+    assert_equal('1.2345e+20', Oj.dump(1.2345e20))
+    assert_equal('5.0e-324', Oj.dump(5.0e-324))
+    assert_equal('100.0', Oj.dump(100.0))
+    [0.56, 2.0 / 3.0, 1.7976931348623157e308, 2.2250738585072014e-308, 123456.789e-15].each { |f|
+      assert_equal(Oj.dump(f, :float_format => :ruby, :float_precision => 0), Oj.dump(f))
+    }
+  end
+
+  def test_cache_keys
+    json = %{[{"a":1,"b":{"a":2}},{"a":3,"b":{"a":4}}]}
+    Oj.key_cache_clear
+    obj = Oj.load(json, :mode => :strict, :cache_keys => true)
+    assert_equal([{'a'=>1,'b'=>{'a'=>2}},{'a'=>3,'b'=>{'a'=>4}}], obj)
+    keys = obj.map { |h| h.keys }.flatten + obj.map { |h| h['b'].keys }.flatten
+    assert(keys.all? { |k| k.frozen? })
+    assert(obj[0].keys[0].equal?(obj[1]['b'].keys[0]))
+    assert_equal({:hits=>4, :misses=>2, :size=>0}, Oj.key_cache_stats)
+
+    obj = Oj.load(json, :mode => :compat, :cache_keys => :global, :symbol_keys => true)
+    assert_equal([{:a=>1,:b=>{:a=>2}},{:a=>3,:b=>{:a=>4}}], obj)
+    Oj.load(json, :mode => :compat, :cache_keys => :global, :symbol_keys => true)
+    assert_equal({:hits=>14, :misses=>4, :size=>2}, Oj.key_cache_stats)
+    Oj.key_cache_clear
+    assert_equal({:hits=>0, :misses=>0, :size=>0}, Oj.key_cache_stats)
+  end
+
+  def test_cache_keys_clear_in_load
+    json = (0...20).map { |i| %{{"a#{i % 3}":#{i},"b":{"a#{i % 3}":[#{i}]}}} }.join("\n")
+    [false, true].each { |sym|
+      docs = []
+      Oj.load(json, :mode => :strict, :cache_keys => :global, :symbol_keys => sym) { |doc|
+        Oj.key_cache_clear
+        docs << doc
+      }
+      assert_equal(20, docs.size)
+      k = sym ? :b : 'b'
+      docs.each_with_index { |doc, i| assert_equal([i], doc[k].values[0]) }
+    }
+    Oj.key_cache_clear
+  end
+
+  def test_cache_keys_stats_ractors
+    return unless defined?(Ractor)
+    Oj.key_cache_clear
+    json = Ractor.make_shareable('[' + (0...5000).map { |i| %{{"a":#{i},"b":#{i}}} }.join(',') + ']')
+    (0...4).map {
+      Ractor.new(json) { |j|
+        10.times { Oj.load(j, :mode => :strict, :cache_keys => :global) }
+        nil
+      }
+    }.each { |r| r.take }
+    stats = Oj.key_cache_stats
+    assert_equal(4 * 10 * 10000, stats[:hits] + stats[:misses])
+    Oj.key_cache_clear
+  end
+
   def test_nan_dump
     assert_equal('null', Oj.dump(0/0.0, :mode => :strict, :nan => :null))
     assert_equal('NaN', Oj.dump(0/0.0, :mode => :strict, :nan => :word))